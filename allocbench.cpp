@@ -0,0 +1,114 @@
+// Heap allocations and list walk time for a generated playlist, with nodes
+// from NodePool against one new per song, the way the playlist allocated
+// before the pool. Counts every operator new while the nodes are made; the
+// copies of the names are the same both ways and reported apart. Then times
+// a walk along next over the ring as built, and again after half the songs
+// were deleted and as many added back, which is where a heap scatters them.
+//
+//   allocbench [songs]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <new>
+#define SOUNDLIST_NO_SFML
+#include "musicplayer.h"
+using namespace std;
+
+static size_t allocations = 0;
+
+void* operator new(size_t bytes){
+    allocations++;
+    if(void* p = malloc(bytes ? bytes : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void* p) noexcept{ free(p); }
+void operator delete(void* p, size_t) noexcept{ free(p); }
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+static void link(vector<node*>& ring){
+    size_t n = ring.size();
+    for(size_t i = 0; i < n; i++){
+        ring[i]->next = ring[(i + 1) % n];
+        ring[i]->prev = ring[(i + n - 1) % n];
+    }
+}
+
+// ms per walk once around the ring, best of a few
+static double walk(node* head){
+    double best = 1e30;
+    volatile float sink = 0;
+    for(int r = 0; r < 5; r++){
+        auto t = chrono::steady_clock::now();
+        float sum = 0;
+        node* n = head;
+        do{ sum += n->duration; n = n->next; } while(n != head);
+        sink = sink + sum;
+        best = min(best, msSince(t));
+    }
+    return best;
+}
+
+struct Result{
+    size_t allocs;
+    double built, churned;
+};
+
+// Builds songs nodes with make, walks, frees a random half with drop,
+// makes as many again at the end and walks once more
+template<class Make, class Drop>
+static Result run(int songs, Make make, Drop drop){
+    mt19937 rng(7);
+    Result r;
+    vector<node*> ring;
+    ring.reserve(songs);
+    vector<string> names;
+    for(int i = 0; i < songs; i++) names.push_back("Artist " + to_string(rng() % 5000) + " - song " + to_string(i));
+    size_t before = allocations;
+    for(int i = 0; i < songs; i++){
+        node* n = make(names[i]);
+        n->duration = (float)(rng() % 600);
+        ring.push_back(n);
+    }
+    r.allocs = allocations - before;
+    link(ring);
+    r.built = walk(ring[0]);
+
+    shuffle(ring.begin(), ring.end(), rng);
+    for(int i = songs / 2; i < songs; i++) drop(ring[i]);
+    ring.resize(songs / 2);
+    for(int i = songs / 2; i < songs; i++){
+        node* n = make(names[i]);
+        n->duration = (float)(rng() % 600);
+        ring.push_back(n);
+    }
+    // the songs kept in playlist order, as if only the deleted ones moved
+    sort(ring.begin(), ring.begin() + songs / 2);
+    link(ring);
+    r.churned = walk(ring[0]);
+    return r;
+}
+
+int main(int argc, char** argv){
+    int songs = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    Result heap = run(songs, [](const string& s){ return new node(s); }, [](node* n){ delete n; });
+    NodePool pool;
+    Result pooled = run(songs, [&](const string& s){ return pool.alloc(s); }, [&](node* n){ pool.release(n); });
+
+    size_t before = allocations;
+    { node probe("Artist 1234 - song 123456"); }
+    size_t perName = allocations - before;
+    printf("%d songs, names allocate %zu of the counts below\n", songs, perName * songs);
+    printf("  new per song  %9zu allocations, walk %7.2f ms, after churn %7.2f ms\n", heap.allocs, heap.built,
+           heap.churned);
+    printf("  NodePool      %9zu allocations (%zu slabs), walk %7.2f ms, after churn %7.2f ms\n", pooled.allocs,
+           pool.slabAllocs, pooled.built, pooled.churned);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "mixer.h"
+using namespace std;
+
+class SampleTap;
+
+enum class PlaybackStatus{ Stopped, Paused, Playing };
+
+// Everything MusicPlayer needs from an audio output. Offsets and durations are
+// in seconds and relative to the audible track. Tags are NodePool handles and
+// let a backend keep the upcoming track ready for a gapless change.
+class AudioBackend{
+public:
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+
+    virtual ~AudioBackend(){}
+
+    virtual bool open(const string& path, uint32_t tag) = 0;   // stops, then loads
+    virtual bool isOpen() const = 0;
+    virtual void play() = 0;
+    virtual void pause() = 0;
+    virtual void stop() = 0;
+    virtual PlaybackStatus status() const = 0;
+
+    virtual void seek(float seconds) = 0;
+    virtual float offset() const = 0;
+    virtual float duration() const = 0;
+    virtual unsigned sampleRate() const = 0;
+
+    virtual void setVolume(float v) = 0;     // 0-100
+    virtual float volume() const = 0;
+    virtual void setGain(float g) = 0;       // per-track linear gain on top of volume
+
+    // Keep path ready to follow the current track; cheap to call every frame
+    virtual void prefetch(const string& path, uint32_t tag) = 0;
+    virtual uint32_t queuedTag() const = 0;
+    virtual void dropQueued() = 0;
+    // True once the output has moved on to the prefetched track by itself
+    virtual bool pollTransition() = 0;
+
+    // Crossfading between tracks, for outputs that mix; 0 seconds is off.
+    // crossfadeTo() fades into path for a change the player has already made;
+    // false means it can't (off, not playing) and path should be open()ed.
+    virtual void setCrossfade(float seconds, FadeShape shape){ (void)seconds; (void)shape; }
+    virtual bool crossfadeTo(const string& path, uint32_t tag){ (void)path; (void)tag; return false; }
+
+    // Times the output ran dry, for the UI
+    virtual unsigned long long underruns() const{ return 0; }
+
+    // Called once per player update; simulated outputs advance their clock here
+    virtual void tick(){}
+
+    // Copy of the PCM being played goes here, for the spectrum analyzer
+    virtual void setTap(SampleTap* tap){ (void)tap; }
+};
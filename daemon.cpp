@@ -0,0 +1,300 @@
+// Headless player. Owns a PlayerController and serves the protocol in ipc.h
+// on a Unix domain socket from a single epoll loop: batches from every client
+// go through the controller's command ring, and whenever a published snapshot
+// differs from the last state told, every subscriber gets a STATE message.
+// The message is built once and the same bytes go to all of them. Nothing
+// queues up for a subscriber that cannot keep up: while its socket is full it
+// is only marked stale, and gets the newest state once it drains.
+//
+//   daemon [socket] [--session DIR | --no-session] [--null]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+using namespace std;
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <csignal>
+#include "playercontrol.h"
+#include "ipc.h"
+
+const int MAX_EVENTS = 256;
+const size_t MAX_BACKLOG = 8u << 20;    // unsent bytes before a client that does not read is dropped
+
+class Daemon{
+public:
+    Daemon(const string& socketPath, unique_ptr<AudioBackend> backend, const string& sessionDir)
+        : path(socketPath), player(0, move(backend), sessionDir){}
+
+    ~Daemon(){
+        player.onPublish(nullptr);      // the control thread outlives the fds below
+        for(auto& kv : clients) close(kv.first);
+        for(int fd : {listener, wake, signals, poller}) if(fd >= 0) close(fd);
+        if(listener >= 0) unlink(path.c_str());
+    }
+
+    // Serves until SIGINT or SIGTERM; the caller has blocked both
+    bool run(){
+        listener = ipcListen(path);
+        if(listener < 0){ perror(("daemon: " + path).c_str()); return false; }
+        wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        poller = epoll_create1(EPOLL_CLOEXEC);
+        if(wake < 0 || signals < 0 || poller < 0){ perror("daemon"); return false; }
+        for(int fd : {listener, wake, signals}) watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        int fd = wake;
+        player.onPublish([fd]{
+            uint64_t one = 1;
+            ssize_t n = write(fd, &one, sizeof one);
+            (void)n;    // a full counter already means "wake up"
+        });
+        printf("daemon: listening on %s, %s\n", path.c_str(),
+               player.restored() ? "session restored" : "new session");
+        fflush(stdout);
+
+        epoll_event events[MAX_EVENTS];
+        while(true){
+            int n = epoll_wait(poller, events, MAX_EVENTS, -1);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                perror("daemon: epoll_wait");
+                return false;
+            }
+            for(int i = 0; i < n; i++){
+                int fd = events[i].data.fd;
+                if(fd == signals) return true;
+                if(fd == listener) accept();
+                else if(fd == wake) published();
+                else if(clients.count(fd)) serve(fd, events[i].events);
+            }
+        }
+    }
+
+private:
+    struct Client{
+        IpcInbox in;
+        vector<char> out;
+        size_t sent = 0;
+        bool subscribed = false;
+        bool stale = false;     // missed a state while out was still draining
+        bool writing = false;   // waiting for EPOLLOUT
+    };
+
+    string path;
+    PlayerController player;
+    int listener = -1, wake = -1, signals = -1, poller = -1;
+    unordered_map<int, unique_ptr<Client>> clients;
+    IpcState told;              // last state sent out
+    vector<char> stateMessage;  // told, framed
+    bool haveState = false;
+
+    void watch(int fd, uint32_t events, int op){
+        epoll_event e{};
+        e.events = events;
+        e.data.fd = fd;
+        epoll_ctl(poller, op, fd, &e);
+    }
+
+    void accept(){
+        while(true){
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0) return;
+            clients[fd].reset(new Client());
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void drop(int fd){
+        epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(fd);
+    }
+
+    void serve(int fd, uint32_t events){
+        Client& c = *clients[fd];
+        if(events & EPOLLOUT){
+            if(!flush(fd, c)) return;
+        }
+        if(!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+        bool open = c.in.fill(fd);
+        IpcType type;
+        RecordReader body{nullptr, nullptr};
+        while(c.in.next(type, body)){
+            bool ok = false;
+            if(type == IpcType::BATCH) ok = batch(c, body);
+            else if(type == IpcType::SUBSCRIBE){
+                c.subscribed = true;
+                ok = true;
+                if(haveState) c.out.insert(c.out.end(), stateMessage.begin(), stateMessage.end());
+            }
+            if(!ok){ drop(fd); return; }    // not speaking the protocol
+        }
+        if(!open || c.in.broken){ drop(fd); return; }
+        flush(fd, c);
+    }
+
+    // Queues every op of a batch, then acknowledges it
+    bool batch(Client& c, RecordReader& r){
+        uint32_t id = r.u32(), count = r.u32();
+        for(uint32_t i = 0; i < count && r.ok; i++){
+            uint8_t op = 0;
+            r.get(&op, 1);
+            Command cmd;
+            switch((IpcOp)op){
+                case IpcOp::PLAY:      cmd.type = Cmd::PLAY; break;
+                case IpcOp::PAUSE:     cmd.type = Cmd::PAUSE; break;
+                case IpcOp::RESUME:    cmd.type = Cmd::RESUME; break;
+                case IpcOp::STOP:      cmd.type = Cmd::STOP; break;
+                case IpcOp::NEXT:      cmd.type = Cmd::NEXT; break;
+                case IpcOp::PREV:      cmd.type = Cmd::PREV; break;
+                case IpcOp::RANDOM:    cmd.type = Cmd::RANDOM; break;
+                case IpcOp::SHUFFLE:   cmd.type = Cmd::SHUFFLE; break;
+                case IpcOp::SELECT:    cmd.type = Cmd::SELECT; cmd.pos = (int)r.u32(); break;
+                case IpcOp::REMOVE:    cmd.type = Cmd::REMOVE; cmd.pos = (int)r.u32(); break;
+                case IpcOp::ADD:       cmd.type = Cmd::ADD; r.str(cmd.text); break;
+                case IpcOp::IMPORT:    cmd.type = Cmd::IMPORT; r.str(cmd.text); break;
+                case IpcOp::EXPORT:    cmd.type = Cmd::EXPORT; r.str(cmd.text); break;
+                case IpcOp::MOVE:      cmd.type = Cmd::MOVE; cmd.pos = (int)r.u32(); cmd.to = (int)r.u32(); break;
+                case IpcOp::UNDO:      cmd.type = Cmd::UNDO; break;
+                case IpcOp::REDO:      cmd.type = Cmd::REDO; break;
+                case IpcOp::DEDUPE:    cmd.type = Cmd::DEDUPE; break;
+                case IpcOp::CROSSFADE: cmd.type = Cmd::CROSSFADE; cmd.pos = (int)min(r.u32(), (uint32_t)MAX_CROSSFADE); break;
+                case IpcOp::FADESHAPE: cmd.type = Cmd::FADESHAPE; cmd.pos = (int)(r.u32() % 3); break;
+                case IpcOp::LOG:       cmd.type = Cmd::LOG; r.str(cmd.text); break;
+                case IpcOp::SORT:      cmd.type = Cmd::SORT; r.str(cmd.text); break;
+                case IpcOp::ADD_TRACKS:{
+                    uint32_t n = r.u32();
+                    if((size_t)(r.end - r.p) < (size_t)n * 8) return false;    // two lengths at least per track
+                    cmd.type = Cmd::ADD_TRACKS;
+                    cmd.tracks.resize(n);
+                    for(TrackInfo& t : cmd.tracks){ r.str(t.name); r.str(t.path); }
+                    break;
+                }
+                case IpcOp::SEEK:      player.seekTo(r.f32()); continue;
+                case IpcOp::VOLUME:    player.setVolume(r.f32()); continue;
+                default:               return false;
+            }
+            if(!r.ok) return false;
+            player.post(move(cmd));
+        }
+        if(!r.ok) return false;
+        RecordWriter ack;
+        ack.u32(id);
+        ack.u32(count);
+        ipcFrame(IpcType::ACK, ack, c.out);
+        return true;
+    }
+
+    // A snapshot went out on the control thread: tell subscribers if
+    // anything they see changed
+    void published(){
+        uint64_t counter;
+        while(read(wake, &counter, sizeof counter) > 0){}
+        const PlayerSnapshot& s = player.snapshot();
+        IpcState now;
+        now.generation = s.generation;
+        now.flags = (s.isPlaying ? IpcState::PLAYING : 0) | (s.isPaused ? IpcState::PAUSED : 0) |
+                    (s.shuffleOn ? IpcState::SHUFFLE : 0) | (s.canUndo ? IpcState::CAN_UNDO : 0) |
+                    (s.canRedo ? IpcState::CAN_REDO : 0);
+        now.current = (uint32_t)s.currentIndex;
+        now.size = (uint32_t)s.size;
+        now.offset = s.offset;
+        now.duration = s.duration;
+        now.volume = s.volume;
+        now.song = s.currentSong;
+        now.log = s.logMsg;
+        if(haveState && !differs(now, told)) return;
+        now.seq = told.seq + 1;
+        now.sentNs = ipcNow();
+        told = move(now);
+        haveState = true;
+        RecordWriter body;
+        told.write(body);
+        stateMessage.clear();
+        ipcFrame(IpcType::STATE, body, stateMessage);
+        vector<int> gone;
+        for(auto& kv : clients){
+            Client& c = *kv.second;
+            if(!c.subscribed) continue;
+            if(c.sent < c.out.size()){ c.stale = true; continue; }
+            c.out.insert(c.out.end(), stateMessage.begin(), stateMessage.end());
+            if(!flush(kv.first, c, false)) gone.push_back(kv.first);
+        }
+        for(int fd : gone) drop(fd);
+    }
+
+    // Progress counts in whole seconds, so playback alone sends one a second
+    static bool differs(const IpcState& a, const IpcState& b){
+        return a.generation != b.generation || a.flags != b.flags || a.current != b.current || a.size != b.size ||
+               (int)a.offset != (int)b.offset || a.duration != b.duration || a.volume != b.volume ||
+               a.song != b.song || a.log != b.log;
+    }
+
+    // Sends what the socket takes. False if the client is gone (and dropped,
+    // unless dropNow is false and the caller does it).
+    bool flush(int fd, Client& c, bool dropNow = true){
+        while(true){
+            while(c.sent < c.out.size()){
+                ssize_t n = send(fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                    if(c.out.size() - c.sent > MAX_BACKLOG) break;
+                    if(!c.writing){ watch(fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD); c.writing = true; }
+                    return true;
+                }
+                if(n <= 0) break;
+                c.sent += (size_t)n;
+            }
+            if(c.sent < c.out.size()){     // error, or too far behind
+                if(dropNow) drop(fd);
+                return false;
+            }
+            c.out.clear();
+            c.sent = 0;
+            if(!c.stale) break;
+            c.stale = false;    // caught up: the newest state is all it needs
+            c.out = stateMessage;
+        }
+        if(c.writing){ watch(fd, EPOLLIN, EPOLL_CTL_MOD); c.writing = false; }
+        return true;
+    }
+};
+
+int main(int argc, char** argv){
+    string socketPath = DAEMON_SOCKET, sessionDir = SESSION_DIR;
+    bool silent = false;
+    for(int i = 1; i < argc; i++){
+        string a = argv[i];
+        if(a == "--session" && i + 1 < argc) sessionDir = argv[++i];
+        else if(a == "--no-session") sessionDir.clear();
+        else if(a == "--null") silent = true;
+        else if(!a.empty() && a[0] != '-') socketPath = a;
+        else { fprintf(stderr, "usage: daemon [socket] [--session DIR | --no-session] [--null]\n"); return 2; }
+    }
+    // before any thread starts, so only the signalfd sees them
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    unique_ptr<AudioBackend> backend = silent ? unique_ptr<AudioBackend>(new NullBackend()) : MusicPlayer::defaultBackend();
+    Daemon d(socketPath, move(backend), sessionDir);
+    return d.run() ? 0 : 1;
+}
+
+#else
+int main(){
+    fprintf(stderr, "daemon: needs Linux (epoll, eventfd, signalfd)\n");
+    return 1;
+}
+#endif
@@ -0,0 +1,76 @@
+// Times Fft::transform (SSE from the width 8 pass up, where the target has
+// it) against transformScalar at the analyzer's size, on random input, and
+// checks every output bin of the fast path against the scalar reference.
+// Each time is the best of a few rounds of many transforms.
+//
+//   fftbench [n] [transforms]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "spectrum.h"
+using namespace std;
+
+const int ROUNDS = 5;
+const float TOLERANCE = 1e-4f;   // of the largest magnitude; float rounding differs by pass order only
+volatile float sink;             // keeps the transforms from being optimized out
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+// best us per transform of run over count transforms
+template<class Run>
+static double best(int count, Run run){
+    double b = 1e30;
+    for(int r = 0; r < ROUNDS; r++){
+        auto t = chrono::steady_clock::now();
+        for(int i = 0; i < count; i++) run();
+        b = min(b, msSince(t) * 1e3 / count);
+    }
+    return b;
+}
+
+int main(int argc, char** argv){
+    size_t n = argc > 1 ? (size_t)atoi(argv[1]) : 2048;
+    int transforms = argc > 2 ? atoi(argv[2]) : 2000;
+    Fft fft(n);
+    mt19937 rng(7);
+    uniform_real_distribution<float> sample(-1.0f, 1.0f);
+    vector<float> inRe(n), inIm(n, 0.0f);
+    for(float& s : inRe) s = sample(rng);
+
+    vector<float> fastRe = inRe, fastIm = inIm, refRe = inRe, refIm = inIm;
+    fft.transform(fastRe.data(), fastIm.data());
+    fft.transformScalar(refRe.data(), refIm.data());
+    float peak = 0, err = 0;
+    for(size_t i = 0; i < n; i++){
+        peak = max(peak, hypot(refRe[i], refIm[i]));
+        err = max(err, hypot(fastRe[i] - refRe[i], fastIm[i] - refIm[i]));
+    }
+
+    vector<float> re(n), im(n);
+    double fast = best(transforms, [&]{
+        copy(inRe.begin(), inRe.end(), re.begin());
+        fill(im.begin(), im.end(), 0.0f);
+        fft.transform(re.data(), im.data());
+        sink = re[1];
+    });
+    double scalar = best(transforms, [&]{
+        copy(inRe.begin(), inRe.end(), re.begin());
+        fill(im.begin(), im.end(), 0.0f);
+        fft.transformScalar(re.data(), im.data());
+        sink = re[1];
+    });
+
+#ifdef SOUNDLIST_FFT_SSE
+    const char* path = "SSE";
+#else
+    const char* path = "scalar (no SSE on this target)";
+#endif
+    printf("n = %zu, transform %s %8.2f us, transformScalar %8.2f us, %.2fx\n", n, path, fast, scalar, scalar / fast);
+    printf("  max error %.3g of peak %.3g%s\n", err, peak, err <= TOLERANCE * peak ? "" : "  MISMATCH");
+    return err <= TOLERANCE * peak ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include "nullbackend.h"
+#include "wavreader.h"
+#include "spectrum.h"
+using namespace std;
+
+// Renders playback into a 16-bit WAV file instead of a sound device, as fast
+// as render() is called. The output is a fixed format; sources are mapped to
+// it channel-wise and resampled by nearest neighbour, which keeps transitions
+// exact and is plenty for checking gaps and levels. Silence is written while
+// nothing plays, and silence between two tracks is counted in gapFrames.
+class FileSinkBackend : public ClockBackend{
+public:
+    unsigned long long framesWritten = 0;
+    unsigned long long gapFrames = 0;       // silent frames after a track ended, until the next one
+    unsigned long long lastGapFrames = 0;   // length of the most recent such gap
+
+    explicit FileSinkBackend(const string& outPath, unsigned rate = 44100, unsigned channels = 2)
+        : outRate(rate), outChannels(channels){
+        out = fopen(outPath.c_str(), "wb");
+        if(out){
+            setvbuf(out, nullptr, _IOFBF, 1 << 16);
+            writeHeader();
+        }
+    }
+
+    ~FileSinkBackend(){ close(); }
+
+    bool good() const{ return out != nullptr; }
+
+    // Plays seconds of output time
+    void render(double seconds){ advance(seconds); }
+
+    bool open(const string& path, uint32_t tag) override{
+        bool reuse = hasNext && next.tag == tag && next.path == path;
+        if(!ClockBackend::open(path, tag)) return false;
+        curReader = reuse ? move(nextReader) : move(loaded);
+        nextReader.reset();
+        if(curReader) curReader->seekFrame(0);
+        step = 0;
+        return true;
+    }
+
+    void play() override{
+        if(ended && hasCur){
+            lastGapFrames = runGap;
+            runGap = 0;
+            ended = false;
+        }
+        ClockBackend::play();
+    }
+
+    void prefetch(const string& path, uint32_t tag) override{
+        ClockBackend::prefetch(path, tag);
+        if(loaded) nextReader = move(loaded);
+        if(!hasNext) nextReader.reset();
+    }
+
+    void dropQueued() override{
+        ClockBackend::dropQueued();
+        nextReader.reset();
+    }
+
+    void setTap(SampleTap* t) override{ tap = t; }
+
+    bool close(){
+        if(!out) return false;
+        fseek(out, 0, SEEK_SET);
+        writeHeader();
+        bool ok = ferror(out) == 0;
+        ok = fclose(out) == 0 && ok;
+        out = nullptr;
+        return ok;
+    }
+
+protected:
+    bool load(Track& t) override{
+        unique_ptr<WavReader> r(new WavReader());
+        if(!r->open(t.path) || !r->info.sampleRate || !r->info.channels) return false;
+        t.rate = r->info.sampleRate;
+        t.channels = r->info.channels;
+        t.frames = r->frames();
+        loaded = move(r);   // claimed by open() or prefetch()
+        return true;
+    }
+
+    void produce(uint64_t frames) override{
+        if(pos + frames >= cur.frames) ended = true;
+        if(curReader && curReader->tell() != pos) curReader->seekFrame(pos);
+        unsigned ch = cur.channels;
+        while(frames){
+            size_t k = (size_t)min<uint64_t>(frames, 4096);
+            in.assign(k * ch, 0);
+            if(curReader) curReader->readFrames(in.data(), k);
+            if(tap) tap->push(in.data(), in.size(), ch, cur.rate);
+            float amp = vol / 100.0f * gain;
+            // nearest neighbour: emit an output frame each time the step crosses a source frame
+            for(size_t i = 0; i < k; i++){
+                step += outRate;
+                while(step >= cur.rate){
+                    step -= cur.rate;
+                    for(unsigned c = 0; c < outChannels; c++){
+                        int v = in[i*ch + (ch == 1 ? 0 : c % ch)];
+                        if(outChannels == 1 && ch > 1) v = (in[i*ch] + in[i*ch + 1]) / 2;
+                        outBuf.push_back((int16_t)max(-32768.0f, min(32767.0f, v * amp)));
+                    }
+                }
+            }
+            writeOut();
+            frames -= k;
+        }
+    }
+
+    void produceSilence(double seconds) override{
+        uint64_t n = (uint64_t)(seconds * outRate + 0.5);
+        if(!n) return;
+        if(st == PlaybackStatus::Stopped && ended){
+            runGap += n;
+            gapFrames += n;
+        }
+        outBuf.assign(n * outChannels, 0);
+        writeOut();
+    }
+
+    void onSwitch() override{
+        curReader = move(nextReader);
+        if(curReader) curReader->seekFrame(0);
+        step = 0;
+        ended = false;
+        lastGapFrames = 0;
+    }
+
+    void onSeek() override{
+        if(curReader) curReader->seekFrame(pos);
+        ended = false;
+    }
+
+private:
+    FILE* out = nullptr;
+    unsigned outRate, outChannels;
+    unique_ptr<WavReader> curReader, nextReader, loaded;
+    SampleTap* tap = nullptr;
+    vector<int16_t> in, outBuf;
+    uint64_t step = 0;
+    bool ended = false;     // the current track ran out without a successor
+    uint64_t runGap = 0;
+
+    void writeOut(){
+        if(out && !outBuf.empty()) fwrite(outBuf.data(), sizeof(int16_t), outBuf.size(), out);
+        framesWritten += outBuf.size() / outChannels;
+        outBuf.clear();
+    }
+
+    void writeHeader(){
+        uint32_t data = (uint32_t)min<unsigned long long>(framesWritten * outChannels * 2, 0xFFFFFFFFull - 36);
+        unsigned char h[44];
+        memcpy(h, "RIFF", 4);
+        putLE32(h + 4, 36 + data);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        putLE32(h + 16, 16);
+        putLE16(h + 20, 1);
+        putLE16(h + 22, outChannels);
+        putLE32(h + 24, outRate);
+        putLE32(h + 28, outRate * outChannels * 2);
+        putLE16(h + 32, outChannels * 2);
+        putLE16(h + 34, 16);
+        memcpy(h + 36, "data", 4);
+        putLE32(h + 40, data);
+        fwrite(h, 1, sizeof h, out);
+    }
+
+    static void putLE32(unsigned char* p, uint32_t v){ for(int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8*i)); }
+    static void putLE16(unsigned char* p, unsigned v){ p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+};
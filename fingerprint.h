@@ -0,0 +1,586 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include "mappedwav.h"
+#include "spectrum.h"
+#include "threadpool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUNDLIST_PRINT_SSE 1
+#endif
+using namespace std;
+namespace fs = std::filesystem;
+
+inline int popcount32(uint32_t v){
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(v);
+#else
+    v = v - ((v >> 1) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+    return (int)((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+#endif
+}
+
+// Haitsma-Kalker robust audio hash. The mono mix is resampled to 5512 Hz,
+// cut into 0.37 s Hann frames every 23 ms, and each frame's energy
+// in 33 log-spaced bands from 300 Hz to 2 kHz becomes 32 bits: the sign of
+// how the difference between neighbouring bands changed since the previous
+// frame. That survives gain changes, re-encoding and resampling; two copies
+// of a song differ in few bits where they line up. Silent frames come out as
+// 0, which never matches. Windowing and the power spectrum run four bins at
+// a time on SSE, on top of the SSE FFT.
+class FingerprintExtractor{
+public:
+    static constexpr unsigned RATE = 5512;      // Hz analysed, whatever the file's rate
+    static constexpr size_t FRAME = 2048;
+    static constexpr size_t HOP = 128;
+    static constexpr int BANDS = 33;
+    static constexpr double MAX_SECONDS = 120;  // enough to tell songs apart
+
+    FingerprintExtractor() : fft(FRAME), window(FRAME), re(FRAME), im(FRAME), power(FRAME / 2){
+        for(size_t i = 0; i < FRAME; i++)
+            window[i] = 0.5f - 0.5f * (float)cos(2 * Fft::PI * i / (FRAME - 1));
+        layoutBands();
+    }
+
+    // Sub-fingerprints of a decodable WAV, HOP analysis samples apart
+    bool extract(const string& path, vector<uint32_t>& out, double& seconds){
+        out.clear();
+        MappedWav w;
+        if(!w.open(path)) return false;
+        unsigned ch = w.info.channels, rate = w.info.sampleRate;
+        uint64_t frames = min<uint64_t>(w.frames(), (uint64_t)(MAX_SECONDS * rate));
+        seconds = (double)frames / rate;
+        mono.clear();
+        havePrev = false;
+        size_t at = 0;          // start of the next analysis frame in mono
+        // each output sample averages the input frames of its own 1/RATE s,
+        // a box filter that also keeps files of any rate on the same clock
+        double step = (double)rate / RATE, edge = step;
+        float sum = 0;
+        unsigned inSum = 0;
+        uint64_t frame = 0;
+        float scale = 1.0f / (32768.0f * ch);
+        vector<int16_t> buf(4096 * ch);
+        uint64_t done = 0;
+        while(done < frames){
+            const int16_t* p;
+            size_t got = (size_t)min<uint64_t>(4096, frames - done);
+            if(w.direct()) got = w.view(got, p);
+            else { got = w.readFrames(buf.data(), got); p = buf.data(); }
+            if(!got) break;
+            done += got;
+            for(size_t i = 0; i < got; i++){
+                for(unsigned c = 0; c < ch; c++) sum += p[i*ch + c];
+                inSum++;
+                if(++frame >= edge){
+                    mono.push_back(sum * scale / inSum);
+                    sum = 0;
+                    inSum = 0;
+                    edge += step;
+                }
+            }
+            for(; at + FRAME <= mono.size(); at += HOP) analyze(&mono[at], out);
+            if(at >= 1 << 16){
+                mono.erase(mono.begin(), mono.begin() + at);
+                at = 0;
+            }
+        }
+        return true;
+    }
+
+private:
+    // about -70 dBFS over the analysed bands
+    static constexpr float SILENCE = 0.03f;
+
+    Fft fft;
+    vector<float> window, re, im, power, mono;
+    size_t edges[BANDS + 1] = {};
+    float prev[BANDS] = {};
+    bool havePrev = false;
+
+    void layoutBands(){
+        float binHz = (float)RATE / FRAME;
+        for(int b = 0; b <= BANDS; b++){
+            float hz = 300.0f * powf(2000.0f / 300.0f, (float)b / BANDS);
+            edges[b] = min(FRAME / 2, (size_t)(hz / binHz));
+            if(b && edges[b] <= edges[b-1]) edges[b] = edges[b-1] + 1;
+        }
+    }
+
+    void analyze(const float* x, vector<uint32_t>& out){
+#ifdef SOUNDLIST_PRINT_SSE
+        __m128 zero = _mm_setzero_ps();
+        for(size_t i = 0; i < FRAME; i += 4){     // FRAME is a multiple of 4
+            _mm_storeu_ps(&re[i], _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(&window[i])));
+            _mm_storeu_ps(&im[i], zero);
+        }
+#else
+        for(size_t i = 0; i < FRAME; i++){ re[i] = x[i] * window[i]; im[i] = 0; }
+#endif
+        fft.transform(re.data(), im.data());
+        size_t lo = edges[0], hi = edges[BANDS], i = lo;
+#ifdef SOUNDLIST_PRINT_SSE
+        for(; i + 4 <= hi; i += 4){
+            __m128 r = _mm_loadu_ps(&re[i]), m = _mm_loadu_ps(&im[i]);
+            _mm_storeu_ps(&power[i], _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+        }
+#endif
+        for(; i < hi; i++) power[i] = re[i]*re[i] + im[i]*im[i];
+        float e[BANDS], total = 0;
+        for(int b = 0; b < BANDS; b++){
+            float s = 0;
+            for(size_t k = edges[b]; k < edges[b+1]; k++) s += power[k];
+            e[b] = s;
+            total += s;
+        }
+        uint32_t bits = 0;
+        for(int b = 0; b < BANDS - 1; b++)
+            if(e[b] - e[b+1] - (prev[b] - prev[b+1]) > 0) bits |= 1u << b;
+        if(havePrev) out.push_back(total < SILENCE ? 0 : bits);
+        copy(e, e + BANDS, prev);
+        havePrev = true;
+    }
+};
+
+// A track the fingerprint of another one matched
+struct FingerprintMatch{
+    uint32_t track;
+    float similarity;   // 1 - bit error rate where the two line up
+};
+
+// Every INDEX_STRIDE-th sub-fingerprint of every track in an open-addressed
+// table that keeps duplicate keys. A query probes all of its own, so any
+// alignment between two tracks still lands on indexed frames; the offsets
+// that collect the most exact hits are then checked bit by bit.
+class FingerprintIndex{
+public:
+    static constexpr uint32_t NONE = ~0u;
+    static constexpr size_t INDEX_STRIDE = 4;
+    static constexpr size_t MIN_OVERLAP = 256;     // ~6 s of sub-fingerprints
+    static constexpr float MAX_BER = 0.35f;         // Haitsma and Kalker's threshold
+    static constexpr int CANDIDATES = 8;            // offsets verified per query
+
+    uint32_t add(vector<uint32_t> print){
+        uint32_t id = (uint32_t)prints.size();
+        for(size_t f = 0; f < print.size(); f += INDEX_STRIDE){
+            if(!print[f] || (f && print[f] == print[f-1])) continue;   // silence, held notes
+            if((used + 1) * 2 > slots.size()) grow();
+            insert({print[f], id, (uint32_t)f});
+        }
+        prints.push_back(move(print));
+        live.push_back(true);
+        return id;
+    }
+
+    // Slots of removed tracks are skipped until the table next grows
+    void remove(uint32_t id){
+        if(id >= live.size()) return;
+        live[id] = false;
+        vector<uint32_t>().swap(prints[id]);
+    }
+
+    const vector<uint32_t>& print(uint32_t id) const{ return prints[id]; }
+
+    // Tracks other than self that print matches, most similar first
+    vector<FingerprintMatch> match(const vector<uint32_t>& print, uint32_t self = NONE) const{
+        vector<FingerprintMatch> out;
+        if(slots.empty()) return out;
+        unordered_map<uint64_t, int> votes;     // (track, offset) -> exact hits
+        for(size_t q = 0; q < print.size(); q++){
+            uint32_t key = print[q];
+            if(!key) continue;
+            for(size_t s = slotOf(key); slots[s].track != NONE; s = (s + 1) & (slots.size() - 1)){
+                const Slot& h = slots[s];
+                if(h.key != key || h.track == self || !live[h.track]) continue;
+                int64_t offset = (int64_t)h.frame - (int64_t)q;
+                votes[(uint64_t)h.track << 32 | (uint32_t)(int32_t)offset]++;
+            }
+        }
+        vector<pair<int, uint64_t>> best;
+        for(auto& kv : votes) best.push_back({kv.second, kv.first});
+        size_t keep = min(best.size(), (size_t)CANDIDATES);
+        partial_sort(best.begin(), best.begin() + keep, best.end(), greater<pair<int, uint64_t>>());
+        for(size_t i = 0; i < keep; i++){
+            uint32_t track = (uint32_t)(best[i].second >> 32);
+            int32_t offset = (int32_t)(uint32_t)best[i].second;
+            float ber = bitErrors(print, prints[track], offset);
+            if(ber > MAX_BER) continue;
+            auto it = find_if(out.begin(), out.end(), [&](const FingerprintMatch& m){ return m.track == track; });
+            if(it == out.end()) out.push_back({track, 1 - ber});
+            else it->similarity = max(it->similarity, 1 - ber);
+        }
+        sort(out.begin(), out.end(), [](const FingerprintMatch& a, const FingerprintMatch& b){ return a.similarity > b.similarity; });
+        return out;
+    }
+
+private:
+    struct Slot{
+        uint32_t key;
+        uint32_t track;     // NONE while free
+        uint32_t frame;
+    };
+    vector<Slot> slots;
+    size_t used = 0;
+    vector<vector<uint32_t>> prints;
+    vector<bool> live;
+
+    size_t slotOf(uint32_t key) const{
+        return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (slots.size() - 1);
+    }
+
+    void insert(const Slot& s){
+        size_t i = slotOf(s.key);
+        while(slots[i].track != NONE) i = (i + 1) & (slots.size() - 1);
+        slots[i] = s;
+        used++;
+    }
+
+    void grow(){
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(max<size_t>(1 << 16, old.size() * 2), Slot{0, NONE, 0});
+        used = 0;
+        for(const Slot& s : old) if(s.track != NONE && live[s.track]) insert(s);
+    }
+
+    // Share of differing bits where a[i] lines up with b[i + offset]; 1 if
+    // they overlap too little, silence left out
+    static float bitErrors(const vector<uint32_t>& a, const vector<uint32_t>& b, int32_t offset){
+        int64_t from = max<int64_t>(0, -(int64_t)offset);
+        int64_t to = min<int64_t>((int64_t)a.size(), (int64_t)b.size() - offset);
+        size_t need = min(MIN_OVERLAP, min(a.size(), b.size()) / 2);
+        size_t frames = 0, errors = 0;
+        for(int64_t i = from; i < to; i++){
+            uint32_t x = a[i], y = b[i + offset];
+            if(!x || !y) continue;
+            errors += popcount32(x ^ y);
+            frames++;
+        }
+        if(!frames || frames < need) return 1;
+        return (float)errors / (frames * (FingerprintExtractor::BANDS - 1));
+    }
+};
+
+// A newly requested file and the indexed one it sounds like
+struct FingerprintDuplicate{
+    string path;
+    string of;
+    float similarity;
+};
+
+// Outcome of a bulk dedupe: for each path handed in, the position of the
+// first one of its group of duplicates, or -1 for that first one itself
+struct DedupeResult{
+    uint64_t tag = 0;
+    vector<int> dupOf;
+    size_t fingerprinted = 0;
+    double seconds = 0;
+};
+
+// On-disk layout of fingerprints.idx:
+//   FingerprintHeader | (FingerprintRecord + path bytes + u32[frames])[count]
+#pragma pack(push, 1)
+struct FingerprintHeader{
+    char magic[4];        // "SLFP"
+    uint32_t version;
+    uint32_t count;
+};
+struct FingerprintRecord{
+    uint64_t size;
+    int64_t mtime;
+    uint32_t frames;
+    uint32_t pathLen;
+};
+#pragma pack(pop)
+
+// Fingerprints of every track, computed once and kept in fingerprints.idx
+// keyed by path, size and mtime, with the index over them. All of it lives
+// on the worker thread. request() queues files that were just added: each
+// batch is fingerprinted in parallel, leaving one core for playback, and
+// every file is then looked up against all the others. dedupe() does the
+// same for a whole playlist on every core.
+class FingerprintCache{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    explicit FingerprintCache(const string& indexPath) : indexPath(indexPath){
+        worker = thread(&FingerprintCache::run, this);
+    }
+
+    ~FingerprintCache(){
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+    }
+
+    void request(const vector<string>& paths){
+        {
+            lock_guard<mutex> lock(m);
+            pending.insert(pending.end(), paths.begin(), paths.end());
+        }
+        cv.notify_one();
+    }
+
+    bool takeDuplicates(vector<FingerprintDuplicate>& out){
+        lock_guard<mutex> lock(m);
+        if(found.empty()) return false;
+        out.swap(found);
+        found.clear();
+        return true;
+    }
+
+    // Replaces any dedupe not started yet; tag comes back with the result
+    void dedupe(vector<string> paths, uint64_t tag){
+        {
+            lock_guard<mutex> lock(m);
+            dedupePaths = move(paths);
+            dedupeTag = tag;
+            dedupeQueued = true;
+        }
+        cv.notify_one();
+    }
+
+    bool takeDedupe(DedupeResult& out){
+        lock_guard<mutex> lock(m);
+        if(!dedupeDone) return false;
+        out = move(dedupeResult);
+        dedupeDone = false;
+        return true;
+    }
+
+private:
+    struct Entry{
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint32_t track = FingerprintIndex::NONE;
+        bool checked = false;   // size/mtime confirmed this session
+        bool failed = false;
+    };
+
+    string indexPath;
+    mutex m;
+    condition_variable cv;
+    thread worker;
+    bool quit = false;
+    vector<string> pending;
+    vector<FingerprintDuplicate> found;
+    vector<string> dedupePaths;
+    uint64_t dedupeTag = 0;
+    bool dedupeQueued = false;
+    DedupeResult dedupeResult;
+    bool dedupeDone = false;
+
+    // worker only
+    unordered_map<string, Entry> entries;
+    vector<const string*> pathOf;   // track -> key in entries
+    FingerprintIndex index;
+
+    void run(){
+        load();
+        unique_lock<mutex> lock(m);
+        while(true){
+            cv.wait(lock, [this]{ return quit || !pending.empty() || dedupeQueued; });
+            if(quit) return;
+            vector<string> batch;
+            batch.swap(pending);
+            bool bulk = dedupeQueued;
+            vector<string> all;
+            all.swap(dedupePaths);
+            uint64_t tag = dedupeTag;
+            dedupeQueued = false;
+            lock.unlock();
+
+            // a dedupe waiting behind this batch gets every core for both
+            unsigned threads = bulk ? 0 : max(1u, workerCount() - 1);
+            auto start = chrono::steady_clock::now();
+            vector<FingerprintDuplicate> dups;
+            size_t built = 0;
+            if(!batch.empty()){
+                built += refresh(batch, threads);
+                vector<uint32_t> tracks;
+                for(const string& p : batch) tracks.push_back(trackOf(p));
+                vector<vector<FingerprintMatch>> hits(batch.size());
+                parallelFor(batch.size(), [&](size_t i){
+                    if(tracks[i] != FingerprintIndex::NONE) hits[i] = index.match(index.print(tracks[i]), tracks[i]);
+                }, threads);
+                for(size_t i = 0; i < batch.size(); i++)
+                    for(const FingerprintMatch& h : hits[i]) dups.push_back({batch[i], *pathOf[h.track], h.similarity});
+            }
+            DedupeResult result;
+            if(bulk){
+                built += refresh(all, 0);
+                result.tag = tag;
+                result.fingerprinted = built;
+                result.dupOf = duplicatesIn(all);
+                result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+            if(built) save();
+
+            lock.lock();
+            found.insert(found.end(), dups.begin(), dups.end());
+            if(bulk){
+                dedupeResult = move(result);
+                dedupeDone = true;
+            }
+        }
+    }
+
+    uint32_t trackOf(const string& path) const{
+        auto it = entries.find(path);
+        return it == entries.end() || it->second.failed ? FingerprintIndex::NONE : it->second.track;
+    }
+
+    // Fingerprints whichever of paths are new or changed on disk since they
+    // were indexed, on threads cores (0 = all). Returns how many it built.
+    size_t refresh(const vector<string>& paths, unsigned threads){
+        vector<string> work;
+        vector<Entry> stat;
+        unordered_set<string> seen;
+        for(const string& p : paths){
+            auto it = entries.find(p);
+            if((it != entries.end() && it->second.checked) || !seen.insert(p).second) continue;
+            Entry e;
+            error_code ec;
+            e.size = fs::file_size(p, ec);
+            if(!ec) e.mtime = (int64_t)fs::last_write_time(p, ec).time_since_epoch().count();
+            e.failed = (bool)ec;
+            e.checked = true;
+            if(it != entries.end() && !e.failed && it->second.size == e.size && it->second.mtime == e.mtime){
+                it->second.checked = true;
+                continue;
+            }
+            if(it != entries.end() && it->second.track != FingerprintIndex::NONE) index.remove(it->second.track);
+            work.push_back(p);
+            stat.push_back(e);
+        }
+        vector<vector<uint32_t>> printsOut(work.size());
+        parallelFor(work.size(), [&](size_t i){
+            if(stat[i].failed) return;
+            static thread_local FingerprintExtractor x;
+            double seconds;
+            stat[i].failed = !x.extract(work[i], printsOut[i], seconds);
+        }, threads);
+        size_t built = 0;
+        for(size_t i = 0; i < work.size(); i++){
+            Entry& e = entries[work[i]];
+            e = stat[i];
+            if(e.failed) continue;
+            e.track = addTrack(work[i], move(printsOut[i]));
+            built++;
+        }
+        return built;
+    }
+
+    uint32_t addTrack(const string& path, vector<uint32_t> print){
+        uint32_t id = index.add(move(print));
+        pathOf.resize(id + 1);
+        pathOf[id] = &entries.find(path)->first;
+        return id;
+    }
+
+    // Looks every path up in parallel, then joins paths that are the same
+    // file or match into groups; all but the first of a group are duplicates
+    vector<int> duplicatesIn(const vector<string>& paths){
+        vector<uint32_t> tracks(paths.size());
+        for(size_t i = 0; i < paths.size(); i++) tracks[i] = trackOf(paths[i]);
+        vector<vector<FingerprintMatch>> hits(paths.size());
+        parallelFor(paths.size(), [&](size_t i){
+            if(tracks[i] != FingerprintIndex::NONE) hits[i] = index.match(index.print(tracks[i]), tracks[i]);
+        });
+        vector<int> group(paths.size());
+        for(size_t i = 0; i < group.size(); i++) group[i] = (int)i;
+        auto root = [&](int i){
+            while(group[i] != i) i = group[i] = group[group[i]];
+            return i;
+        };
+        auto join = [&](int a, int b){
+            a = root(a); b = root(b);
+            if(a != b) group[max(a, b)] = min(a, b);    // the earliest position leads
+        };
+        unordered_map<string, int> first;       // path -> earliest position
+        for(size_t i = 0; i < paths.size(); i++){
+            auto it = first.emplace(paths[i], (int)i).first;
+            join(it->second, (int)i);
+        }
+        for(size_t i = 0; i < paths.size(); i++)
+            for(const FingerprintMatch& h : hits[i]){
+                auto it = first.find(*pathOf[h.track]);
+                if(it != first.end()) join((int)i, it->second);
+            }
+        vector<int> dupOf(paths.size(), -1);
+        for(size_t i = 0; i < paths.size(); i++){
+            int r = root((int)i);
+            if(r != (int)i) dupOf[i] = r;
+        }
+        return dupOf;
+    }
+
+    void load(){
+        FILE* f = fopen(indexPath.c_str(), "rb");
+        if(!f) return;
+        setvbuf(f, nullptr, _IOFBF, 1 << 16);
+        FingerprintHeader h;
+        if(fread(&h, sizeof h, 1, f) == 1 && memcmp(h.magic, "SLFP", 4) == 0 && h.version == VERSION){
+            string path;
+            vector<uint32_t> print;
+            for(uint32_t i = 0; i < h.count; i++){
+                FingerprintRecord r;
+                if(fread(&r, sizeof r, 1, f) != 1 || r.pathLen > 1 << 16) break;
+                path.resize(r.pathLen);
+                print.resize(r.frames);
+                if(fread(&path[0], 1, r.pathLen, f) != r.pathLen) break;
+                if(fread(print.data(), 4, r.frames, f) != r.frames) break;
+                Entry& e = entries[path];
+                if(e.track != FingerprintIndex::NONE) continue;
+                e.size = r.size;
+                e.mtime = r.mtime;
+                e.track = addTrack(path, print);
+            }
+        }
+        fclose(f);
+    }
+
+    // Worker only, so nothing else is touching entries
+    void save(){
+        string tmp = indexPath + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return;
+        setvbuf(f, nullptr, _IOFBF, 1 << 16);
+        FingerprintHeader h;
+        memcpy(h.magic, "SLFP", 4);
+        h.version = VERSION;
+        h.count = 0;
+        for(auto& kv : entries) if(!kv.second.failed && kv.second.track != FingerprintIndex::NONE) h.count++;
+        fwrite(&h, sizeof h, 1, f);
+        for(auto& kv : entries){
+            if(kv.second.failed || kv.second.track == FingerprintIndex::NONE) continue;
+            const vector<uint32_t>& print = index.print(kv.second.track);
+            FingerprintRecord r;
+            r.size = kv.second.size;
+            r.mtime = kv.second.mtime;
+            r.frames = (uint32_t)print.size();
+            r.pathLen = (uint32_t)kv.first.size();
+            fwrite(&r, sizeof r, 1, f);
+            fwrite(kv.first.data(), 1, kv.first.size(), f);
+            fwrite(print.data(), 4, print.size(), f);
+        }
+        bool good = ferror(f) == 0;
+        good = fclose(f) == 0 && good;
+        error_code ec;
+        if(good) fs::rename(tmp, indexPath, ec);
+        else fs::remove(tmp, ec);
+    }
+};
@@ -2,11 +2,14 @@
 #define NOGDI
 #define NOUSER
 #include "raylib.h"
-#include "musicplayer.h"
+#include "rlgl.h"
+#include "playercontrol.h"
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
 #include <vector>
+#include <list>
+#include <unordered_map>
 #include <algorithm>
 using namespace std;
 
@@ -27,7 +30,31 @@ const int SH = 740;
 const int PX = 20;
 const int PW = SW - PX*2;
 const int PLAYLIST_ROWS = 7;
+const char* EXPORT_PLAYLIST = "playlist.m3u8";
+const char* TRACE_FILE = "soundlist-trace.json";
+const char* SORT_KEYS[] = {"name", "duration", "date", "loudness"};    // Ctrl+O steps through them
+const float PROFILE_WINDOW = 2.0f;     // seconds of samples behind the overlay
+const int PROFILE_ROWS = 16;
+// frame pacing: full rate only while someone is using the window
+const int ACTIVE_FPS = 60;
+const int PLAYING_FPS = 20;         // progress, spinner and meters
+const int IDLE_FPS = 15;            // while a scan or the control thread still owes a change
+const float ACTIVE_LINGER = 0.5f;   // seconds at full rate after the last input
 float smoothScroll = 0;
+bool pointerWanted = false;         // something clickable is under the mouse
+
+// Hash of everything a panel shows. A panel is drawn again only when its
+// key changes; the rest of the time the canvas keeps its last drawing.
+struct PanelKey{
+    uint64_t h = 1469598103934665603ull;
+    PanelKey& add(const void* p, size_t n){
+        const unsigned char* b = (const unsigned char*)p;
+        for(size_t i=0; i<n; i++){ h ^= b[i]; h *= 1099511628211ull; }
+        return *this;
+    }
+    template<class T> PanelKey& operator<<(const T& v){ return add(&v, sizeof v); }
+    PanelKey& operator<<(const string& s){ add(s.data(), s.size()); return *this << s.size(); }
+};
 
 bool IsMouseOver(int x, int y, int w, int h){
     Vector2 m = GetMousePosition();
@@ -36,36 +63,180 @@ bool IsMouseOver(int x, int y, int w, int h){
 bool IsClicked(int x, int y, int w, int h){
     return IsMouseOver(x,y,w,h) && IsMouseButtonPressed(MOUSE_LEFT_BUTTON);
 }
-bool DrawButton(int x, int y, int w, int h, const char* label, Color bg, Color fg, int fontSize=14){
-    bool hover = IsMouseOver(x,y,w,h);
-    bool clicked = IsClicked(x,y,w,h);
+// A clickable area, the same for the input pass and the drawing
+struct Box{
+    int x, y, w, h;
+    bool over() const{ return IsMouseOver(x,y,w,h); }
+    bool clicked() const{ return IsClicked(x,y,w,h); }
+};
+// The mouse as the area at x, y, w, h sees it: nothing while it is elsewhere
+void MouseKey(PanelKey& k, int x, int y, int w, int h){
+    bool in = IsMouseOver(x,y,w,h);
+    k << in;
+    if(!in) return;
+    Vector2 m = GetMousePosition();
+    k << m.x << m.y << GetMouseWheelMove() << IsMouseButtonDown(MOUSE_LEFT_BUTTON)
+      << IsMouseButtonPressed(MOUSE_LEFT_BUTTON) << IsMouseButtonReleased(MOUSE_LEFT_BUTTON);
+}
+void DrawButton(const Box& b, const char* label, Color bg, Color fg, int fontSize=14){
+    int x = b.x, y = b.y, w = b.w, h = b.h;
+    bool hover = b.over();
     Color drawBg = bg;
     if(hover) drawBg = {(unsigned char)min(255,bg.r+30),(unsigned char)min(255,bg.g+30),(unsigned char)min(255,bg.b+30),255};
     DrawRectangle(x,y,w,h,drawBg);
     DrawRectangleLines(x,y,w,h, hover ? COL_ACCENT : COL_BORDER);
     int tw = MeasureText(label, fontSize);
     DrawText(label, x+(w-tw)/2, y+(h-fontSize)/2, fontSize, fg);
-    if(hover) SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
-    return clicked;
+    if(hover) pointerWanted = true;
 }
 void DrawPanel(int x, int y, int w, int h, Color bg, Color border){
     DrawRectangle(x,y,w,h,bg);
     DrawRectangleLines(x,y,w,h,border);
 }
-string TruncateText(const string& text, int maxWidth, int fontSize){
-    if(MeasureText(text.c_str(), fontSize) <= maxWidth) return text;
-    string t = text;
-    while(t.size()>0 && MeasureText((t+"...").c_str(), fontSize)>maxWidth) t.pop_back();
-    return t+"...";
+
+// Text measuring for the default font without building strings. Glyph
+// advances are measured once per codepoint at the font's own size; a label is cut by
+// binary search over its prefix widths, and the last CAPACITY labels are
+// kept as laid out.
+class TextLayout{
+public:
+    static constexpr size_t CAPACITY = 512;
+
+    // What MeasureText(text, fontSize) returns
+    int width(const string& text, int fontSize){
+        Metrics m = metrics(fontSize);
+        float w = 0;
+        int glyphs = 0;
+        for(size_t i=0; i<text.size(); glyphs++){
+            int bytes;
+            w += advance(text, i, bytes);
+            i += bytes;
+        }
+        return glyphs ? (int)(w*m.scale + (glyphs-1)*m.spacing) : 0;
+    }
+
+    // text, or its longest prefix (whole codepoints) plus "..." that fits
+    // in maxWidth. The reference stays valid until the next call.
+    const string& truncate(const string& text, int maxWidth, int fontSize){
+        uint64_t key = hashOf(text, maxWidth, fontSize);
+        auto hit = index.find(key);
+        if(hit != index.end()){
+            Entry& e = *hit->second;
+            if(e.maxWidth == maxWidth && e.fontSize == fontSize && e.text == text){
+                lru.splice(lru.begin(), lru, hit->second);
+                return e.label;
+            }
+            lru.erase(hit->second);     // hash collision: the newer label wins
+            index.erase(hit);
+        }
+        lru.push_front({text, maxWidth, fontSize, layout(text, maxWidth, fontSize)});
+        index[key] = lru.begin();
+        if(lru.size() > CAPACITY){
+            index.erase(hashOf(lru.back().text, lru.back().maxWidth, lru.back().fontSize));
+            lru.pop_back();
+        }
+        return lru.front().label;
+    }
+
+private:
+    // MeasureText draws sizes under 10 at 10 and spaces glyphs size/10 apart;
+    // like it, widths are summed unscaled and scaled once
+    struct Metrics{
+        float scale;
+        float spacing;
+    };
+    struct Entry{
+        string text;
+        int maxWidth, fontSize;
+        string label;
+    };
+    float ascii[128];
+    bool asciiReady = false;
+    unordered_map<int, float> other;
+    list<Entry> lru;
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    vector<float> prefix;   // unscaled width of the first k+1 glyphs
+    vector<size_t> ends;    // byte offset after glyph k
+
+    static Metrics metrics(int fontSize){
+        int drawn = max(fontSize, 10);
+        return {(float)drawn/GetFontDefault().baseSize, (float)(drawn/10)};
+    }
+
+    // Unscaled advance of the glyph at byte i; bytes is its UTF-8 length
+    float advance(const string& text, size_t i, int& bytes){
+        unsigned char c = text[i];
+        if(c < 128){
+            bytes = 1;
+            if(!asciiReady){
+                fill(ascii, ascii+128, -1.0f);
+                asciiReady = true;
+            }
+            if(ascii[c] < 0) ascii[c] = measure(string(1, (char)c));
+            return ascii[c];
+        }
+        int cp = GetCodepoint(text.c_str() + i, &bytes);
+        auto it = other.find(cp);
+        if(it != other.end()) return it->second;
+        float a = measure(text.substr(i, bytes));
+        other[cp] = a;
+        return a;
+    }
+
+    static float measure(const string& glyph){
+        Font font = GetFontDefault();
+        return MeasureTextEx(font, glyph.c_str(), (float)font.baseSize, 0).x;
+    }
+
+    string layout(const string& text, int maxWidth, int fontSize){
+        Metrics m = metrics(fontSize);
+        prefix.clear();
+        ends.clear();
+        float w = 0;
+        for(size_t i=0; i<text.size(); ){
+            int bytes;
+            w += advance(text, i, bytes);
+            i += bytes;
+            prefix.push_back(w);
+            ends.push_back(i);
+        }
+        int n = (int)prefix.size();
+        if(n == 0 || (int)(w*m.scale + (n-1)*m.spacing) <= maxWidth) return text;
+        int dotBytes;
+        float dots = 3*advance(".", 0, dotBytes);
+        // k glyphs and the dots are k+3 glyphs wide; widths only grow with k
+        auto fits = [&](int k){ return (int)(((k ? prefix[k-1] : 0) + dots)*m.scale + (k+2)*m.spacing) <= maxWidth; };
+        int lo = 0, hi = n-1;
+        while(lo < hi){
+            int mid = (lo + hi + 1)/2;
+            if(fits(mid)) lo = mid;
+            else hi = mid-1;
+        }
+        return text.substr(0, lo ? ends[lo-1] : 0) + "...";
+    }
+
+    static uint64_t hashOf(const string& text, int maxWidth, int fontSize){
+        uint64_t h = 1469598103934665603ull;
+        for(unsigned char c : text){ h ^= c; h *= 1099511628211ull; }
+        h ^= (uint64_t)(uint32_t)maxWidth << 32 | (uint32_t)fontSize;
+        h *= 1099511628211ull;
+        return h;
+    }
+};
+TextLayout textLayout;
+
+const string& TruncateText(const string& text, int maxWidth, int fontSize){
+    PROFILE_SCOPE("ui.truncate");
+    return textLayout.truncate(text, maxWidth, fontSize);
 }
 
 struct InputBox{
     string text;
     bool active = false;
     float cursorBlink = 0;
-    void update(){
+    void update(float dt){
         if(!active) return;
-        cursorBlink += GetFrameTime();
+        cursorBlink += dt;
         int key = GetCharPressed();
         while(key>0){ if(key>=32&&key<=125) text+=(char)key; key=GetCharPressed(); }
         if(IsKeyPressed(KEY_BACKSPACE) && !text.empty()) text.pop_back();
@@ -78,7 +249,7 @@ struct InputBox{
         string trunc = TruncateText(display, w-20, fontSize);
         DrawText(trunc.c_str(), x+10, y+(h-fontSize)/2, fontSize, col);
         if(active && (int)(cursorBlink*2)%2==0){
-            int cx = x+10+MeasureText(TruncateText(text,w-20,fontSize).c_str(), fontSize);
+            int cx = x+10+textLayout.width(TruncateText(text,w-20,fontSize), fontSize);
             DrawRectangle(cx+2, y+8, 2, h-16, COL_ACCENT);
         }
     }
@@ -87,263 +258,561 @@ struct InputBox{
 
 int main(){
     srand(time(0));
+    Profiler::nameThread("ui");
     InitWindow(SW, SH, "MUSIC PLAYER - DSA MINI PROJECT");
-    SetTargetFPS(60);
+    SetTargetFPS(0);    // paced below, by what is going on
 
-    MusicPlayer player;
+    PlayerController player(PLAYLIST_ROWS); // playlist + audio live on the control thread
+    LibraryScanner library;
+    // a restored session already has the library in it, in the user's order
+    if(library.load(LIBRARY_INDEX) && !player.restored()) player.addTracks(library.tracks);
+    library.rescanAsync(MUSIC_ROOT, LIBRARY_INDEX); // picks up new or changed files
     InputBox addInput;
     int scrollOffset = 0;
+    // Truncated row labels, rebuilt only when the playlist or scroll changes
+    vector<string> rowLabels;
+    unsigned long long labelGen = ~0ull;
+    int labelOffset = -1;
+    bool labelSearching = false;
+    string lastQuery;
+    int searchScroll = 0;
+    float volume = player.startVolume(); // the UI is the only writer, so it keeps its own copy
     float spinAngle = 0;
     bool draggingProgress = false;
+    float wheelSeek = -1;   // where the last wheel tick seeked to, while the wheel keeps turning
     bool draggingVolume = false;
+    int draggingRow = 0;    // 1-based song picked up by its number, 0 when none
+    // Waveform columns for the progress bar, redone when the track or width changes
+    vector<int8_t> waveCols;
+    shared_ptr<const WavePeaks> wavePeaks;
+    // F3 overlay: per-section percentiles, refreshed twice a second
+    bool showProfile = false;
+    vector<SectionStats> profStats;
+    float profAge = 0;
+
+    // Panels are drawn into canvas, each only when its key changes, and the
+    // window is presented only when something was drawn
+    enum{ HEADER, NOW, PROGRESS, CONTROLS, VOLUME, PLAYLIST, ADD, LOG, FOOTER, PANELS };
+    const int panelY[PANELS+1] = {15, 65, 155, 189, 253, 287, 625, 685, 717, SH};
+    const int ROW_H = 44;
+    const int listY = panelY[PLAYLIST]+30, listH = PLAYLIST_ROWS*ROW_H;
+    const int ctlY = panelY[CONTROLS]+12;
+    const Box fadeShapeBtn{PX+PW-46, panelY[NOW]+52, 36, 18};
+    const Box progressBar{PX+42, panelY[PROGRESS]+6, PW-84, 22};      // the bar and a margin to grab it by
+    const Box playBtn{PX+8, ctlY, 68, 38}, pauseBtn{PX+84, ctlY, 76, 38}, prevBtn{PX+168, ctlY, 56, 38},
+              nextBtn{PX+232, ctlY, 56, 38}, randomBtn{PX+296, ctlY, 42, 38}, shuffleBtn{PX+346, ctlY, 52, 38},
+              crossfadeBtn{PX+402, ctlY, PW-410, 38};
+    const Box volDownBtn{PX+PW-44, panelY[VOLUME]+7, 20, 20}, volUpBtn{PX+PW-22, panelY[VOLUME]+7, 20, 20};
+    const Box volumeBar{PX+32, panelY[VOLUME]+6, PW-118, 22};
+    const Box addBox{PX+10, panelY[ADD]+10, PW-100, 40}, addBtn{PX+PW-84, panelY[ADD]+10, 74, 40};
+    uint64_t drawnKey[PANELS] = {};
+    bool panelPointer[PANELS] = {};
+    bool pointer = false;
+    bool overlayShown = false;
+    bool focused = true;
+    bool presented = false;
+    bool waiting = false;   // raylib blocks for input events in PollInputEvents and EndDrawing
+    double lastTime = GetTime(), nextFrame = 0, lastInput = 0;
+    RenderTexture2D canvas = LoadRenderTexture(SW, SH);
+    BeginTextureMode(canvas);
+    ClearBackground(COL_BG);
+    EndTextureMode();
 
     while(!WindowShouldClose()){
-        float dt = GetFrameTime();
-        addInput.update();
-        player.update(); // auto-advance songs
+        // sleep out the frame period; frames that presented nothing poll here,
+        // and when idle that blocks until there is input
+        double wait = nextFrame - GetTime();
+        if(wait > 0) WaitTime(wait);
+        if(!presented) PollInputEvents();
+        if(waiting){ DisableEventWaiting(); waiting = false; }
+
+        PROFILE_SCOPE("ui.frame");
+        ProfileScope phase("ui.input");
+        double now = GetTime();
+        float dt = (float)(now - lastTime);
+        lastTime = now;
+        addInput.update(dt);
+        player.noteFrame(dt);
+        if(library.finished()) player.addTracks(library.takeAdded());
+        const PlayerSnapshot& st = player.snapshot();
+
+        bool keyed = false;
+        while(GetKeyPressed()) keyed = true;
+        Vector2 md = GetMouseDelta();
+        if(keyed || md.x != 0 || md.y != 0 || GetMouseWheelMove() != 0 || IsMouseButtonDown(MOUSE_LEFT_BUTTON) ||
+           IsMouseButtonReleased(MOUSE_LEFT_BUTTON))
+            lastInput = now;
 
         if(!addInput.active){
-            if(IsKeyPressed(KEY_LEFT))  player.prev();
-            if(IsKeyPressed(KEY_RIGHT)) player.next();
+            if(IsKeyPressed(KEY_LEFT))  player.send(Cmd::PREV);
+            if(IsKeyPressed(KEY_RIGHT)) player.send(Cmd::NEXT);
+            if(IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_S)) player.send(Cmd::EXPORT, 0, EXPORT_PLAYLIST);
+            if(IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_Z))
+                player.send(IsKeyDown(KEY_LEFT_SHIFT) ? Cmd::REDO : Cmd::UNDO);
+            if(IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_Y)) player.send(Cmd::REDO);
+            if(IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_D)) player.send(Cmd::DEDUPE);
+            if(IsKeyDown(KEY_LEFT_CONTROL) && IsKeyPressed(KEY_O)){
+                static int sortKey = 0;     // shift sorts descending
+                player.send(Cmd::SORT, 0, string(IsKeyDown(KEY_LEFT_SHIFT) ? "-" : "") + SORT_KEYS[sortKey]);
+                sortKey = (sortKey + 1) % 4;
+            }
+            if(IsKeyPressed(KEY_F3)){
+                showProfile = !showProfile;
+                Profiler::get().enabled = showProfile;
+                profAge = 1;
+            }
+            if(IsKeyPressed(KEY_F4))
+                player.send(Cmd::LOG, 0, Profiler::get().writeTrace(TRACE_FILE) ? string("TRACE WRITTEN TO ") + TRACE_FILE
+                                                                             : string("ERROR: Could not write ") + TRACE_FILE);
         }
-        if(player.isPlaying && !player.isPaused) spinAngle += dt * 120;
+        bool spinning = st.isPlaying && !st.isPaused;
+        if(spinning) spinAngle += dt * 120;
 
-        SetMouseCursor(MOUSE_CURSOR_DEFAULT);
         if(IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && !IsMouseOver(PX, 618, PW-90, 40))
             addInput.active = false;
         if(IsMouseButtonReleased(MOUSE_LEFT_BUTTON)){ draggingProgress=false; draggingVolume=false; }
 
-        BeginDrawing();
-        ClearBackground(COL_BG);
-        int y = 0;
+        // SEARCH — typing in the add box filters the playlist to ranked matches
+        bool searching = !addInput.text.empty();
+        if(addInput.text != lastQuery){
+            player.send(Cmd::SEARCH, 0, addInput.text);
+            lastQuery = addInput.text;
+            searchScroll = 0;
+        }
+        // results for an older query are still in flight; keep them until the new ones land
+        const vector<RowView>& matches = st.matches;
+        float pulse = sin(GetTime()*3)*0.5f+0.5f;
 
-        // HEADER
-        DrawRectangle(PX, 15, PW, 50, COL_ACCENT);
-        DrawText("SOUNDLIST", PX+16, 28, 26, COL_BLACK);
-        const char* tag = "DSA PROJECT";
-        int tagW = MeasureText(tag, 11);
-        DrawRectangle(PX+PW-tagW-24, 26, tagW+16, 22, COL_BLACK);
-        DrawText(tag, PX+PW-tagW-16, 31, 11, COL_ACCENT);
-        y = 65;
+        // Mouse input, every frame: a panel is only redrawn when what it shows
+        // changes, and the same wheel tick twice in a row looks like no change
+        if(fadeShapeBtn.clicked()) player.send(Cmd::FADESHAPE, ((int)st.fadeShape + 1) % 3);
 
-        // NOW PLAYING
-        DrawPanel(PX, y, PW, 90, COL_SURFACE, COL_BORDER);
-        DrawText("NOW PLAYING", PX+14, y+10, 10, COL_MUTED);
-        int vx=PX+20, vy=y+30, vr=22;
-        bool spinning = player.isPlaying && !player.isPaused;
-        DrawCircle(vx+vr, vy+vr, vr, spinning ? COL_ACCENT : COL_BORDER);
-        for(int r=vr-2; r>4; r-=4){
-            Color groove = spinning ? Color{(unsigned char)(200-r*3),(unsigned char)(245-r*2),66,255} : Color{30,30,30,255};
-            DrawCircleLines(vx+vr, vy+vr, r, groove);
-        }
-        DrawCircle(vx+vr, vy+vr, 5, COL_BG);
-        if(spinning){
-            float rad = spinAngle * DEG2RAD;
-            DrawLine(vx+vr, vy+vr, vx+vr+(int)(cos(rad)*(vr-3)), vy+vr+(int)(sin(rad)*(vr-3)), COL_BLACK);
-        }
-        string nowSong = player.current ? player.current->song : "No song selected";
-        Color nowCol = player.current ? COL_TEXT : COL_MUTED;
-        DrawText(TruncateText(nowSong, PW-100, 16).c_str(), PX+70, y+28, 16, nowCol);
-        if(player.isPlaying && !player.isPaused){
-            DrawRectangle(PX+70, y+52, 60, 18, COL_ACCENT);
-            DrawText("PLAYING", PX+76, y+55, 10, COL_BLACK);
-        } else if(player.isPaused){
-            DrawRectangle(PX+70, y+52, 54, 18, COL_YELLOW);
-            DrawText("PAUSED", PX+76, y+55, 10, COL_BLACK);
-        } else {
-            DrawRectangle(PX+70, y+52, 54, 18, COL_BORDER);
-            DrawText("STOPPED", PX+76, y+55, 10, COL_MUTED);
-        }
-        y += 90;
-
-        // PROGRESS BAR 
-        DrawPanel(PX, y, PW, 34, COL_SURFACE, COL_BORDER);
-        string elapsed  = player.getTimeElapsed();
-        string duration = player.getTimeDuration();
-        DrawText(elapsed.c_str(),  PX+8, y+10, 11, COL_MUTED);
-        DrawText(duration.c_str(), PX+PW-MeasureText(duration.c_str(),11)-8, y+10, 11, COL_MUTED);
-        int barX=PX+46, barW=PW-92, barY=y+14, barH=6;
-        float prog = player.getProgress();
-        bool overBar = IsMouseOver(barX-4, barY-8, barW+8, barH+16);
-        if(overBar) SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
-        if(overBar && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) draggingProgress = true;
-        if(overBar){
+        float prog = st.progress;
+        if(progressBar.over()){
+            if(IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) draggingProgress = true;
             float wheel = GetMouseWheelMove();
-            if(wheel != 0 && player.isPlaying){
-                float total  = player.music.getDuration().asSeconds();
-                float curPos = player.music.getPlayingOffset().asSeconds();
+            if(wheel != 0 && st.isPlaying){
+                // the snapshot may not show the last wheel seek yet
+                float total  = st.duration;
+                float curPos = wheelSeek >= 0 ? wheelSeek : st.offset;
                 float newPos = max(0.0f, min(total, curPos + wheel * 5.0f));
-                player.music.setPlayingOffset(sf::seconds(newPos));
-                player.logMsg = "SEEKED TO " + to_string((int)newPos) + "s";
-            }
-        }
+                player.seekTo(newPos);
+                player.send(Cmd::LOG, 0, "SEEKED TO " + to_string((int)newPos) + "s");
+                wheelSeek = newPos;
+            } else wheelSeek = -1;
+        } else wheelSeek = -1;
         if(draggingProgress && IsMouseButtonDown(MOUSE_LEFT_BUTTON)){
-            float frac = (GetMousePosition().x - barX) / (float)barW;
+            float frac = (GetMousePosition().x - progressBar.x - 4) / (float)(progressBar.w - 8);
             frac = max(0.0f, min(1.0f, frac));
-            float total = player.music.getDuration().asSeconds();
-            if(total > 0) player.music.setPlayingOffset(sf::seconds(frac * total));
+            float total = st.duration;
+            if(total > 0) player.seekTo(frac * total); // coalesced: one seek per control tick
             prog = frac;
         }
-        DrawRectangle(barX, barY, barW, barH, COL_BORDER);
-        int fillW = (int)(barW * prog);
-        if(fillW > 0) DrawRectangle(barX, barY, fillW, barH, COL_ACCENT);
-        DrawCircle(barX+fillW, barY+barH/2, 7, COL_ACCENT);
-        y += 34;
 
-        // CONTROLS
-        DrawPanel(PX, y, PW, 64, COL_SURFACE, COL_BORDER);
-        int btnY=y+12, btnH=38, bx=PX+8;
-        if(DrawButton(bx, btnY, 68, btnH, "PLAY", COL_ACCENT, COL_BLACK, 13))
-            if(!player.isPlaying) player.play();
-        bx += 76;
-        if(player.isPaused){
-            if(DrawButton(bx, btnY, 76, btnH, "RESUME", COL_YELLOW, COL_BLACK, 12)) player.resume();
-        } else {
-            if(DrawButton(bx, btnY, 76, btnH, "PAUSE", COL_SURFACE, COL_YELLOW, 13)) player.pause();
+        if(playBtn.clicked() && !st.isPlaying) player.send(Cmd::PLAY);
+        if(pauseBtn.clicked()) player.send(st.isPaused ? Cmd::RESUME : Cmd::PAUSE);
+        if(prevBtn.clicked()) player.send(Cmd::PREV);
+        if(nextBtn.clicked()) player.send(Cmd::NEXT);
+        if(randomBtn.clicked()) player.send(Cmd::RANDOM);
+        if(shuffleBtn.clicked()) player.send(Cmd::SHUFFLE);
+        if(crossfadeBtn.clicked()){
+            // cycles the crossfade length: off, 2, 4, 8, 12 seconds
+            static const int FADES[] = {0, 2, 4, 8, 12};
+            int at = 0;
+            while(at < 4 && FADES[at] < (int)st.crossfade) at++;
+            player.send(Cmd::CROSSFADE, FADES[(at + 1) % 5]);
         }
-        bx += 84;
-        if(DrawButton(bx, btnY, 56, btnH, "< PREV", COL_SURFACE, COL_TEXT, 11)) player.prev();
-        bx += 64;
-        if(DrawButton(bx, btnY, 56, btnH, "NEXT >", COL_SURFACE, COL_TEXT, 11)) player.next();
-        bx += 64;
-        if(DrawButton(bx, btnY, 42, btnH, "RNG", COL_SURFACE, COL_YELLOW, 11)) player.randomSong();
-        y += 64;
 
-        // VOLUME BAR
-        DrawPanel(PX, y, PW, 34, COL_SURFACE, COL_BORDER);
-        DrawText("VOL", PX+8, y+10, 11, COL_MUTED);
-        if(DrawButton(PX+PW-44, y+7, 20, 20, "-", COL_SURFACE, COL_TEXT, 13))
-            player.setVolume(player.getVolume() - 5.0f);
-        if(DrawButton(PX+PW-22, y+7, 20, 20, "+", COL_SURFACE, COL_ACCENT, 13))
-            player.setVolume(player.getVolume() + 5.0f);
-        string volStr = to_string((int)player.getVolume()) + "%";
-        DrawText(volStr.c_str(), PX+PW-44-MeasureText(volStr.c_str(),10)-6, y+12, 10, COL_MUTED);
-        int volX=PX+36, volW=PW-36-90, volY=y+14, volH=6;
-        float volF = player.getVolume() / 100.0f;
-        bool overVol = IsMouseOver(volX-4, volY-8, volW+8, volH+16);
-        if(overVol) SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
-        if(overVol){ float w=GetMouseWheelMove(); if(w!=0) player.setVolume(player.getVolume()+w*5.0f); }
-        if(overVol && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) draggingVolume = true;
+        if(volDownBtn.clicked()) player.setVolume(volume = max(0.0f, volume - 5.0f));
+        if(volUpBtn.clicked()) player.setVolume(volume = min(100.0f, volume + 5.0f));
+        if(volumeBar.over()){
+            float w = GetMouseWheelMove();
+            if(w != 0) player.setVolume(volume = max(0.0f, min(100.0f, volume+w*5.0f)));
+            if(IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) draggingVolume = true;
+        }
         if(draggingVolume && IsMouseButtonDown(MOUSE_LEFT_BUTTON)){
-            float frac = (GetMousePosition().x - volX) / (float)volW;
+            float frac = (GetMousePosition().x - volumeBar.x - 4) / (float)(volumeBar.w - 8);
             frac = max(0.0f, min(1.0f, frac));
-            player.setVolume(frac * 100.0f);
-            volF = frac;
+            player.setVolume(volume = frac * 100.0f);
         }
-        DrawRectangle(volX, volY, volW, volH, COL_BORDER);
-        int volFill = (int)(volW * volF);
-        if(volFill > 0) DrawRectangle(volX, volY, volFill, volH, COL_ACCENT);
-        DrawCircle(volX+volFill, volY+volH/2, 6, COL_ACCENT);
-        y += 34;
-
-        // PLAYLIST HEADER
-        DrawPanel(PX, y, PW, 30, COL_CARD, COL_BORDER);
-        DrawText("PLAYLIST // CIRCULAR DOUBLY LINKED LIST", PX+12, y+9, 10, COL_MUTED);
-        string countStr = "[" + to_string(player.size) + " SONGS]";
-        int cw = MeasureText(countStr.c_str(), 10);
-        DrawText(countStr.c_str(), PX+PW-cw-12, y+9, 10, COL_ACCENT);
-        y += 30;
-
-        // PLAYLIST ITEMS
-        auto songs = player.getSongs();
-        int rowH = 44;
-        int playlistH = PLAYLIST_ROWS * rowH;
-        DrawRectangle(PX, y, PW, playlistH, COL_CARD);
-        DrawRectangleLines(PX, y, PW, playlistH, COL_BORDER);
-
-        if(songs.empty()){
-            const char* emptyMsg = "// PLAYLIST IS EMPTY - ADD A SONG BELOW";
-            int ew = MeasureText(emptyMsg, 12);
-            DrawText(emptyMsg, PX+(PW-ew)/2, y+playlistH/2-6, 12, COL_MUTED);
-        } else {
+
+        // PLAYLIST: the undo/redo buttons sit left of the count
+        string countStr = searching ? "[" + to_string(matches.size()) + " MATCHES]" : "[" + to_string(st.size) + " SONGS]";
+        int countW = MeasureText(countStr.c_str(), 10);
+        Box undoBtn{PX+PW-countW-96, panelY[PLAYLIST]+6, 34, 18}, redoBtn{PX+PW-countW-58, panelY[PLAYLIST]+6, 34, 18};
+        if(!searching && undoBtn.clicked() && st.canUndo) player.send(Cmd::UNDO);
+        if(!searching && redoBtn.clicked() && st.canRedo) player.send(Cmd::REDO);
+        int total = searching ? (int)matches.size() : st.size;
+        int& offset = searching ? searchScroll : scrollOffset;
+        vector<const RowView*> rows;
+        if(total > 0){
             float wheel = GetMouseWheelMove();
-            if(wheel!=0 && IsMouseOver(PX,y,PW,playlistH) && !overBar && !overVol){
-                scrollOffset -= (int)wheel;
-                scrollOffset = max(0, min(scrollOffset, (int)songs.size()-PLAYLIST_ROWS));
+            if(wheel!=0 && IsMouseOver(PX,listY,PW,listH)){
+                offset -= (int)wheel;
+                offset = max(0, min(offset, total-PLAYLIST_ROWS));
             }
-            int currentIdx = 0;
-            for(int i=0; i<(int)songs.size(); i++) if(songs[i].second){ currentIdx=i; break; }
-            if(currentIdx < scrollOffset) scrollOffset = currentIdx;
-            if(currentIdx >= scrollOffset+PLAYLIST_ROWS) scrollOffset = currentIdx-PLAYLIST_ROWS+1;
-            scrollOffset = max(0, scrollOffset);
-
-            for(int i=scrollOffset; i<min((int)songs.size(), scrollOffset+PLAYLIST_ROWS); i++){
-                int iy = y+(i-scrollOffset)*rowH;
-                bool isCurrent = songs[i].second;
-                if(isCurrent){
-                    DrawRectangle(PX+1, iy, PW-2, rowH, COL_ACTIVE_BG);
-                    DrawRectangle(PX+1, iy, 3, rowH, COL_ACCENT);
-                }
-                if(!isCurrent && IsMouseOver(PX,iy,PW,rowH)){
-                    DrawRectangle(PX+1, iy, PW-2, rowH, Color{255,255,255,8});
-                    SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
+            if(!searching){
+                int currentIdx = st.currentIndex - 1;
+                if(currentIdx < scrollOffset) scrollOffset = currentIdx;
+                if(currentIdx >= scrollOffset+PLAYLIST_ROWS) scrollOffset = currentIdx-PLAYLIST_ROWS+1;
+                scrollOffset = max(0, scrollOffset);
+                player.setView(scrollOffset);
+            }
+            if(searching) for(int r=offset; r<min(total, offset+PLAYLIST_ROWS); r++) rows.push_back(&matches[r]);
+            else for(const RowView& rv : st.rows) rows.push_back(&rv);
+            for(int r=0; r<(int)rows.size(); r++){
+                int pos = rows[r]->pos;
+                int iy = listY+r*ROW_H;
+                if(IsClicked(PX+PW-26, iy+(ROW_H-22)/2, 22, 22)){
+                    if(!st.isPlaying) player.send(Cmd::REMOVE, pos);
+                    else player.send(Cmd::LOG, 0, "STOP PLAYBACK BEFORE DELETING");
                 }
-                DrawLine(PX, iy+rowH, PX+PW, iy+rowH, COL_BORDER);
-                string numStr = to_string(i+1);
-                if(numStr.size()==1) numStr = "0"+numStr;
-                DrawText(numStr.c_str(), PX+14, iy+(rowH-14)/2, 13, isCurrent ? COL_ACCENT : COL_MUTED);
-                DrawText(TruncateText(songs[i].first, PW-100, 14).c_str(), PX+46, iy+(rowH-14)/2, 14, isCurrent ? COL_ACCENT : COL_TEXT);
-                if(isCurrent && player.isPlaying && !player.isPaused){
-                    int bx2=PX+PW-54, bw=5, bg2=3;
-                    for(int b=0; b<4; b++){
-                        float h2=(sin(GetTime()*5+(float)b/4.0f*6.28f)*0.5f+0.5f)*18+4;
-                        DrawRectangle(bx2+b*(bw+bg2), iy+rowH/2-(int)h2/2, bw, (int)h2, COL_ACCENT);
-                    }
+                // the number is a grip: drop the row on another one to move it there
+                if(!searching && IsClicked(PX, iy, 40, ROW_H)) draggingRow = pos;
+                if(draggingRow && IsMouseOver(PX, iy, PW, ROW_H) && pos != draggingRow && IsMouseButtonReleased(MOUSE_LEFT_BUTTON))
+                    player.moveSong(draggingRow, pos);
+                if(IsClicked(searching ? PX : PX+40, iy, searching ? PW-30 : PW-70, ROW_H)){
+                    player.send(Cmd::SELECT, pos);
+                    if(searching) addInput.text = ""; // jump back to the playlist
                 }
-                int dx=PX+PW-26, dy2=iy+(rowH-22)/2;
-                if(IsMouseOver(dx,dy2,22,22)) SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
-                if(DrawButton(dx,dy2,22,22,"x",COL_SURFACE,COL_MUTED,12)){
-                    if(!player.isPlaying) player.deleteMusic(i+1);
-                    else player.logMsg = "STOP PLAYBACK BEFORE DELETING";
+            }
+            if(total > PLAYLIST_ROWS){
+                smoothScroll += (offset - smoothScroll) * min(1.0f, 14.0f * dt);
+                if(fabs(offset - smoothScroll) < 0.01f) smoothScroll = offset;   // settled: stop redrawing
+            }
+        }
+        bool dropping = draggingRow != 0;
+        if(IsMouseButtonReleased(MOUSE_LEFT_BUTTON)) draggingRow = 0;
+
+        if(addBox.clicked()) addInput.active = true;
+        bool submitted = addBtn.clicked() || (addInput.active && IsKeyPressed(KEY_ENTER));
+        if(submitted){
+            string val = addInput.submit();
+            if(playlistFormatOf(val) != PlaylistFormat::UNKNOWN) player.send(Cmd::IMPORT, 0, val);
+            else if(!val.empty()) player.send(Cmd::ADD, 0, val);
+        }
+
+        // what each panel shows this frame
+        phase.next("ui.damage");
+        PanelKey keys[PANELS];
+        for(int p=0; p<PANELS; p++) MouseKey(keys[p], PX, panelY[p], PW, panelY[p+1]-panelY[p]);
+        keys[NOW] << st.hasCurrent << st.currentSong << st.isPlaying << st.isPaused << (int)st.fadeShape
+                  << (st.crossfade > 0) << st.underruns;
+        if(spinning) keys[NOW] << spinAngle;
+        keys[PROGRESS] << st.elapsed << st.total << (int)((PW-92) * prog) << st.peaks.get() << draggingProgress;
+        keys[CONTROLS] << st.isPlaying << st.isPaused << st.shuffleOn << (int)st.crossfade;
+        keys[VOLUME] << volume << draggingVolume;
+        keys[PLAYLIST] << searching << st.size << st.canUndo << st.canRedo << st.currentIndex << st.isPlaying
+                       << st.viewOffset << scrollOffset << searchScroll << smoothScroll << dropping;
+        for(const RowView& rv : st.rows) keys[PLAYLIST] << rv.song << rv.pos << rv.isCurrent;
+        if(searching) for(const RowView& rv : matches) keys[PLAYLIST] << rv.song << rv.pos << rv.isCurrent;
+        if(spinning) for(int b=0; b<SpectrumAnalyzer::BANDS; b++) keys[PLAYLIST] << (int)(st.bands[b]*18);
+        keys[ADD] << addInput.text << addInput.active << submitted;
+        if(addInput.active) keys[ADD] << (int)(addInput.cursorBlink*2)%2;
+        keys[LOG] << st.logMsg << st.isPlaying << st.isPaused;
+        if(spinning) keys[LOG] << (int)(pulse*8);
+        bool dirty[PANELS];
+        bool anyDirty = false;
+        for(int p=0; p<PANELS; p++){
+            dirty[p] = keys[p].h != drawnKey[p];
+            drawnKey[p] = keys[p].h;
+            anyDirty |= dirty[p];
+        }
+
+        if(anyDirty) BeginTextureMode(canvas);
+        int y = 0;
+
+        // HEADER
+        phase.next("ui.nowPlaying");
+        if(dirty[HEADER]){
+            DrawRectangle(PX, 15, PW, 50, COL_ACCENT);
+            DrawText("SOUNDLIST", PX+16, 28, 26, COL_BLACK);
+            const char* tag = "DSA PROJECT";
+            int tagW = MeasureText(tag, 11);
+            DrawRectangle(PX+PW-tagW-24, 26, tagW+16, 22, COL_BLACK);
+            DrawText(tag, PX+PW-tagW-16, 31, 11, COL_ACCENT);
+        }
+
+        // NOW PLAYING
+        if(dirty[NOW]){
+            pointerWanted = false;
+            y = panelY[NOW];
+            DrawPanel(PX, y, PW, 90, COL_SURFACE, COL_BORDER);
+            DrawText("NOW PLAYING", PX+14, y+10, 10, COL_MUTED);
+            int vx=PX+20, vy=y+30, vr=22;
+            DrawCircle(vx+vr, vy+vr, vr, spinning ? COL_ACCENT : COL_BORDER);
+            for(int r=vr-2; r>4; r-=4){
+                Color groove = spinning ? Color{(unsigned char)(200-r*3),(unsigned char)(245-r*2),66,255} : Color{30,30,30,255};
+                DrawCircleLines(vx+vr, vy+vr, r, groove);
+            }
+            DrawCircle(vx+vr, vy+vr, 5, COL_BG);
+            if(spinning){
+                float rad = spinAngle * DEG2RAD;
+                DrawLine(vx+vr, vy+vr, vx+vr+(int)(cos(rad)*(vr-3)), vy+vr+(int)(sin(rad)*(vr-3)), COL_BLACK);
+            }
+            string nowSong = st.hasCurrent ? st.currentSong : "No song selected";
+            Color nowCol = st.hasCurrent ? COL_TEXT : COL_MUTED;
+            DrawText(TruncateText(nowSong, PW-100, 16).c_str(), PX+70, y+28, 16, nowCol);
+            if(st.isPlaying && !st.isPaused){
+                DrawRectangle(PX+70, y+52, 60, 18, COL_ACCENT);
+                DrawText("PLAYING", PX+76, y+55, 10, COL_BLACK);
+            } else if(st.isPaused){
+                DrawRectangle(PX+70, y+52, 54, 18, COL_YELLOW);
+                DrawText("PAUSED", PX+76, y+55, 10, COL_BLACK);
+            } else {
+                DrawRectangle(PX+70, y+52, 54, 18, COL_BORDER);
+                DrawText("STOPPED", PX+76, y+55, 10, COL_MUTED);
+            }
+            // crossfade curve and output underruns
+            DrawButton(fadeShapeBtn, fadeShapeName(st.fadeShape), COL_BG, st.crossfade > 0 ? COL_ACCENT : COL_MUTED, 10);
+            string xrun = "XRUN " + to_string(st.underruns);
+            DrawText(xrun.c_str(), PX+PW-54-MeasureText(xrun.c_str(), 10), y+56, 10,
+                     st.underruns ? COL_YELLOW : COL_MUTED);
+            panelPointer[NOW] = pointerWanted;
+        }
+
+        // PROGRESS BAR
+        phase.next("ui.progress");
+        if(dirty[PROGRESS]){
+            pointerWanted = false;
+            y = panelY[PROGRESS];
+            DrawPanel(PX, y, PW, 34, COL_SURFACE, COL_BORDER);
+            const string& elapsed  = st.elapsed;
+            const string& duration = st.total;
+            DrawText(elapsed.c_str(),  PX+8, y+10, 11, COL_MUTED);
+            DrawText(duration.c_str(), PX+PW-MeasureText(duration.c_str(),11)-8, y+10, 11, COL_MUTED);
+            int barX=progressBar.x+4, barW=progressBar.w-8, barY=progressBar.y+8, barH=progressBar.h-16;
+            if(progressBar.over()) pointerWanted = true;
+            int fillW = (int)(barW * prog);
+            if(st.peaks){
+                if(st.peaks != wavePeaks || (int)waveCols.size() != barW*2){
+                    st.peaks->columns(barW, waveCols);
+                    wavePeaks = st.peaks;
                 }
-                if(IsClicked(PX, iy, PW-30, rowH)){
-                    bool wasPlaying = player.isPlaying;
-                    if(wasPlaying) player.stopMusic();
-                    player.setByIndex(i+1);
-                    if(wasPlaying) player.play();
+                int mid = barY+barH/2;
+                for(int x=0; x<barW; x++){
+                    int top = mid - (waveCols[2*x+1]*11)/128, bot = mid - (waveCols[2*x]*11)/128;
+                    DrawLine(barX+x, top, barX+x, bot+1, x < fillW ? COL_ACCENT : COL_BORDER);
                 }
+            } else {
+                DrawRectangle(barX, barY, barW, barH, COL_BORDER);
+                if(fillW > 0) DrawRectangle(barX, barY, fillW, barH, COL_ACCENT);
             }
-            if((int)songs.size() > PLAYLIST_ROWS){
-                smoothScroll += (scrollOffset - smoothScroll) * 14.0f * dt;
-                int maxScroll = (int)songs.size() - PLAYLIST_ROWS;
-                float pos = (maxScroll > 0) ? (smoothScroll / maxScroll) : 0;
-                int sbH = max(20, (int)(playlistH * ((float)PLAYLIST_ROWS / songs.size())));
-                int sbY = y + (int)((playlistH - sbH) * pos);
-                DrawRectangle(PX+PW-5, y, 4, playlistH, COL_BORDER);
-                DrawRectangle(PX+PW-5, sbY, 4, sbH, COL_ACCENT);
+            DrawCircle(barX+fillW, barY+barH/2, 7, COL_ACCENT);
+            panelPointer[PROGRESS] = pointerWanted;
+        }
+
+        // CONTROLS
+        phase.next("ui.controls");
+        if(dirty[CONTROLS]){
+            pointerWanted = false;
+            y = panelY[CONTROLS];
+            DrawPanel(PX, y, PW, 64, COL_SURFACE, COL_BORDER);
+            DrawButton(playBtn, "PLAY", COL_ACCENT, COL_BLACK, 13);
+            if(st.isPaused) DrawButton(pauseBtn, "RESUME", COL_YELLOW, COL_BLACK, 12);
+            else DrawButton(pauseBtn, "PAUSE", COL_SURFACE, COL_YELLOW, 13);
+            DrawButton(prevBtn, "< PREV", COL_SURFACE, COL_TEXT, 11);
+            DrawButton(nextBtn, "NEXT >", COL_SURFACE, COL_TEXT, 11);
+            DrawButton(randomBtn, "RNG", COL_SURFACE, COL_YELLOW, 11);
+            DrawButton(shuffleBtn, "SHUF", st.shuffleOn ? COL_ACCENT : COL_SURFACE, st.shuffleOn ? COL_BLACK : COL_TEXT, 11);
+            string xf = st.crossfade > 0 ? "XF" + to_string((int)st.crossfade) : "XF";
+            DrawButton(crossfadeBtn, xf.c_str(), st.crossfade > 0 ? COL_ACCENT : COL_SURFACE,
+                       st.crossfade > 0 ? COL_BLACK : COL_TEXT, 11);
+            panelPointer[CONTROLS] = pointerWanted;
+        }
+
+        // VOLUME BAR
+        if(dirty[VOLUME]){
+            pointerWanted = false;
+            y = panelY[VOLUME];
+            DrawPanel(PX, y, PW, 34, COL_SURFACE, COL_BORDER);
+            DrawText("VOL", PX+8, y+10, 11, COL_MUTED);
+            DrawButton(volDownBtn, "-", COL_SURFACE, COL_TEXT, 13);
+            DrawButton(volUpBtn, "+", COL_SURFACE, COL_ACCENT, 13);
+            string volStr = to_string((int)volume) + "%";
+            DrawText(volStr.c_str(), PX+PW-44-MeasureText(volStr.c_str(),10)-6, y+12, 10, COL_MUTED);
+            int volX=volumeBar.x+4, volW=volumeBar.w-8, volY=volumeBar.y+8, volH=volumeBar.h-16;
+            if(volumeBar.over()) pointerWanted = true;
+            DrawRectangle(volX, volY, volW, volH, COL_BORDER);
+            int volFill = (int)(volW * volume / 100.0f);
+            if(volFill > 0) DrawRectangle(volX, volY, volFill, volH, COL_ACCENT);
+            DrawCircle(volX+volFill, volY+volH/2, 6, COL_ACCENT);
+            panelPointer[VOLUME] = pointerWanted;
+        }
+
+        phase.next("ui.playlist");
+        if(dirty[PLAYLIST]){
+            pointerWanted = false;
+            y = panelY[PLAYLIST];
+            // PLAYLIST HEADER
+            DrawPanel(PX, y, PW, 30, COL_CARD, COL_BORDER);
+            DrawText(searching ? "SEARCH // TRIGRAM INDEX" : "PLAYLIST // CIRCULAR DOUBLY LINKED LIST", PX+12, y+9, 10, COL_MUTED);
+            DrawText(countStr.c_str(), PX+PW-countW-12, y+9, 10, COL_ACCENT);
+            if(!searching){
+                DrawButton(undoBtn, "UNDO", COL_SURFACE, st.canUndo ? COL_TEXT : COL_BORDER, 9);
+                DrawButton(redoBtn, "REDO", COL_SURFACE, st.canRedo ? COL_TEXT : COL_BORDER, 9);
             }
+            y = listY;
+
+            // PLAYLIST ITEMS
+            DrawRectangle(PX, y, PW, listH, COL_CARD);
+            DrawRectangleLines(PX, y, PW, listH, COL_BORDER);
+
+            if(total == 0){
+                const char* emptyMsg = searching ? "// NO MATCHING SONGS" : "// PLAYLIST IS EMPTY - ADD A SONG BELOW";
+                int ew = MeasureText(emptyMsg, 12);
+                DrawText(emptyMsg, PX+(PW-ew)/2, y+listH/2-6, 12, COL_MUTED);
+            } else {
+                // the snapshot's window may trail the scroll by one control tick
+                int first = searching ? offset : st.viewOffset;
+                if(st.generation != labelGen || first != labelOffset || searching != labelSearching || rows.size() != rowLabels.size()){
+                    rowLabels.clear();
+                    for(const RowView* rv : rows) rowLabels.push_back(TruncateText(rv->song, PW-100, 14));
+                    labelGen = st.generation;
+                    labelOffset = first;
+                    labelSearching = searching;
+                }
+
+                for(int r=0; r<(int)rows.size(); r++){
+                    const RowView& rv = *rows[r];
+                    int pos = rv.pos;
+                    int iy = y+r*ROW_H;
+                    bool isCurrent = rv.isCurrent;
+                    if(isCurrent){
+                        DrawRectangle(PX+1, iy, PW-2, ROW_H, COL_ACTIVE_BG);
+                        DrawRectangle(PX+1, iy, 3, ROW_H, COL_ACCENT);
+                    }
+                    if(!isCurrent && IsMouseOver(PX,iy,PW,ROW_H)){
+                        DrawRectangle(PX+1, iy, PW-2, ROW_H, Color{255,255,255,8});
+                        pointerWanted = true;
+                    }
+                    DrawLine(PX, iy+ROW_H, PX+PW, iy+ROW_H, COL_BORDER);
+                    string numStr = to_string(pos);
+                    if(numStr.size()==1) numStr = "0"+numStr;
+                    DrawText(numStr.c_str(), PX+14, iy+(ROW_H-14)/2, 13, isCurrent ? COL_ACCENT : COL_MUTED);
+                    DrawText(rowLabels[r].c_str(), PX+46, iy+(ROW_H-14)/2, 14, isCurrent ? COL_ACCENT : COL_TEXT);
+                    if(isCurrent && st.isPlaying && !st.isPaused){
+                        int bx2=PX+PW-54, bw=5, bg2=3;
+                        const int per = SpectrumAnalyzer::BANDS/4;
+                        for(int b=0; b<4; b++){
+                            float v=0;
+                            for(int k=0; k<per; k++) v=max(v, st.bands[b*per+k]);
+                            float h2=v*18+4;
+                            DrawRectangle(bx2+b*(bw+bg2), iy+ROW_H/2-(int)h2/2, bw, (int)h2, COL_ACCENT);
+                        }
+                    }
+                    DrawButton(Box{PX+PW-26, iy+(ROW_H-22)/2, 22, 22}, "x", COL_SURFACE, COL_MUTED, 12);
+                    if(draggingRow && IsMouseOver(PX, iy, PW, ROW_H) && pos != draggingRow)
+                        DrawRectangle(PX+1, draggingRow < pos ? iy+ROW_H-2 : iy, PW-2, 2, COL_ACCENT);
+                }
+                if(total > PLAYLIST_ROWS){
+                    int maxScroll = total - PLAYLIST_ROWS;
+                    float pos = (maxScroll > 0) ? (smoothScroll / maxScroll) : 0;
+                    int sbH = max(20, (int)(listH * ((float)PLAYLIST_ROWS / total)));
+                    int sbY = y + (int)((listH - sbH) * pos);
+                    DrawRectangle(PX+PW-5, y, 4, listH, COL_BORDER);
+                    DrawRectangle(PX+PW-5, sbY, 4, sbH, COL_ACCENT);
+                }
+            }
+            panelPointer[PLAYLIST] = pointerWanted;
         }
-        y += playlistH;
 
         // ADD SONG
-        DrawPanel(PX, y, PW, 60, COL_SURFACE, COL_BORDER);
-        if(IsClicked(PX+10, y+10, PW-100, 40)) addInput.active = true;
-        addInput.draw(PX+10, y+10, PW-100, 40, "ENTER SONG NAME...", 13);
-        if(DrawButton(PX+PW-84, y+10, 74, 40, "+ ADD", COL_ACCENT, COL_BLACK, 13) ||
-           (addInput.active && IsKeyPressed(KEY_ENTER))){
-            string val = addInput.submit();
-            if(!val.empty()) player.addMusic(val);
+        phase.next("ui.footer");
+        if(dirty[ADD]){
+            pointerWanted = false;
+            y = panelY[ADD];
+            DrawPanel(PX, y, PW, 60, COL_SURFACE, COL_BORDER);
+            addInput.draw(addBox.x, addBox.y, addBox.w, addBox.h, "ENTER SONG NAME OR .M3U/.PLS...", 13);
+            DrawButton(addBtn, "+ ADD", COL_ACCENT, COL_BLACK, 13);
+            panelPointer[ADD] = pointerWanted;
         }
-        y += 60;
 
-        DrawPanel(PX, y, PW, 32, Color{13,13,13,255}, COL_BORDER);
-        float pulse = sin(GetTime()*3)*0.5f+0.5f;
-        Color dotCol = player.isPlaying && !player.isPaused ?
-            Color{200,245,66,(unsigned char)(150+(int)(pulse*105))} :
-            player.isPaused ? COL_YELLOW : COL_MUTED;
-        DrawCircle(PX+18, y+16, 5, dotCol);
-        DrawText(TruncateText(player.logMsg, PW-50, 11).c_str(), PX+30, y+10, 11, COL_MUTED);
-        y += 32;
-
-        DrawPanel(PX, y, PW, 26, COL_CARD, COL_BORDER);
-        DrawText("struct node { song | *next | *prev }", PX+12, y+7, 10, COL_MUTED);
-        const char* dsa = "HEAD -> TAIL -> HEAD";
-        DrawText(dsa, PX+PW-MeasureText(dsa,10)-12, y+7, 10, COL_ACCENT);
-
-        EndDrawing();
+        if(dirty[LOG]){
+            y = panelY[LOG];
+            DrawPanel(PX, y, PW, 32, Color{13,13,13,255}, COL_BORDER);
+            Color dotCol = st.isPlaying && !st.isPaused ?
+                Color{200,245,66,(unsigned char)(150+(int)(pulse*105))} :
+                st.isPaused ? COL_YELLOW : COL_MUTED;
+            DrawCircle(PX+18, y+16, 5, dotCol);
+            DrawText(TruncateText(st.logMsg, PW-50, 11).c_str(), PX+30, y+10, 11, COL_MUTED);
+        }
+
+        if(dirty[FOOTER]){
+            y = panelY[FOOTER];
+            DrawPanel(PX, y, PW, 26, COL_CARD, COL_BORDER);
+            DrawText("struct node { song | *next | *prev }", PX+12, y+7, 10, COL_MUTED);
+            const char* dsa = "HEAD -> TAIL -> HEAD";
+            DrawText(dsa, PX+PW-MeasureText(dsa,10)-12, y+7, 10, COL_ACCENT);
+        }
+        if(anyDirty) EndTextureMode();
+
+        bool wantPointer = false;
+        for(int p=0; p<PANELS; p++) wantPointer |= panelPointer[p];
+        if(wantPointer != pointer){
+            SetMouseCursor(wantPointer ? MOUSE_CURSOR_POINTING_HAND : MOUSE_CURSOR_DEFAULT);
+            pointer = wantPointer;
+        }
+
+        // nothing changed: the window keeps showing the last frame
+        bool focus = IsWindowFocused();
+        presented = anyDirty || showProfile || overlayShown || focus != focused;
+        focused = focus;
+        if(presented){
+            phase.next("ui.present");
+            BeginDrawing();
+            // the canvas holds finished pixels: copy them without blending a second time
+            rlDrawRenderBatchActive();
+            rlDisableColorBlend();
+            DrawTextureRec(canvas.texture, Rectangle{0, 0, (float)SW, -(float)SH}, Vector2{0, 0}, WHITE);
+            rlDrawRenderBatchActive();
+            rlEnableColorBlend();
+
+            // PROFILER OVERLAY
+            if(showProfile){
+                profAge += dt;
+                if(profAge >= 0.5f){ profStats = Profiler::get().stats(PROFILE_WINDOW); profAge = 0; }
+                int shown = min((int)profStats.size(), PROFILE_ROWS);
+                int oy = 70, oh = 56 + shown*13;
+                DrawRectangle(PX, oy, PW, oh, Color{0,0,0,225});
+                DrawRectangleLines(PX, oy, PW, oh, COL_ACCENT);
+                DrawText("SECTION", PX+8, oy+8, 10, COL_ACCENT);
+                const char* cols = "P50     P99     MAX ms    CALLS";
+                DrawText(cols, PX+PW-MeasureText(cols,10)-8, oy+8, 10, COL_ACCENT);
+                for(int i=0; i<shown; i++){
+                    const SectionStats& ps = profStats[i];
+                    int ry = oy+24+i*13;
+                    char buf[64];
+                    snprintf(buf, sizeof buf, "%6.2f  %6.2f  %6.2f  %6d", ps.p50, ps.p99, ps.worst, ps.calls);
+                    DrawText(ps.name.c_str(), PX+8, ry, 10, COL_TEXT);
+                    DrawText(buf, PX+PW-MeasureText(buf,10)-8, ry, 10, ps.p99 > 16.7f ? COL_ACCENT2 : COL_TEXT);
+                }
+                string pool = "NODES " + to_string(st.nodesLive) + " IN " + to_string(st.nodeSlabs) + " SLABS";
+                DrawText(pool.c_str(), PX+8, oy+24+shown*13, 10, COL_MUTED);
+                char trans[64];
+                snprintf(trans, sizeof trans, "LAST CHANGE: GAP %llu SAMPLES, WORST FRAME %.1f MS", st.gapSamples, st.transitionMs);
+                DrawText(trans, PX+8, oy+37+shown*13, 10, st.transitionMs > 16.7f ? COL_ACCENT2 : COL_MUTED);
+            }
+            overlayShown = showProfile;
+            EndDrawing();
+        }
+
+        bool interacting = now - lastInput < ACTIVE_LINGER || draggingProgress || draggingVolume || draggingRow ||
+                           addInput.active || showProfile;
+        int fps = interacting ? ACTIVE_FPS : spinning ? PLAYING_FPS : IDLE_FPS;
+        nextFrame = now + 1.0 / fps;
+        // idle: stopped or paused, nothing drawn this frame and nothing on its
+        // way from the control thread or the scan, so nothing changes until input
+        bool viewShown = searching || st.viewOffset == scrollOffset;
+        if(!interacting && !spinning && !presented && viewShown && player.settled(st) && !library.scanning()){
+            EnableEventWaiting();
+            waiting = true;
+            nextFrame = now;
+        }
     }
 
-    player.stopMusic();
+    UnloadRenderTexture(canvas);
+    player.send(Cmd::STOP);
     CloseWindow();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "persistentseq.h"
+using namespace std;
+
+// At pos, removed handles of before were replaced by added handles of after
+struct Splice{
+    int pos = 0;
+    int removed = 0;
+    int added = 0;
+    PersistentSeq before, after;
+};
+
+// One undoable playlist edit; a move is a removal and an insertion
+struct EditStep{
+    string what;
+    vector<Splice> splices;
+};
+
+// Undo and redo stacks over versions of the playlist order. order mirrors
+// the ring; every version a step keeps shares all but O(log n) nodes with
+// it (a sort shares none, so the oldest steps go once the versions outgrow
+// NODE_BUDGET). Handles that drop out of reach (the removals of a step
+// falling off the bottom, the insertions of a discarded redo branch) are
+// handed back so the caller can free songs that are no longer in the
+// playlist either.
+class EditHistory{
+public:
+    static constexpr size_t LIMIT = 256;
+    static constexpr size_t NODE_BUDGET = 8u << 20;    // ~200 MB of versions, or 4 of the whole list if more
+
+    SeqStore store;
+    PersistentSeq order{&store};
+
+    // order with count handles at pos replaced by added
+    Splice splice(int pos, int count, const vector<uint32_t>& added){
+        Splice s;
+        s.pos = pos;
+        s.removed = count;
+        s.added = (int)added.size();
+        s.before = order;
+        order = order.erased(pos, count).inserted(pos, added);
+        s.after = order;
+        return s;
+    }
+
+    void record(EditStep step, vector<uint32_t>& unreachable){
+        for(EditStep& r : redoSteps) leaving(r, false, unreachable);
+        redoSteps.clear();
+        undoSteps.push_back(move(step));
+        while(undoSteps.size() > LIMIT || (undoSteps.size() > 1 && store.live > max(NODE_BUDGET, (size_t)order.size() * 4))){
+            leaving(undoSteps.front(), true, unreachable);
+            undoSteps.pop_front();
+        }
+    }
+
+    // Starts over from a playlist loaded whole, with nothing to undo
+    void reset(const vector<uint32_t>& handles){
+        undoSteps.clear();
+        redoSteps.clear();
+        order = PersistentSeq(&store).inserted(0, handles);
+    }
+
+    bool canUndo() const{ return !undoSteps.empty(); }
+    bool canRedo() const{ return !redoSteps.empty(); }
+
+    // Moves the newest step to the redo stack and returns it; order becomes
+    // the version before it
+    const EditStep& undo(){
+        redoSteps.push_back(move(undoSteps.back()));
+        undoSteps.pop_back();
+        order = redoSteps.back().splices.front().before;
+        return redoSteps.back();
+    }
+
+    const EditStep& redo(){
+        undoSteps.push_back(move(redoSteps.back()));
+        redoSteps.pop_back();
+        order = undoSteps.back().splices.back().after;
+        return undoSteps.back();
+    }
+
+    size_t nodes() const{ return store.live; }
+
+private:
+    deque<EditStep> undoSteps;
+    vector<EditStep> redoSteps;     // newest undo last
+
+    // What step put in (or took out, for removals) and did not also take
+    // out (put back): a move keeps its song reachable from newer versions
+    static void leaving(const EditStep& step, bool removals, vector<uint32_t>& out){
+        vector<uint32_t> in, back;
+        for(const Splice& s : step.splices){
+            if(removals){ s.before.read(s.pos, s.removed, in); s.after.read(s.pos, s.added, back); }
+            else { s.after.read(s.pos, s.added, in); s.before.read(s.pos, s.removed, back); }
+        }
+        sort(back.begin(), back.end());
+        for(uint32_t h : in) if(!binary_search(back.begin(), back.end(), h)) out.push_back(h);
+    }
+};
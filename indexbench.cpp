@@ -0,0 +1,146 @@
+// Times positional access on generated playlists of 10k, 100k and 1M
+// songs, each against walking next from head, the way the playlist did it
+// before the index: PlaylistIndex::at and indexOf, deleteMusic at a random
+// position and randomSong. Each size is timed with the ring in load order
+// and after a shuffle, which is what a playlist edited for a while looks
+// like in memory. Walks stop after a time budget, so the slow cases still
+// finish.
+//
+//   indexbench [lookups]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#define SOUNDLIST_NO_SFML
+#include "musicplayer.h"
+using namespace std;
+
+const double WALK_BUDGET_MS = 2000;
+volatile uint32_t sink;  // keeps the lookups from being optimized out
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+// Puts the ring back in the order of nodes, the way the journal replays ORDER
+static void relink(MusicPlayer& p, const vector<node*>& nodes){
+    size_t n = nodes.size();
+    for(size_t i = 0; i < n; i++){
+        nodes[i]->next = nodes[(i + 1) % n];
+        nodes[i]->prev = nodes[(i + n - 1) % n];
+    }
+    p.head = nodes[0];
+    p.index.rebuild(nodes);
+}
+
+// Runs step over items until done or the budget is spent; returns ms per item
+template<class T, class Step>
+static double budgeted(const vector<T>& items, int& done, Step step){
+    auto t = chrono::steady_clock::now();
+    done = 0;
+    for(const T& item : items){
+        step(item);
+        done++;
+        if(msSince(t) > WALK_BUDGET_MS) break;
+    }
+    return done ? msSince(t) / done : 0;
+}
+
+int main(int argc, char** argv){
+    int lookups = argc > 1 ? atoi(argv[1]) : 100000;
+    mt19937 rng(7);
+
+    for(int songs : {10000, 100000, 1000000}){
+        vector<int> positions(lookups);
+        for(int& pos : positions) pos = (int)(rng() % songs);
+        for(bool shuffled : {false, true}){
+            MusicPlayer p(unique_ptr<AudioBackend>(new NullBackend()));
+            NodeChain chain;
+            vector<uint32_t> handles;
+            for(int i = 0; i < songs; i++){
+                node* n = p.pool.alloc("Song " + to_string(i));
+                chain.push(n);
+                handles.push_back(n->id);
+            }
+            p.spliceAt(0, chain);
+            p.history.reset(handles);
+            vector<node*> nodes;
+            for(node* n : p.visible(0, p.size)) nodes.push_back(n);
+            if(shuffled){
+                shuffle(nodes.begin(), nodes.end(), rng);
+                relink(p, nodes);
+            }
+            vector<node*> targets;
+            for(int pos : positions) targets.push_back(nodes[pos]);
+            bool same = true;
+            int walked;
+
+            // position -> node
+            auto t = chrono::steady_clock::now();
+            for(int pos : positions) sink += p.index.at(pos)->id;
+            double atIndexed = msSince(t) * 1e3 / lookups;
+            double atWalk = budgeted(positions, walked, [&](int pos){
+                node* n = p.head;
+                for(int j = 0; j < pos; j++) n = n->next;
+                same = same && n == p.index.at(pos);
+            }) * 1e3;
+            int atWalks = walked;
+
+            // node -> position, what currentIndex and positionOf ask
+            t = chrono::steady_clock::now();
+            for(node* n : targets) sink += p.index.indexOf(n);
+            double ofIndexed = msSince(t) * 1e3 / lookups;
+            double ofWalk = budgeted(targets, walked, [&](node* n){
+                int pos = 0;
+                for(node* w = p.head; w != n; w = w->next) pos++;
+                same = same && pos == p.index.indexOf(n);
+            }) * 1e3;
+            int ofWalks = walked;
+
+            // randomSong: a shuffle draw against rand() % size and a walk
+            int picks = min(lookups, songs);
+            t = chrono::steady_clock::now();
+            for(int i = 0; i < picks; i++){
+                p.randomSong();
+                sink += p.current->id;
+            }
+            double pickIndexed = msSince(t) * 1e3 / picks;
+            double pickWalk = budgeted(positions, walked, [&](int){
+                node* n = p.head;
+                for(int j = rand() % p.size; j > 0; j--) n = n->next;
+                sink += n->id;
+            }) * 1e3;
+            int pickWalks = walked;
+
+            // deleteMusic at random positions, undo history included; then
+            // the old way on what is left: walk from head and unlink
+            int deletes = min(lookups, songs / 10);
+            vector<int> at;
+            for(int i = 0; i < deletes; i++) at.push_back(1 + (int)(rng() % (songs - i)));
+            t = chrono::steady_clock::now();
+            for(int pos : at) p.deleteMusic(pos);
+            double delIndexed = msSince(t) * 1e3 / deletes;
+            same = same && p.size == songs - deletes && p.index.count(p.index.root) == p.size;
+            int left = p.size;
+            double delWalk = budgeted(at, walked, [&](int pos){
+                node* n = p.head;
+                for(int j = 1; j < pos % left + 1; j++) n = n->next;
+                n->prev->next = n->next;
+                n->next->prev = n->prev;
+                if(n == p.head) p.head = n->next;
+                left--;
+            }) * 1e3;
+            int delWalks = walked;
+
+            printf("%8d songs, %-7s index.at %8.3f us, walk %10.3f us (%d walks)%s\n", songs,
+                   shuffled ? "shuffle" : "load", atIndexed, atWalk, atWalks, same ? "" : "  WRONG NODE");
+            printf("%24s indexOf  %8.3f us, walk %10.3f us (%d walks)\n", "", ofIndexed, ofWalk, ofWalks);
+            printf("%24s random   %8.3f us, walk %10.3f us (%d walks)\n", "", pickIndexed, pickWalk, pickWalks);
+            printf("%24s delete   %8.3f us, walk %10.3f us (%d walks)\n", "", delIndexed, delWalk, delWalks);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "journal.h"
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0      // no such flag: the process ignores SIGPIPE instead
+#endif
+using namespace std;
+
+const string DAEMON_SOCKET = "soundlist.sock";
+
+// Control protocol of the headless daemon over a Unix domain stream socket.
+// Every message is an IpcHeader and its payload, fields laid out as
+// RecordWriter writes them (little-endian u32/f32/u64, u32-prefixed strings).
+//
+//   client -> daemon   BATCH       u32 id, u32 count, count x op
+//                      SUBSCRIBE   empty; STATE messages follow, the first at once
+//   daemon -> client   ACK         u32 id, u32 ops queued
+//                      STATE       IpcState
+//
+// An op is a u8 IpcOp and its arguments. The ops of a batch reach the player
+// in order with no other client's in between; SEEK and VOLUME are
+// last-writer-wins values that skip the queue.
+enum class IpcType : uint8_t{
+    BATCH = 1,
+    SUBSCRIBE,
+    ACK,
+    STATE,
+};
+
+// Numbers are part of the protocol: add at the end
+enum class IpcOp : uint8_t{
+    PLAY = 1, PAUSE, RESUME, STOP, NEXT, PREV, RANDOM, SHUFFLE,
+    SELECT,         // u32 pos (1-based)
+    REMOVE,         // u32 pos
+    ADD,            // str song
+    IMPORT,         // str playlist file
+    EXPORT,         // str playlist file
+    ADD_TRACKS,     // u32 n, n x (str name, str path)
+    MOVE,           // u32 from, u32 to
+    UNDO, REDO, DEDUPE,
+    CROSSFADE,      // u32 seconds
+    FADESHAPE,      // u32 FadeShape
+    SEEK,           // f32 seconds
+    VOLUME,         // f32 0..100
+    LOG,            // str message
+    SORT,           // str spec: "name", "duration", "date", "loudness", comma separated, '-' for descending
+};
+
+#pragma pack(push, 1)
+struct IpcHeader{
+    uint32_t bytes;     // payload that follows
+    uint8_t type;
+};
+#pragma pack(pop)
+
+// What subscribers are told whenever something they can see changes
+struct IpcState{
+    uint64_t seq = 0;           // STATE messages the daemon has built so far
+    uint64_t sentNs = 0;        // ipcNow() when it was sent
+    uint64_t generation = 0;    // bumped by every playlist edit
+    uint32_t flags = 0;         // PLAYING | PAUSED | ...
+    uint32_t current = 0;       // 1-based, 0 for none
+    uint32_t size = 0;
+    float offset = 0, duration = 0, volume = 0;
+    string song;
+    string log;
+
+    static constexpr uint32_t PLAYING = 1, PAUSED = 2, SHUFFLE = 4, CAN_UNDO = 8, CAN_REDO = 16;
+
+    void write(RecordWriter& w) const{
+        w.put(&seq, 8);
+        w.put(&sentNs, 8);
+        w.put(&generation, 8);
+        w.u32(flags);
+        w.u32(current);
+        w.u32(size);
+        w.f32(offset);
+        w.f32(duration);
+        w.f32(volume);
+        w.str(song);
+        w.str(log);
+    }
+
+    bool read(RecordReader& r){
+        r.get(&seq, 8);
+        r.get(&sentNs, 8);
+        r.get(&generation, 8);
+        flags = r.u32();
+        current = r.u32();
+        size = r.u32();
+        offset = r.f32();
+        duration = r.f32();
+        volume = r.f32();
+        r.str(song);
+        r.str(log);
+        return r.ok;
+    }
+};
+
+// Steady clock in ns; the same clock in every process on the machine
+inline uint64_t ipcNow(){
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Appends one framed message to out
+inline void ipcFrame(IpcType type, const RecordWriter& body, vector<char>& out){
+    IpcHeader h;
+    h.bytes = (uint32_t)body.bytes.size();
+    h.type = (uint8_t)type;
+    const char* p = (const char*)&h;
+    out.insert(out.end(), p, p + sizeof h);
+    out.insert(out.end(), body.bytes.begin(), body.bytes.end());
+}
+
+// A BATCH message, op by op
+struct IpcBatch{
+    uint32_t id = 0;
+    uint32_t count = 0;
+    RecordWriter ops;
+
+    void add(IpcOp op){ ops.put(&op, 1); count++; }
+    void add(IpcOp op, uint32_t pos){ add(op); ops.u32(pos); }
+    void add(IpcOp op, const string& text){ add(op); ops.str(text); }
+    void add(IpcOp op, float value){ add(op); ops.f32(value); }
+    void move(uint32_t from, uint32_t to){ add(IpcOp::MOVE, from); ops.u32(to); }
+
+    // (name, path) pairs, one op however many there are
+    void addTracks(const vector<pair<string, string>>& tracks){
+        add(IpcOp::ADD_TRACKS, (uint32_t)tracks.size());
+        for(auto& t : tracks){ ops.str(t.first); ops.str(t.second); }
+    }
+
+    vector<char> message() const{
+        RecordWriter body;
+        body.u32(id);
+        body.u32(count);
+        body.put(ops.bytes.data(), ops.bytes.size());
+        vector<char> out;
+        ipcFrame(IpcType::BATCH, body, out);
+        return out;
+    }
+};
+
+// Bytes read off a socket, cut into whole messages
+class IpcInbox{
+public:
+    static constexpr uint32_t MAX_MESSAGE = 256u << 20;
+
+    // Reads whatever is there without blocking once something has arrived.
+    // False on end of stream or an error.
+    bool fill(int fd){
+        if(at && at == buf.size()){ buf.clear(); at = 0; }
+        else if(at > (1u << 20)){ buf.erase(buf.begin(), buf.begin() + at); at = 0; }
+        int flags = 0;
+        while(true){
+            size_t old = buf.size();
+            buf.resize(old + CHUNK);
+            ssize_t n = recv(fd, &buf[old], CHUNK, flags);
+            buf.resize(old + (n > 0 ? (size_t)n : 0));
+            if(n == 0) return false;
+            if(n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            if((size_t)n < CHUNK) return true;
+            flags = MSG_DONTWAIT;
+        }
+    }
+
+    // The next whole message; body points into the inbox until the next fill()
+    bool next(IpcType& type, RecordReader& body){
+        if(buf.size() - at < sizeof(IpcHeader)) return false;
+        IpcHeader h;
+        memcpy(&h, &buf[at], sizeof h);
+        if(h.bytes > MAX_MESSAGE){ broken = true; return false; }
+        if(buf.size() - at - sizeof h < h.bytes) return false;
+        type = (IpcType)h.type;
+        body = RecordReader{&buf[at + sizeof h], &buf[at + sizeof h] + h.bytes};
+        at += sizeof h + h.bytes;
+        return true;
+    }
+
+    bool broken = false;    // the peer announced a message too big to take
+
+private:
+    static constexpr size_t CHUNK = 1 << 16;
+    vector<char> buf;
+    size_t at = 0;
+};
+
+inline bool ipcAddress(const string& path, sockaddr_un& addr){
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof addr.sun_path) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+inline bool ipcNonBlocking(int fd){
+    int fl = fcntl(fd, F_GETFL, 0);
+    return fl >= 0 && fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0;
+}
+
+// Listening socket at path, replacing a stale one; -1 on failure
+inline int ipcListen(const string& path){
+    sockaddr_un addr;
+    if(!ipcAddress(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    unlink(path.c_str());
+    if(bind(fd, (sockaddr*)&addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0 || !ipcNonBlocking(fd)){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Blocking connection to the daemon at path; -1 if it is not there
+inline int ipcConnect(const string& path){
+    sockaddr_un addr;
+    if(!ipcAddress(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, (sockaddr*)&addr, sizeof addr) != 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes all of data to a blocking socket
+inline bool ipcSendAll(int fd, const vector<char>& data){
+    size_t done = 0;
+    while(done < data.size()){
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "mappedfile.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+enum class JournalOp : uint8_t{
+    INSERT = 1,     // u32 pos, u32 count, count x (f32 duration, str song, str path)
+    REMOVE,         // u32 pos, u32 count
+    CURRENT,        // u32 pos + 1, 0 for none
+    PLAYBACK,       // f32 offset, f32 volume
+    ORDER,          // u32 count, count x u32: old position of the song now at each position
+};
+
+// On-disk layout of a session directory:
+//   journal.log    { JournalHeader | payload }*, appended as the playlist changes
+//   playlist.snap  SnapshotHeader | SnapshotRecord[count] | text bytes
+// The snapshot folds in every record up to its seq; the journal may still
+// hold some of those if a crash came between writing one and truncating the other.
+#pragma pack(push, 1)
+struct JournalHeader{
+    uint32_t bytes;     // payload that follows
+    uint32_t crc;       // CRC-32 of seq, op and payload
+    uint64_t seq;
+    uint8_t op;
+};
+struct SnapshotHeader{
+    char magic[4];      // "SLSS"
+    uint32_t version;
+    uint64_t seq;       // last journal record folded in
+    uint32_t count;
+    int32_t current;    // position, -1 for none
+    float offset;       // seconds into current
+    float volume;
+    uint64_t textBytes;
+};
+struct SnapshotRecord{
+    uint64_t textOff;   // song name, then path right after it
+    uint32_t songLen;
+    uint32_t pathLen;
+    float duration;
+};
+#pragma pack(pop)
+
+inline uint32_t crc32(const void* data, size_t n, uint32_t crc = 0){
+    static const array<uint32_t, 256> table = []{
+        array<uint32_t, 256> t;
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    for(size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Flushes stdio and asks the OS to put the file on disk
+inline bool syncFile(FILE* f){
+    if(fflush(f) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Payload of one record, built field by field
+struct RecordWriter{
+    vector<char> bytes;
+
+    void u32(uint32_t v){ put(&v, 4); }
+    void f32(float v){ put(&v, 4); }
+    void str(const string& s){ u32((uint32_t)s.size()); put(s.data(), s.size()); }
+    void put(const void* p, size_t n){ bytes.insert(bytes.end(), (const char*)p, (const char*)p + n); }
+};
+
+// Reads a payload back; any overrun clears ok and yields zeros
+struct RecordReader{
+    const char* p;
+    const char* end;
+    bool ok = true;
+
+    uint32_t u32(){ uint32_t v = 0; get(&v, 4); return v; }
+    float f32(){ float v = 0; get(&v, 4); return v; }
+    void str(string& out){
+        uint32_t n = u32();
+        if(!ok || (size_t)(end - p) < n){ ok = false; out.clear(); return; }
+        out.assign(p, n);
+        p += n;
+    }
+    void get(void* dst, size_t n){
+        if(!ok || (size_t)(end - p) < n){ ok = false; return; }
+        memcpy(dst, p, n);
+        p += n;
+    }
+};
+
+// Calls onRecord(op, seq, reader) for each intact record in file order and
+// returns the length of the intact prefix. A torn or corrupt record — the
+// tail of a write cut short by a crash — ends the log there, as does
+// onRecord returning false.
+template<class OnRecord>
+uint64_t readJournal(const string& path, uint64_t& lastSeq, OnRecord onRecord){
+    MappedFile map;
+    if(!map.open(path)) return 0;
+    map.adviseSequential();
+    const char* base = (const char*)map.data();
+    size_t at = 0;
+    while(map.size() - at >= sizeof(JournalHeader)){
+        JournalHeader h;
+        memcpy(&h, base + at, sizeof h);
+        size_t body = at + sizeof h;
+        if(map.size() - body < h.bytes) break;
+        uint32_t crc = crc32(&h.seq, sizeof h.seq + sizeof h.op);
+        if(crc32(base + body, h.bytes, crc) != h.crc) break;
+        RecordReader r{base + body, base + body + h.bytes};
+        if(!onRecord((JournalOp)h.op, h.seq, r)) break;
+        lastSeq = h.seq;
+        at = body + h.bytes;
+    }
+    return at;
+}
+
+// Whole playlist as written to playlist.snap
+struct SessionImage{
+    SnapshotHeader header{};
+    vector<SnapshotRecord> records;
+    string text;
+
+    void add(const string& song, const string& path, float duration){
+        SnapshotRecord r;
+        r.textOff = text.size();
+        r.songLen = (uint32_t)song.size();
+        r.pathLen = (uint32_t)path.size();
+        r.duration = duration;
+        records.push_back(r);
+        text += song;
+        text += path;
+    }
+
+    size_t bytes() const{ return sizeof header + records.size() * sizeof(SnapshotRecord) + text.size(); }
+};
+
+// Memory-mapped playlist.snap. Entries point straight into the mapping.
+class SnapshotView{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    SnapshotHeader header{};
+
+    struct Entry{
+        const char* song;
+        uint32_t songLen;
+        const char* path;
+        uint32_t pathLen;
+        float duration;
+    };
+
+    bool open(const string& path){
+        if(!map.open(path) || map.size() < sizeof header) return false;
+        memcpy(&header, map.data(), sizeof header);
+        if(memcmp(header.magic, "SLSS", 4) != 0 || header.version != VERSION) return false;
+        size_t recBytes = (size_t)header.count * sizeof(SnapshotRecord);
+        if(map.size() < sizeof header + recBytes + header.textBytes) return false;
+        recs = (const SnapshotRecord*)(map.data() + sizeof header);
+        text = (const char*)map.data() + sizeof header + recBytes;
+        map.adviseSequential();
+        return true;
+    }
+
+    // false if the record points outside the text
+    bool at(uint32_t i, Entry& e) const{
+        SnapshotRecord r;
+        memcpy(&r, recs + i, sizeof r);
+        if(r.textOff + r.songLen + r.pathLen > header.textBytes) return false;
+        e.song = text + r.textOff;
+        e.songLen = r.songLen;
+        e.path = e.song + r.songLen;
+        e.pathLen = r.pathLen;
+        e.duration = r.duration;
+        return true;
+    }
+
+private:
+    MappedFile map;
+    const SnapshotRecord* recs = nullptr;
+    const char* text = nullptr;
+};
+
+// Append-only journal with group commit. append() only copies the record
+// into memory; a background thread writes what has gathered every
+// COMMIT_MS and fsyncs once per batch. A snapshot is queued behind the
+// records before it, written under a temp name, synced and renamed, and only
+// then is the journal started afresh.
+class JournalWriter{
+public:
+    static constexpr int COMMIT_MS = 50;
+
+    JournalWriter(){}
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+    ~JournalWriter(){ close(); }
+
+    // Continues dir/journal.log after its first keep bytes (the intact part
+    // found on restore), numbering records after lastSeq
+    bool open(const string& dir, uint64_t keep, uint64_t lastSeq){
+        close();
+        error_code ec;
+        fs::create_directories(dir, ec);
+        logPath = (fs::path(dir) / "journal.log").string();
+        snapPath = (fs::path(dir) / "playlist.snap").string();
+        if(fs::exists(logPath, ec)) fs::resize_file(logPath, keep, ec);
+        log = fopen(logPath.c_str(), "ab");
+        if(!log) return false;
+        nextSeq = lastSeq + 1;
+        sinceSnapshot = keep;
+        quit = false;
+        worker = thread(&JournalWriter::run, this);
+        return true;
+    }
+
+    bool isOpen() const{ return log != nullptr; }
+
+    void append(JournalOp op, const RecordWriter& r){
+        JournalHeader h;
+        h.bytes = (uint32_t)r.bytes.size();
+        h.op = (uint8_t)op;
+        lock_guard<mutex> lock(m);
+        h.seq = nextSeq++;
+        h.crc = crc32(r.bytes.data(), r.bytes.size(), crc32(&h.seq, sizeof h.seq + sizeof h.op));
+        const char* p = (const char*)&h;
+        pending.insert(pending.end(), p, p + sizeof h);
+        pending.insert(pending.end(), r.bytes.begin(), r.bytes.end());
+        sinceSnapshot += sizeof h + r.bytes.size();
+    }
+
+    // Replaces the snapshot with image, covering every record appended so far
+    void snapshot(SessionImage image){
+        {
+            lock_guard<mutex> lock(m);
+            image.header.seq = nextSeq - 1;
+            sealed.push_back({move(pending), unique_ptr<SessionImage>(new SessionImage(move(image)))});
+            pending.clear();
+            sinceSnapshot = 0;
+        }
+        cv.notify_one();
+    }
+
+    // Last write error from the writer thread, once
+    bool takeError(string& msg){
+        lock_guard<mutex> lock(m);
+        if(error.empty()) return false;
+        msg.swap(error);
+        error.clear();
+        return true;
+    }
+
+    // Journal bytes a restart would have to replay
+    uint64_t bytesSinceSnapshot(){
+        lock_guard<mutex> lock(m);
+        return sinceSnapshot;
+    }
+
+    // Writes and syncs everything appended, then stops the writer
+    void close(){
+        if(!worker.joinable()) return;
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+        fclose(log);
+        log = nullptr;
+    }
+
+private:
+    struct Batch{
+        vector<char> records;
+        unique_ptr<SessionImage> snap;   // written after records, if any
+    };
+
+    string logPath, snapPath;
+    FILE* log = nullptr;
+    thread worker;
+    mutex m;
+    condition_variable cv;
+    bool quit = false;
+    vector<char> pending;
+    deque<Batch> sealed;
+    uint64_t nextSeq = 1;
+    uint64_t sinceSnapshot = 0;
+    string error;
+
+    void fail(const string& msg){
+        lock_guard<mutex> lock(m);
+        error = msg;
+    }
+
+    void run(){
+        unique_lock<mutex> lock(m);
+        while(true){
+            cv.wait_for(lock, chrono::milliseconds(COMMIT_MS), [this]{ return quit || !sealed.empty(); });
+            deque<Batch> work;
+            work.swap(sealed);
+            if(!pending.empty()) work.push_back({move(pending), nullptr});
+            pending.clear();
+            bool last = quit;
+            lock.unlock();
+            bool dirty = false;
+            for(Batch& b : work){
+                if(!b.records.empty()){
+                    fwrite(b.records.data(), 1, b.records.size(), log);
+                    dirty = true;
+                }
+                if(b.snap && writeSnapshot(*b.snap)){
+                    // everything in the log is now in the snapshot. If a fresh
+                    // log cannot be opened the old one goes on: replay skips
+                    // the records the snapshot covers.
+                    FILE* fresh = fopen(logPath.c_str(), "wb");
+                    if(fresh){
+                        fclose(log);
+                        log = fresh;
+                        dirty = false;
+                    } else {
+                        fail("ERROR: COULD NOT RESTART SESSION JOURNAL, APPENDING TO THE OLD ONE");
+                    }
+                }
+            }
+            if(dirty) syncFile(log);
+            if(last) return;
+            lock.lock();
+        }
+    }
+
+    bool writeSnapshot(SessionImage& img){
+        syncFile(log);
+        string tmp = snapPath + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return false;
+        memcpy(img.header.magic, "SLSS", 4);
+        img.header.version = SnapshotView::VERSION;
+        img.header.count = (uint32_t)img.records.size();
+        img.header.textBytes = img.text.size();
+        fwrite(&img.header, sizeof img.header, 1, f);
+        fwrite(img.records.data(), sizeof(SnapshotRecord), img.records.size(), f);
+        fwrite(img.text.data(), 1, img.text.size(), f);
+        bool good = ferror(f) == 0 && syncFile(f);
+        good = fclose(f) == 0 && good;
+        error_code ec;
+        if(good) fs::rename(tmp, snapPath, ec);
+        else fs::remove(tmp, ec);
+        return good && !ec;
+    }
+};
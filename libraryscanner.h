@@ -0,0 +1,231 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include <filesystem>
+#include <algorithm>
+#include "wavheader.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// One file in the music library
+struct TrackInfo{
+    string path;
+    string name;      // file stem, shown in the playlist
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    WavInfo wav;
+};
+
+// On-disk layout of library.idx:
+//   IndexHeader | IndexRecord[count] | path bytes
+#pragma pack(push, 1)
+struct IndexHeader{
+    char magic[4];        // "SLIX"
+    uint32_t version;
+    uint32_t count;
+    uint64_t pathBytes;
+};
+struct IndexRecord{
+    uint64_t size;
+    int64_t mtime;
+    uint64_t dataOffset;
+    uint64_t dataBytes;
+    uint32_t sampleRate;
+    uint16_t channels;
+    uint16_t bitsPerSample;
+    uint16_t format;
+    uint16_t blockAlign;
+    uint32_t pathOff;
+    uint32_t pathLen;
+    uint16_t nameOff;     // stem position inside the path
+    uint16_t nameLen;
+};
+#pragma pack(pop)
+
+// Walks a music root on all cores, reads WAV headers only, and keeps the result
+// in a memory-mapped index so the next start does not touch the music files.
+class LibraryScanner{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    ~LibraryScanner(){ if(worker.joinable()) worker.join(); }
+
+    // Maps an existing index; returns false if it is missing or stale
+    bool load(const string& indexPath){
+        tracks.clear();
+        MappedFile map;
+        if(!map.open(indexPath) || map.size() < sizeof(IndexHeader)) return false;
+        IndexHeader h;
+        memcpy(&h, map.data(), sizeof(h));
+        if(memcmp(h.magic, "SLIX", 4) != 0 || h.version != VERSION) return false;
+        size_t recBytes = (size_t)h.count * sizeof(IndexRecord);
+        if(map.size() < sizeof(IndexHeader) + recBytes + h.pathBytes) return false;
+        const IndexRecord* recs = (const IndexRecord*)(map.data() + sizeof(IndexHeader));
+        const char* paths = (const char*)(map.data() + sizeof(IndexHeader) + recBytes);
+        tracks.resize(h.count);
+        for(uint32_t i = 0; i < h.count; i++){
+            IndexRecord r;
+            memcpy(&r, recs + i, sizeof(r));
+            if((uint64_t)r.pathOff + r.pathLen > h.pathBytes || r.nameOff + r.nameLen > r.pathLen){ tracks.clear(); return false; }
+            TrackInfo& t = tracks[i];
+            t.path.assign(paths + r.pathOff, r.pathLen);
+            t.name.assign(paths + r.pathOff + r.nameOff, r.nameLen);
+            t.size = r.size;
+            t.mtime = r.mtime;
+            t.wav.dataOffset = r.dataOffset;
+            t.wav.dataBytes = r.dataBytes;
+            t.wav.sampleRate = r.sampleRate;
+            t.wav.channels = r.channels;
+            t.wav.bitsPerSample = r.bitsPerSample;
+            t.wav.format = r.format;
+            t.wav.blockAlign = r.blockAlign;
+        }
+        return true;
+    }
+
+    // Walks root and re-reads only files whose size or mtime changed.
+    // Files not present in the previous index end up in added.
+    void scan(const string& root){
+        unordered_map<string, size_t> known;
+        for(size_t i = 0; i < tracks.size(); i++) known[tracks[i].path] = i;
+
+        vector<TrackInfo> found;
+        error_code ec;
+        for(fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)){
+            // a file that cannot be queried is skipped; ec is left to the walk
+            error_code fileEc;
+            if(!it->is_regular_file(fileEc)) continue;
+            string ext = it->path().extension().string();
+            if(ext != ".wav" && ext != ".WAV") continue;
+            TrackInfo t;
+            t.path = it->path().string();
+            t.name = it->path().stem().string();
+            t.size = it->file_size(fileEc);
+            if(fileEc) continue;
+            t.mtime = (int64_t)it->last_write_time(fileEc).time_since_epoch().count();
+            if(fileEc) continue;
+            found.push_back(move(t));
+        }
+        // directory order is arbitrary; keep the playlist order stable across runs
+        sort(found.begin(), found.end(), [](const TrackInfo& a, const TrackInfo& b){ return a.path < b.path; });
+
+        vector<size_t> dirty;
+        vector<bool> isNew(found.size());
+        for(size_t i = 0; i < found.size(); i++){
+            auto k = known.find(found[i].path);
+            isNew[i] = k == known.end();
+            if(!isNew[i] && tracks[k->second].size == found[i].size && tracks[k->second].mtime == found[i].mtime)
+                found[i].wav = tracks[k->second].wav;
+            else
+                dirty.push_back(i);
+        }
+
+        vector<char> ok(found.size(), 1);
+        parallelFor(dirty.size(), [&](size_t i){
+            TrackInfo& t = found[dirty[i]];
+            ok[dirty[i]] = readHeader(t.path, t.size, t.wav);
+        });
+
+        tracks.clear();
+        added.clear();
+        for(size_t i = 0; i < found.size(); i++){
+            if(!ok[i]) continue;
+            if(isNew[i]) added.push_back(found[i]);
+            tracks.push_back(move(found[i]));
+        }
+        rescanned = dirty.size();
+    }
+
+    bool save(const string& indexPath) const{
+        string tmp = indexPath + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return false;
+        IndexHeader h;
+        memcpy(h.magic, "SLIX", 4);
+        h.version = VERSION;
+        h.count = (uint32_t)tracks.size();
+        h.pathBytes = 0;
+        for(const TrackInfo& t : tracks) h.pathBytes += t.path.size();
+        fwrite(&h, sizeof(h), 1, f);
+        uint32_t off = 0;
+        for(const TrackInfo& t : tracks){
+            IndexRecord r;
+            r.size = t.size;
+            r.mtime = t.mtime;
+            r.dataOffset = t.wav.dataOffset;
+            r.dataBytes = t.wav.dataBytes;
+            r.sampleRate = t.wav.sampleRate;
+            r.channels = t.wav.channels;
+            r.bitsPerSample = t.wav.bitsPerSample;
+            r.format = t.wav.format;
+            r.blockAlign = t.wav.blockAlign;
+            r.pathOff = off;
+            r.pathLen = (uint32_t)t.path.size();
+            r.nameOff = (uint16_t)(t.path.size() - t.name.size() - fs::path(t.path).extension().string().size()); // stem sits right before the extension
+            r.nameLen = (uint16_t)t.name.size();
+            fwrite(&r, sizeof(r), 1, f);
+            off += r.pathLen;
+        }
+        for(const TrackInfo& t : tracks) fwrite(t.path.data(), 1, t.path.size(), f);
+        bool good = ferror(f) == 0;
+        good = fclose(f) == 0 && good;
+        if(!good) return false;
+        error_code ec;
+        fs::rename(tmp, indexPath, ec);
+        return !ec;
+    }
+
+    // scan + save on a background thread; poll finished() from the UI
+    void rescanAsync(const string& root, const string& indexPath){
+        if(worker.joinable()) worker.join();
+        done = false;
+        worker = thread([this, root, indexPath]{
+            scan(root);
+            save(indexPath);
+            done = true;
+        });
+    }
+
+    bool finished() const{ return done; }
+
+    // From rescanAsync until takeAdded has collected what it found
+    bool scanning() const{ return worker.joinable(); }
+
+    // Tracks discovered by the last scan that were not in the old index
+    vector<TrackInfo> takeAdded(){
+        if(worker.joinable()) worker.join();
+        done = false;
+        return move(added);
+    }
+
+    vector<TrackInfo> tracks;
+    vector<TrackInfo> added;
+    size_t rescanned = 0;   // files whose headers were re-read by the last scan
+
+private:
+    thread worker;
+    atomic<bool> done{false};
+
+    static bool readHeader(const string& path, uint64_t size, WavInfo& out){
+        FILE* f = fopen(path.c_str(), "rb");
+        if(!f) return false;
+        bool ok = parseWavHeader([f](uint64_t off, void* dst, size_t n) -> size_t{
+#ifdef _WIN32
+            if(_fseeki64(f, (long long)off, SEEK_SET) != 0) return 0;
+#else
+            if(fseeko(f, (off_t)off, SEEK_SET) != 0) return 0;
+#endif
+            return fread(dst, 1, n, f);
+        }, size, out);
+        fclose(f);
+        return ok;
+    }
+};
@@ -0,0 +1,166 @@
+// Load generator for the daemon. First one client enqueues BULK tracks in a
+// single batch and times it until the ACK and until subscribers see the new
+// size. Then every client subscribes and sends batches of LOG ops back to
+// back for the given time, each waiting for its ACK; every batch changes the
+// state, so each one fans out to all subscribers. Reports op throughput,
+// ACK round trips and how long STATE messages took from daemon to client.
+//
+//   loadgen [clients] [seconds] [batch] [socket]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#ifndef _WIN32
+#include "ipc.h"
+
+const int BULK = 10000;
+
+struct ClientStats{
+    uint64_t ops = 0, batches = 0, states = 0, lost = 0;
+    vector<float> ackUs;        // batch sent -> its ACK
+    vector<float> stateUs;      // daemon sent -> client read
+};
+
+// Reads until the ACK for id (any id if 0) arrives, timing the STATEs on the way
+static bool awaitAck(int fd, IpcInbox& in, uint32_t id, ClientStats& st, uint64_t& lastSeq){
+    IpcType type;
+    RecordReader body{nullptr, nullptr};
+    while(true){
+        while(in.next(type, body)){
+            if(type == IpcType::STATE){
+                IpcState s;
+                if(!s.read(body)) return false;
+                st.stateUs.push_back((ipcNow() - s.sentNs) / 1e3f);
+                st.states++;
+                if(lastSeq && s.seq > lastSeq + 1) st.lost += s.seq - lastSeq - 1;    // coalesced away
+                lastSeq = s.seq;
+            } else if(type == IpcType::ACK){
+                uint32_t got = body.u32();
+                if(got == id) return true;
+            }
+        }
+        if(!in.fill(fd)) return false;
+    }
+}
+
+static float pct(vector<float>& v, double p){
+    if(v.empty()) return 0;
+    size_t k = min(v.size() - 1, (size_t)(v.size() * p));
+    nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+int main(int argc, char** argv){
+    int clients = argc > 1 ? atoi(argv[1]) : 200;
+    double seconds = argc > 2 ? atof(argv[2]) : 5;
+    int batch = argc > 3 ? atoi(argv[3]) : 16;
+    string path = argc > 4 ? argv[4] : DAEMON_SOCKET;
+
+    // bulk enqueue: one message, BULK tracks
+    {
+        int fd = ipcConnect(path);
+        if(fd < 0){ fprintf(stderr, "loadgen: no daemon at %s\n", path.c_str()); return 1; }
+        IpcInbox in;
+        ClientStats st;
+        uint64_t seq = 0;
+        vector<char> sub;
+        ipcFrame(IpcType::SUBSCRIBE, RecordWriter(), sub);
+        ipcSendAll(fd, sub);
+        IpcType type;
+        RecordReader body{nullptr, nullptr};
+        IpcState s;
+        while(!in.next(type, body)) in.fill(fd);
+        s.read(body);
+        uint32_t before = s.size;
+        IpcBatch b;
+        b.id = 1;
+        vector<pair<string, string>> tracks;
+        for(int i = 0; i < BULK; i++) tracks.push_back({"load " + to_string(i), "/nonexistent/load" + to_string(i) + ".wav"});
+        b.addTracks(tracks);
+        vector<char> msg = b.message();
+        uint64_t t0 = ipcNow();
+        ipcSendAll(fd, msg);
+        awaitAck(fd, in, 1, st, seq);
+        uint64_t acked = ipcNow();
+        while(s.size < before + BULK){
+            while(!in.next(type, body)) if(!in.fill(fd)) return 1;
+            if(type == IpcType::STATE) s.read(body);
+        }
+        uint64_t seen = ipcNow();
+        printf("bulk: %d tracks in one %.1f KB message, ack %.2f ms, visible to subscribers %.2f ms\n",
+               BULK, msg.size() / 1024.0, (acked - t0) / 1e6, (seen - t0) / 1e6);
+        close(fd);
+    }
+
+    vector<ClientStats> stats(clients);
+    atomic<int> ready{0}, failed{0};
+    atomic<bool> go{false};
+    vector<thread> pool;
+    for(int c = 0; c < clients; c++){
+        pool.emplace_back([&, c]{
+            ClientStats& st = stats[c];
+            int fd = ipcConnect(path);
+            if(fd < 0){ failed++; ready++; return; }
+            IpcInbox in;
+            vector<char> sub;
+            ipcFrame(IpcType::SUBSCRIBE, RecordWriter(), sub);
+            ipcSendAll(fd, sub);
+            uint64_t seq = 0;
+            ready++;
+            while(!go) this_thread::yield();
+            auto end = chrono::steady_clock::now() + chrono::duration<double>(seconds);
+            uint32_t id = 0;
+            while(chrono::steady_clock::now() < end){
+                IpcBatch b;
+                b.id = ++id;
+                for(int k = 0; k < batch; k++) b.add(IpcOp::LOG, "LOAD " + to_string(c) + "/" + to_string(id) + "/" + to_string(k));
+                uint64_t t0 = ipcNow();
+                if(!ipcSendAll(fd, b.message()) || !awaitAck(fd, in, id, st, seq)){ failed++; break; }
+                st.ackUs.push_back((ipcNow() - t0) / 1e3f);
+                st.ops += batch;
+                st.batches++;
+            }
+            close(fd);
+        });
+    }
+    while(ready < clients) this_thread::sleep_for(chrono::milliseconds(1));
+    this_thread::sleep_for(chrono::milliseconds(100));     // let the subscriptions land
+    auto t0 = chrono::steady_clock::now();
+    go = true;
+    for(thread& t : pool) t.join();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    ClientStats all;
+    for(ClientStats& s : stats){
+        all.ops += s.ops;
+        all.batches += s.batches;
+        all.states += s.states;
+        all.lost += s.lost;
+        all.ackUs.insert(all.ackUs.end(), s.ackUs.begin(), s.ackUs.end());
+        all.stateUs.insert(all.stateUs.end(), s.stateUs.begin(), s.stateUs.end());
+    }
+    printf("%d clients x %d ops/batch for %.1fs%s\n", clients, batch, wall,
+           failed ? (", " + to_string(failed.load()) + " FAILED").c_str() : "");
+    printf("  commands: %llu ops in %llu batches, %.0f ops/s\n", (unsigned long long)all.ops,
+           (unsigned long long)all.batches, all.ops / wall);
+    printf("  ack round trip: p50 %.0f us, p99 %.0f us, max %.0f us\n", pct(all.ackUs, 0.5), pct(all.ackUs, 0.99),
+           all.ackUs.empty() ? 0 : *max_element(all.ackUs.begin(), all.ackUs.end()));
+    printf("  notifications: %llu received (%.0f/s), %llu coalesced, delivery p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           (unsigned long long)all.states, all.states / wall, (unsigned long long)all.lost, pct(all.stateUs, 0.5),
+           pct(all.stateUs, 0.99), all.stateUs.empty() ? 0 : *max_element(all.stateUs.begin(), all.stateUs.end()));
+    return failed ? 1 : 0;
+}
+
+#else
+int main(){
+    fprintf(stderr, "loadgen: needs a POSIX system\n");
+    return 1;
+}
+#endif
@@ -0,0 +1,399 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include "mappedwav.h"
+#include "threadpool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUNDLIST_KWEIGHT_SSE 1
+#endif
+using namespace std;
+namespace fs = std::filesystem;
+
+struct TrackLoudness{
+    float lufs = -HUGE_VALF;   // integrated loudness, -inf for silence
+    float peak = 0;            // sample peak, 1 = full scale
+
+    // Linear gain that brings the track to target LUFS without clipping its peak
+    float gain(float target = -18.0f) const{
+        if(!isfinite(lufs)) return 1.0f;
+        float db = max(-24.0f, min(12.0f, target - lufs));
+        float g = powf(10.0f, db / 20.0f);
+        if(peak > 0) g = min(g, 1.0f / peak);
+        return g;
+    }
+};
+
+// ITU-R BS.1770 / EBU R128 integrated loudness: K-weighting (high shelf +
+// RLB high-pass), mean square over 400 ms blocks every 100 ms, then the
+// -70 LUFS absolute and -10 LU relative gates. Both biquads run on up to four
+// channels at once, one per SSE lane.
+class LoudnessMeter{
+public:
+    explicit LoudnessMeter(unsigned rate, unsigned channels) : channels(channels){
+        // coefficients as derived by the libebur128 authors, valid at any rate
+        double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+        double K = tan(PI * f0 / rate);
+        double Vh = pow(10.0, G / 20.0), Vb = pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q + K * K;
+        shelf[0] = (float)((Vh + Vb * K / Q + K * K) / a0);
+        shelf[1] = (float)(2.0 * (K * K - Vh) / a0);
+        shelf[2] = (float)((Vh - Vb * K / Q + K * K) / a0);
+        shelf[3] = (float)(2.0 * (K * K - 1.0) / a0);
+        shelf[4] = (float)((1.0 - K / Q + K * K) / a0);
+        f0 = 38.13547087602444; Q = 0.5003270373238773;
+        K = tan(PI * f0 / rate);
+        a0 = 1.0 + K / Q + K * K;
+        high[0] = 1; high[1] = -2; high[2] = 1;   // fixed numerator, folded into filter()
+        high[3] = (float)(2.0 * (K * K - 1.0) / a0);
+        high[4] = (float)((1.0 - K / Q + K * K) / a0);
+        groups = (channels + 3) / 4;
+        state.assign(groups * 16, 0.0f);
+        energy.assign(groups * 4, 0.0);
+        weight.assign(groups * 4, 0.0);
+        for(unsigned c = 0; c < channels; c++)
+            weight[c] = channels == 6 ? (c == 3 ? 0.0 : c >= 4 ? 1.41 : 1.0) : 1.0;   // 5.1: no LFE, louder surrounds
+        step = max(1u, rate / 10);
+    }
+
+    // frames of interleaved 16-bit samples
+    void add(const int16_t* s, size_t frames){
+        while(frames){
+            size_t k = min<size_t>(frames, step - inStep);
+            for(unsigned g = 0; g < groups; g++) filter(g, s, k);
+            s += k * channels;
+            frames -= k;
+            if((inStep += (unsigned)k) == step) closeStep();
+        }
+    }
+
+    TrackLoudness result() const{
+        TrackLoudness r;
+        r.peak = peak;
+        // 400 ms blocks = four consecutive 100 ms steps
+        vector<double> blocks;
+        for(size_t i = 3; i < steps.size(); i++)
+            blocks.push_back((steps[i] + steps[i-1] + steps[i-2] + steps[i-3]) / 4);
+        if(blocks.empty() && !steps.empty()){   // shorter than one block: use what there is
+            double sum = 0;
+            for(double z : steps) sum += z;
+            blocks.push_back(sum / steps.size());
+        }
+        double absGate = fromLufs(-70.0), sum = 0;
+        size_t n = 0;
+        for(double z : blocks) if(z > absGate){ sum += z; n++; }
+        if(!n) return r;
+        double relGate = sum / n * 0.1;     // 10 LU below the absolute-gated mean
+        sum = 0; n = 0;
+        for(double z : blocks) if(z > absGate && z > relGate){ sum += z; n++; }
+        if(n) r.lufs = (float)(-0.691 + 10.0 * log10(sum / n));
+        return r;
+    }
+
+private:
+    static constexpr double PI = 3.14159265358979323846;
+
+    unsigned channels, groups, step, inStep = 0;
+    float shelf[5], high[5];          // b0 b1 b2 a1 a2
+    vector<float> state;              // per group: shelf z1, z2, high z1, z2 (4 lanes each)
+    vector<double> energy;            // sum of squares in the current step, per channel
+    vector<double> weight;
+    vector<double> steps;             // weighted mean square of every 100 ms step
+    float peak = 0;
+
+    static double fromLufs(double l){ return pow(10.0, (l + 0.691) / 10.0); }
+
+    // Transposed direct form II, both stages, over frames for the four
+    // channels of group g. The state stays in registers for the whole run.
+    void filter(unsigned g, const int16_t* s, size_t frames){
+        float* st = &state[g * 16];
+        unsigned first = g * 4, lanes = min(4u, channels - first);
+        float x[4] = {}, sq[4], pk[4];
+#ifdef SOUNDLIST_KWEIGHT_SSE
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        const __m128 sb0 = _mm_set1_ps(shelf[0]), sb1 = _mm_set1_ps(shelf[1]), sb2 = _mm_set1_ps(shelf[2]);
+        const __m128 sa1 = _mm_set1_ps(shelf[3]), sa2 = _mm_set1_ps(shelf[4]);
+        const __m128 ha1 = _mm_set1_ps(high[3]), ha2 = _mm_set1_ps(high[4]);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        __m128 z1 = _mm_loadu_ps(st), z2 = _mm_loadu_ps(st + 4);
+        __m128 w1 = _mm_loadu_ps(st + 8), w2 = _mm_loadu_ps(st + 12);
+        __m128 acc = _mm_setzero_ps(), peakV = _mm_setzero_ps();
+        for(size_t i = 0; i < frames; i++, s += channels){
+            for(unsigned l = 0; l < lanes; l++) x[l] = s[first + l];
+            __m128 in = _mm_mul_ps(_mm_loadu_ps(x), scale);
+            peakV = _mm_max_ps(peakV, _mm_and_ps(in, absMask));
+            __m128 y = _mm_add_ps(_mm_mul_ps(in, sb0), z1);
+            z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(in, sb1), _mm_mul_ps(y, sa1)), z2);
+            z2 = _mm_sub_ps(_mm_mul_ps(in, sb2), _mm_mul_ps(y, sa2));
+            // high-pass numerator is 1, -2, 1
+            __m128 h = _mm_add_ps(y, w1);
+            w1 = _mm_sub_ps(_mm_sub_ps(w2, _mm_add_ps(y, y)), _mm_mul_ps(h, ha1));
+            w2 = _mm_sub_ps(y, _mm_mul_ps(h, ha2));
+            acc = _mm_add_ps(acc, _mm_mul_ps(h, h));
+        }
+        _mm_storeu_ps(st, z1);
+        _mm_storeu_ps(st + 4, z2);
+        _mm_storeu_ps(st + 8, w1);
+        _mm_storeu_ps(st + 12, w2);
+        _mm_storeu_ps(sq, acc);
+        _mm_storeu_ps(pk, peakV);
+#else
+        float acc[4] = {}, pkv[4] = {};
+        for(size_t i = 0; i < frames; i++, s += channels){
+            for(unsigned l = 0; l < lanes; l++) x[l] = s[first + l];
+            for(int l = 0; l < 4; l++){
+                float v = x[l] * (1.0f / 32768.0f);
+                pkv[l] = max(pkv[l], fabsf(v));
+                float y = shelf[0] * v + st[l];
+                st[l] = shelf[1] * v - shelf[3] * y + st[4 + l];
+                st[4 + l] = shelf[2] * v - shelf[4] * y;
+                float h = y + st[8 + l];
+                st[8 + l] = st[12 + l] - 2 * y - high[3] * h;
+                st[12 + l] = y - high[4] * h;
+                acc[l] += h * h;
+            }
+        }
+        for(int l = 0; l < 4; l++){ sq[l] = acc[l]; pk[l] = pkv[l]; }
+#endif
+        for(unsigned l = 0; l < lanes; l++){
+            energy[first + l] += sq[l];
+            peak = max(peak, pk[l]);
+        }
+    }
+
+    void closeStep(){
+        double z = 0;
+        for(unsigned c = 0; c < channels; c++){ z += weight[c] * energy[c]; energy[c] = 0; }
+        steps.push_back(z / step);
+        inStep = 0;
+    }
+};
+
+// On-disk layout of loudness.idx:
+//   LoudnessHeader | (LoudnessRecord + path bytes)[count]
+#pragma pack(push, 1)
+struct LoudnessHeader{
+    char magic[4];        // "SLLU"
+    uint32_t version;
+    uint32_t count;
+};
+struct LoudnessRecord{
+    uint64_t size;
+    int64_t mtime;
+    float lufs;
+    float peak;
+    uint32_t pathLen;
+};
+#pragma pack(pop)
+
+// Loudness of every track, measured once and kept in loudness.idx keyed by
+// path, size and mtime. lookup() never waits; anything unknown or not yet
+// checked against the file on disk is queued, and each queued batch is
+// measured in parallel, leaving one core for playback.
+class LoudnessCache{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    explicit LoudnessCache(const string& indexPath) : indexPath(indexPath){
+        load();
+        worker = thread(&LoudnessCache::run, this);
+    }
+
+    ~LoudnessCache(){
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+    }
+
+    // Result for path if it is known to match the file; queues it otherwise
+    bool lookup(const string& path, TrackLoudness& out){
+        {
+            lock_guard<mutex> lock(m);
+            auto it = entries.find(path);
+            if(it != entries.end() && it->second.checked && !it->second.failed){ out = it->second.value; return true; }
+            if(!enqueue(path)) return false;
+        }
+        cv.notify_one();
+        return false;
+    }
+
+    void request(const vector<string>& paths){
+        {
+            lock_guard<mutex> lock(m);
+            for(const string& p : paths){
+                auto it = entries.find(p);
+                if(it == entries.end() || !it->second.checked) enqueue(p);
+            }
+        }
+        cv.notify_one();
+    }
+
+    // Throughput line for the last batch that measured anything, once
+    bool takeReport(string& out){
+        lock_guard<mutex> lock(m);
+        if(report.empty()) return false;
+        out.swap(report);
+        report.clear();
+        return true;
+    }
+
+private:
+    struct Entry{
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        TrackLoudness value;
+        bool checked = false;   // size/mtime confirmed this session
+        bool failed = false;
+    };
+
+    string indexPath;
+    mutex m;
+    condition_variable cv;
+    thread worker;
+    bool quit = false;
+    unordered_map<string, Entry> entries;
+    vector<string> pending;
+    unordered_set<string> queued;
+    string report;
+
+    bool enqueue(const string& path){
+        auto it = entries.find(path);
+        if(it != entries.end() && it->second.failed) return false;
+        if(!queued.insert(path).second) return false;
+        pending.push_back(path);
+        return true;
+    }
+
+    void run(){
+        unique_lock<mutex> lock(m);
+        while(true){
+            cv.wait(lock, [this]{ return quit || !pending.empty(); });
+            if(quit) return;
+            vector<string> batch;
+            batch.swap(pending);
+            vector<Entry> known(batch.size());
+            for(size_t i = 0; i < batch.size(); i++){
+                auto it = entries.find(batch[i]);
+                if(it != entries.end()) known[i] = it->second;
+            }
+            lock.unlock();
+
+            unsigned threads = max(1u, workerCount() - 1);
+            vector<double> seconds(batch.size(), 0.0);
+            auto start = chrono::steady_clock::now();
+            parallelFor(batch.size(), [&](size_t i){
+                Entry& e = known[i];
+                error_code ec;
+                uint64_t size = fs::file_size(batch[i], ec);
+                int64_t mtime = ec ? 0 : (int64_t)fs::last_write_time(batch[i], ec).time_since_epoch().count();
+                if(ec){ e.failed = true; return; }
+                if(e.size == size && e.mtime == mtime && !e.failed && e.size){ e.checked = true; return; }
+                e = Entry();
+                e.size = size;
+                e.mtime = mtime;
+                e.checked = true;
+                e.failed = !measure(batch[i], e.value, seconds[i]);
+            }, threads);
+            double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            double audio = 0;
+            for(double s : seconds) audio += s;
+
+            lock.lock();
+            for(size_t i = 0; i < batch.size(); i++){
+                queued.erase(batch[i]);
+                entries[batch[i]] = known[i];
+            }
+            if(audio > 0){
+                char line[128];
+                snprintf(line, sizeof line, "LOUDNESS: %.1f H OF AUDIO IN %.1fs (%.2f AUDIO-H/S/CORE)",
+                         audio / 3600, wall, audio / 3600 / max(wall, 1e-6) / threads);
+                report = line;
+                lock.unlock();
+                save();
+                lock.lock();
+            }
+        }
+    }
+
+    static bool measure(const string& path, TrackLoudness& out, double& seconds){
+        MappedWav w;
+        if(!w.open(path)) return false;
+        unsigned ch = w.info.channels;
+        LoudnessMeter meter(w.info.sampleRate, ch);
+        vector<int16_t> buf(4096 * ch);
+        size_t got;
+        if(w.direct()){
+            const int16_t* p;
+            while((got = w.view(4096, p)) > 0) meter.add(p, got);
+        } else {
+            while((got = w.readFrames(buf.data(), 4096)) > 0) meter.add(buf.data(), got);
+        }
+        out = meter.result();
+        seconds = w.info.duration();
+        return true;
+    }
+
+    void load(){
+        FILE* f = fopen(indexPath.c_str(), "rb");
+        if(!f) return;
+        LoudnessHeader h;
+        if(fread(&h, sizeof h, 1, f) == 1 && memcmp(h.magic, "SLLU", 4) == 0 && h.version == VERSION){
+            string path;
+            for(uint32_t i = 0; i < h.count; i++){
+                LoudnessRecord r;
+                if(fread(&r, sizeof r, 1, f) != 1 || r.pathLen > 1 << 16) break;
+                path.resize(r.pathLen);
+                if(fread(&path[0], 1, r.pathLen, f) != r.pathLen) break;
+                Entry& e = entries[path];
+                e.size = r.size;
+                e.mtime = r.mtime;
+                e.value.lufs = r.lufs;
+                e.value.peak = r.peak;
+            }
+        }
+        fclose(f);
+    }
+
+    void save(){
+        vector<pair<string, Entry>> copy;
+        {
+            lock_guard<mutex> lock(m);
+            for(auto& kv : entries) if(!kv.second.failed) copy.push_back(kv);
+        }
+        string tmp = indexPath + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return;
+        setvbuf(f, nullptr, _IOFBF, 1 << 16);
+        LoudnessHeader h;
+        memcpy(h.magic, "SLLU", 4);
+        h.version = VERSION;
+        h.count = (uint32_t)copy.size();
+        fwrite(&h, sizeof h, 1, f);
+        for(auto& kv : copy){
+            LoudnessRecord r;
+            r.size = kv.second.size;
+            r.mtime = kv.second.mtime;
+            r.lufs = kv.second.value.lufs;
+            r.peak = kv.second.value.peak;
+            r.pathLen = (uint32_t)kv.first.size();
+            fwrite(&r, sizeof r, 1, f);
+            fwrite(kv.first.data(), 1, kv.first.size(), f);
+        }
+        bool good = ferror(f) == 0;
+        good = fclose(f) == 0 && good;
+        error_code ec;
+        if(good) fs::rename(tmp, indexPath, ec);
+    }
+};
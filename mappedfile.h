@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// Read-only memory mapping of a whole file. Empty or missing files map to
+// nothing and data() stays nullptr.
+class MappedFile{
+public:
+    MappedFile(){}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){ close(); }
+
+    bool open(const string& path){
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if(!GetFileSizeEx(file, &sz) || sz.QuadPart == 0){ close(); return false; }
+        len = (size_t)sz.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping){ close(); return false; }
+        ptr = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0){ close(); return false; }
+        len = (size_t)st.st_size;
+        void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        ptr = p == MAP_FAILED ? nullptr : (const unsigned char*)p;
+#endif
+        if(!ptr){ close(); return false; }
+        return true;
+    }
+
+    void close(){
+#ifdef _WIN32
+        if(ptr) UnmapViewOfFile(ptr);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(ptr) munmap((void*)ptr, len);
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        ptr = nullptr;
+        len = 0;
+    }
+
+    // Hints for streaming: read ahead behind the reader, and start fetching
+    // [off, off+n) now. No-ops where the platform has no cheap equivalent.
+    void adviseSequential() const{
+#ifndef _WIN32
+        if(ptr) posix_madvise((void*)ptr, len, POSIX_MADV_SEQUENTIAL);
+#endif
+    }
+
+    void willNeed(size_t off, size_t n) const{
+#ifndef _WIN32
+        if(!ptr || off >= len) return;
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = off - off % page;
+        posix_madvise((void*)(ptr + start), min(len, off + n) - start, POSIX_MADV_WILLNEED);
+#else
+        (void)off; (void)n;
+#endif
+    }
+
+    const unsigned char* data() const{ return ptr; }
+    size_t size() const{ return len; }
+    bool isOpen() const{ return ptr != nullptr; }
+
+private:
+    const unsigned char* ptr = nullptr;
+    size_t len = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
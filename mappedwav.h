@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "mappedfile.h"
+#include "wavheader.h"
+#include "wavreader.h"
+using namespace std;
+
+// PCM WAV read straight out of a memory mapping. The chunk list is walked
+// once at open; after that a seek is just an index and 16-bit little-endian
+// data is handed out in place, without a copy. Other sample formats are
+// converted from the mapping into the caller's buffer.
+class MappedWav{
+public:
+    WavInfo info;
+
+    bool open(const string& path){
+        pos = 0;
+        if(!map.open(path)) return false;
+        const unsigned char* base = map.data();
+        size_t size = map.size();
+        bool ok = parseWavHeader([base, size](uint64_t off, void* dst, size_t n) -> size_t{
+            if(off >= size) return 0;
+            n = (size_t)min<uint64_t>(n, size - off);
+            memcpy(dst, base + off, n);
+            return n;
+        }, size, info);
+        if(!ok || !wavDecodable(info)){ map.close(); return false; }
+        map.adviseSequential();
+        return true;
+    }
+
+    bool isOpen() const{ return map.isOpen(); }
+    uint64_t frames() const{ return info.frames(); }
+    uint64_t tell() const{ return pos; }
+
+    // Interleaved 16-bit samples can be used where they lie
+    bool direct() const{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return false;
+#else
+        return info.format == 1 && info.bitsPerSample == 16 && info.dataOffset % 2 == 0;
+#endif
+    }
+
+    void seekFrame(uint64_t frame){
+        pos = min(frame, frames());
+        map.willNeed((size_t)(info.dataOffset + pos * info.blockAlign), 1 << 18);
+    }
+
+    // Up to count frames in place; only when direct()
+    size_t view(size_t count, const int16_t*& out){
+        count = (size_t)min<uint64_t>(count, frames() - pos);
+        out = (const int16_t*)(map.data() + info.dataOffset + pos * info.blockAlign);
+        pos += count;
+        return count;
+    }
+
+    // Up to count frames converted into out (count * channels samples)
+    size_t readFrames(int16_t* out, size_t count){
+        count = (size_t)min<uint64_t>(count, frames() - pos);
+        wavToInt16(info, map.data() + info.dataOffset + pos * info.blockAlign, count * info.channels, out);
+        pos += count;
+        return count;
+    }
+
+    // Faults in the next frames now, so the audio thread does not wait on disk
+    void warm(uint64_t count){
+        const unsigned char* p = map.data() + info.dataOffset + pos * info.blockAlign;
+        size_t n = (size_t)(min<uint64_t>(count, frames() - pos) * info.blockAlign);
+        volatile unsigned char sink = 0;
+        for(size_t i = 0; i < n; i += 4096) sink ^= p[i];
+        (void)sink;
+    }
+
+private:
+    MappedFile map;
+    uint64_t pos = 0;       // frame
+};
@@ -0,0 +1,78 @@
+// Frames per second through rampMix (SSE for mono and stereo, where the
+// target has it) against rampMixScalar, for the spans TrackStream mixes: the
+// 64-frame linear pieces a curved fade is drawn with and a whole 100 ms
+// chunk at 48 kHz. Input runs a little past full scale so saturation is
+// included. Also reports how far the SSE output strays from the scalar one;
+// the gains are stepped rather than recomputed, so 1 LSB is expected.
+//
+//   mixbench [frames]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "mixer.h"
+using namespace std;
+
+const int ROUNDS = 5;
+const size_t SPANS[] = {64, 4800};
+volatile int sink;    // keeps the mixes from being optimized out
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+// Best frames/s of mix over total frames, cut into span-sized pieces along one fade
+template<class Mix>
+static double rate(const vector<float>& a, const vector<float>& b, vector<int16_t>& dst, size_t total, size_t span,
+                   unsigned ch, Mix mix){
+    size_t have = a.size() / ch;
+    double best = 1e30;
+    for(int r = 0; r < ROUNDS; r++){
+        auto t = chrono::steady_clock::now();
+        for(size_t done = 0; done < total; done += span){
+            size_t at = done % (have - span + 1);
+            float t0 = (float)done / total, t1 = (float)(done + span) / total;
+            mix(&a[at*ch], &b[at*ch], &dst[at*ch], span, ch, 1 - t0, 1 - t1, t0, t1);
+        }
+        sink = dst[0];
+        best = min(best, msSince(t));
+    }
+    return total / best * 1e3;
+}
+
+int main(int argc, char** argv){
+    size_t total = argc > 1 ? (size_t)atol(argv[1]) : 20000000;
+    mt19937 rng(7);
+    uniform_real_distribution<float> sample(-1.2f, 1.2f);
+    const size_t HAVE = 48000;   // a second of source, reused so it stays in cache
+#ifdef SOUNDLIST_MIX_SSE
+    printf("rampMix SSE against rampMixScalar, %zu frames per run\n", total);
+#else
+    printf("no SSE on this target: rampMix is rampMixScalar, %zu frames per run\n", total);
+#endif
+    for(unsigned ch : {1u, 2u}){
+        vector<float> a(HAVE * ch), b(HAVE * ch);
+        for(float& s : a) s = sample(rng);
+        for(float& s : b) s = sample(rng);
+        vector<int16_t> fast(HAVE * ch), ref(HAVE * ch);
+        for(size_t span : SPANS){
+            int diff = 0;
+            for(size_t at = 0; at + span <= HAVE; at += span){
+                float t0 = (float)at / HAVE, t1 = (float)(at + span) / HAVE;
+                rampMix(&a[at*ch], &b[at*ch], &fast[at*ch], span, ch, 1 - t0, 1 - t1, t0, t1);
+                rampMixScalar(&a[at*ch], &b[at*ch], &ref[at*ch], span, ch, 1 - t0, 1 - t1, t0, t1);
+            }
+            for(size_t i = 0; i < HAVE / span * span * ch; i++) diff = max(diff, abs(fast[i] - ref[i]));
+            double simd = rate(a, b, fast, total, span, ch, rampMix);
+            double scalar = rate(a, b, ref, total, span, ch, [](const float* x, const float* y, int16_t* d, size_t n,
+                                 unsigned c, float a0, float a1, float b0, float b1){
+                rampMixScalar(x, y, d, n, c, a0, a1, b0, b1);
+            });
+            printf("  %-6s %4zu-frame spans: rampMix %7.1f M frames/s, scalar %7.1f M frames/s, %.2fx, max diff %d LSB\n",
+                   ch == 1 ? "mono" : "stereo", span, simd / 1e6, scalar / 1e6, simd / scalar, diff);
+        }
+    }
+    return 0;
+}
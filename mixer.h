@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUNDLIST_MIX_SSE 1
+#endif
+using namespace std;
+
+enum class FadeShape{ Linear, EqualPower, SCurve };
+
+inline const char* fadeShapeName(FadeShape s){
+    switch(s){
+        case FadeShape::Linear:     return "LIN";
+        case FadeShape::EqualPower: return "EQP";
+        default:                    return "S";
+    }
+}
+
+// Gains of the outgoing and incoming track at t in [0, 1] of the fade
+inline void fadeGains(FadeShape shape, float t, float& out, float& in){
+    t = max(0.0f, min(1.0f, t));
+    if(shape == FadeShape::EqualPower){   // constant power for uncorrelated material
+        in = sinf(t * 1.5707963f);
+        out = cosf(t * 1.5707963f);
+        return;
+    }
+    if(shape == FadeShape::SCurve) in = t * t * (3.0f - 2.0f * t);   // smoothstep: gentle at both ends
+    else in = t;
+    out = 1.0f - in;
+}
+
+// rampMix one frame at a time from frame first on: the tail of the SSE loop,
+// the whole span elsewhere, and the reference for both
+inline void rampMixScalar(const float* a, const float* b, int16_t* dst, size_t frames, unsigned channels,
+                          float ga0, float ga1, float gb0, float gb1, size_t first = 0){
+    if(!frames) return;
+    float da = (ga1 - ga0) / frames, db = (gb1 - gb0) / frames;
+    for(size_t i = first; i < frames; i++){
+        float g1 = ga0 + da * i, g2 = gb0 + db * i;
+        for(unsigned c = 0; c < channels; c++){
+            float v = (a[i*channels + c] * g1 + b[i*channels + c] * g2) * 32767.0f;
+            dst[i*channels + c] = (int16_t)lrintf(max(-32768.0f, min(32767.0f, v)));
+        }
+    }
+}
+
+// dst[i] = a[i]*ga + b[i]*gb for interleaved frames, with both gains moving
+// linearly from their start to end value across the span, saturated to 16
+// bits. Curved fades are drawn as short linear pieces of this.
+inline void rampMix(const float* a, const float* b, int16_t* dst, size_t frames, unsigned channels,
+                    float ga0, float ga1, float gb0, float gb1){
+    size_t i = 0;
+#ifdef SOUNDLIST_MIX_SSE
+    if(frames && channels <= 2){
+        float da = (ga1 - ga0) / frames, db = (gb1 - gb0) / frames;
+        // four samples per step: frames f..f+3 (mono) or f, f, f+1, f+1 (stereo)
+        unsigned per = 4 / channels;
+        __m128 lane = channels == 1 ? _mm_setr_ps(0, 1, 2, 3) : _mm_setr_ps(0, 0, 1, 1);
+        __m128 ga = _mm_add_ps(_mm_set1_ps(ga0), _mm_mul_ps(lane, _mm_set1_ps(da)));
+        __m128 gb = _mm_add_ps(_mm_set1_ps(gb0), _mm_mul_ps(lane, _mm_set1_ps(db)));
+        __m128 stepA = _mm_set1_ps(da * per), stepB = _mm_set1_ps(db * per);
+        __m128 scale = _mm_set1_ps(32767.0f);
+        size_t samples = frames * channels;
+        for(; i + 8 <= samples; i += 8){
+            __m128 x0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), ga), _mm_mul_ps(_mm_loadu_ps(b + i), gb));
+            ga = _mm_add_ps(ga, stepA); gb = _mm_add_ps(gb, stepB);
+            __m128 x1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i + 4), ga), _mm_mul_ps(_mm_loadu_ps(b + i + 4), gb));
+            ga = _mm_add_ps(ga, stepA); gb = _mm_add_ps(gb, stepB);
+            __m128i p = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(x0, scale)), _mm_cvtps_epi32(_mm_mul_ps(x1, scale)));
+            _mm_storeu_si128((__m128i*)(dst + i), p);
+        }
+        i /= channels;
+    }
+#endif
+    rampMixScalar(a, b, dst, frames, channels, ga0, ga1, gb0, gb1, i);
+}
@@ -1,99 +1,792 @@
 #pragma once
 #include <iostream>
-#include <windows.h>
 #include <string>
 #include <vector>
 #include <atomic>
 #include <thread>
-#include <SFML/Audio.hpp>
+#include <cstdint>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include "audiobackend.h"
+#include "spectrum.h"
+#include "waveform.h"
+#include "loudness.h"
+#include "fingerprint.h"
+#include "nullbackend.h"
+#ifndef SOUNDLIST_NO_SFML
+#include "sfmlbackend.h"
+#endif
+#include "libraryscanner.h"
+#include "searchindex.h"
+#include "playlistio.h"
+#include "shuffle.h"
+#include "playlistsort.h"
+#include "history.h"
+#include "journal.h"
+#include "profiler.h"
 using namespace std;
 
+#ifndef SOUNDLIST_MUSIC_ROOT
+#define SOUNDLIST_MUSIC_ROOT "C:\\Users\\DELL\\OneDrive\\Desktop\\DSA_FINAL_PROJECT\\Music\\"
+#endif
+const string MUSIC_ROOT = SOUNDLIST_MUSIC_ROOT;
+const string LIBRARY_INDEX = "library.idx";
+const string WAVEFORM_CACHE = "waveforms";
+const string LOUDNESS_INDEX = "loudness.idx";
+const string FINGERPRINT_INDEX = "fingerprints.idx";
+const float MAX_CROSSFADE = 12.0f;          // seconds
+const string SESSION_DIR = "session";       // playlist snapshot + journal
+
 struct node{
-    string song;
+    // first, so a list walk and a sort comparison touch one cache line
     node* next;
     node* prev;
-    node(string s){
-        song = s;
+    uint64_t sortKey; // first field of the running sortBy
+    string song;
+    string path;      // full file path, empty for songs typed in by name
+    float duration;   // seconds, 0 when unknown
+    // order-statistic index links (implicit treap keyed by playlist position)
+    node* left;
+    node* right;
+    node* parent;
+    unsigned pri;
+    int cnt;
+    uint32_t id;  // stable handle into the NodePool
+    node(string s, uint32_t h = 0){
         next = nullptr;
         prev = nullptr;
+        sortKey = 0;
+        song = s;
+        duration = 0;
+        left = right = parent = nullptr;
+        pri = 0;
+        cnt = 1;
+        id = h;
+    }
+};
+
+// Slab allocator for playlist nodes. Slabs are reserved once and never grow,
+// so node addresses stay stable; deleted slots go on a free list for reuse.
+// A handle is the slot number and stays valid until that song is deleted.
+// The list and index links stay plain pointers; handles name songs where a
+// pointer cannot be kept: undo history, the journal and per-song caches.
+class NodePool{
+public:
+    static constexpr uint32_t SLAB_BITS = 12;               // 4096 nodes per slab
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+
+    size_t slabAllocs = 0;  // heap allocations made by the pool
+    size_t live = 0;
+
+    node* alloc(const string& song){
+        node* n;
+        if(!freeSlots.empty()){
+            uint32_t h = freeSlots.back();
+            freeSlots.pop_back();
+            n = get(h);
+            n->song = song;
+            n->path.clear();
+            n->duration = 0;
+            n->next = n->prev = nullptr;
+            n->left = n->right = n->parent = nullptr;
+            n->pri = 0;
+            n->cnt = 1;
+        } else {
+            if(slabs.empty() || slabs.back().size() == SLAB_SIZE){
+                slabs.emplace_back();
+                slabs.back().reserve(SLAB_SIZE);
+                slabAllocs++;
+            }
+            uint32_t h = (uint32_t)((slabs.size()-1) << SLAB_BITS | slabs.back().size());
+            slabs.back().emplace_back(song, h);
+            n = &slabs.back().back();
+        }
+        live++;
+        return n;
+    }
+
+    void release(node* n){
+        n->song.clear();
+        n->path.clear();
+        n->next = n->prev = nullptr;
+        freeSlots.push_back(n->id);
+        live--;
+    }
+
+    node* get(uint32_t h) const{
+        if(h == NIL || (h >> SLAB_BITS) >= slabs.size()) return nullptr;
+        const vector<node>& slab = slabs[h >> SLAB_BITS];
+        if((h & (SLAB_SIZE-1)) >= slab.size()) return nullptr;
+        return const_cast<node*>(&slab[h & (SLAB_SIZE-1)]);
+    }
+
+    // Drops every node at once — one free per slab instead of one per song
+    void clear(){
+        slabs.clear();
+        freeSlots.clear();
+        live = 0;
+    }
+
+private:
+    vector<vector<node>> slabs;
+    vector<uint32_t> freeSlots;
+};
+
+// Rank-augmented treap over the circular list — answers "node at position i"
+// and "position of node" in O(log n) without walking next/prev.
+class PlaylistIndex{
+public:
+    node* root = nullptr;
+
+    static int count(node* t){ return t ? t->cnt : 0; }
+
+    // 0-based position -> node
+    node* at(int i) const{
+        node* t = root;
+        while(t){
+            int l = count(t->left);
+            if(i < l) t = t->left;
+            else if(i == l) return t;
+            else { i -= l+1; t = t->right; }
+        }
+        return nullptr;
+    }
+
+    // node -> 0-based position
+    int indexOf(node* n) const{
+        if(!n) return -1;
+        int r = count(n->left);
+        while(n->parent){
+            if(n == n->parent->right) r += count(n->parent->left) + 1;
+            n = n->parent;
+        }
+        return r;
+    }
+
+    // Puts count nodes already linked by next in before position pos, in
+    // O(count + log n): the sub-treap is built left to right with a stack,
+    // then merged in once
+    void insertChain(int pos, node* first, int count){
+        node* n = first;
+        insertBuilt(pos, build(count, [&n]{ node* t = n; n = n->next; return t; }));
+    }
+
+    // The whole index over nodes in playlist order. Reading them from an
+    // array, not along next, lets the cache misses of a shuffled list overlap.
+    void rebuild(const vector<node*>& order){
+        size_t i = 0;
+        root = build((int)order.size(), [&]{ return order[i++]; });
+        if(root) root->parent = nullptr;
+    }
+
+    // Drops count nodes from position pos out of the index
+    void eraseRange(int pos, int count){
+        node *a, *b, *mid, *c;
+        split(root, pos, a, b);
+        split(b, count, mid, c);
+        root = merge(a, c);
+        if(root) root->parent = nullptr;
+    }
+
+    void clear(){ root = nullptr; }
+
+private:
+    unsigned seed = 2463534242u;
+    unsigned nextPri(){ seed ^= seed<<13; seed ^= seed>>17; seed ^= seed<<5; return seed; }
+
+    // Sub-treap over count nodes handed out in order by next()
+    template<class Next>
+    node* build(int count, Next next){
+        vector<node*> stack;
+        for(int i = 0; i < count; i++){
+            node* n = next();
+            n->left = n->right = n->parent = nullptr;
+            n->cnt = 1;
+            n->pri = nextPri();
+            node* last = nullptr;
+            while(!stack.empty() && stack.back()->pri < n->pri){
+                last = stack.back();
+                stack.pop_back();
+                pull(last);
+            }
+            n->left = last;
+            if(!stack.empty()) stack.back()->right = n;
+            stack.push_back(n);
+        }
+        node* sub = stack.empty() ? nullptr : stack.front();
+        while(!stack.empty()){ pull(stack.back()); stack.pop_back(); }
+        return sub;
+    }
+
+    void insertBuilt(int pos, node* sub){
+        node *a, *b;
+        split(root, pos, a, b);
+        root = merge(merge(a, sub), b);
+        if(root) root->parent = nullptr;
+    }
+
+    static void pull(node* t){
+        t->cnt = 1 + count(t->left) + count(t->right);
+        if(t->left)  t->left->parent = t;
+        if(t->right) t->right->parent = t;
+    }
+
+    static node* merge(node* a, node* b){
+        if(!a) return b;
+        if(!b) return a;
+        if(a->pri > b->pri){
+            a->right = merge(a->right, b);
+            pull(a);
+            return a;
+        }
+        b->left = merge(a, b->left);
+        pull(b);
+        return b;
+    }
+
+    // first k nodes -> a, rest -> b
+    static void split(node* t, int k, node*& a, node*& b){
+        if(!t){ a = b = nullptr; return; }
+        t->parent = nullptr;
+        if(count(t->left) < k){
+            split(t->right, k - count(t->left) - 1, t->right, b);
+            pull(t);
+            a = t;
+        } else {
+            split(t->left, k, a, t->left);
+            pull(t);
+            b = t;
+        }
+        if(a) a->parent = nullptr;
+        if(b) b->parent = nullptr;
+    }
+};
+
+// Detached run of nodes linked next/prev, spliced into the ring in one step
+struct NodeChain{
+    node* first = nullptr;
+    node* last = nullptr;
+    int count = 0;
+
+    void push(node* n){
+        n->next = nullptr;
+        n->prev = last;
+        if(last) last->next = n;
+        else first = n;
+        last = n;
+        count++;
+    }
+};
+
+// Zero-copy window over consecutive songs of the circular list
+struct PlaylistRange{
+    node* first;
+    int count;
+
+    struct iterator{
+        node* n;
+        int left;
+        node* operator*() const{ return n; }
+        iterator& operator++(){ n = n->next; left--; return *this; }
+        bool operator!=(const iterator& o) const{ return left != o.left; }
+    };
+    iterator begin() const{ return {first, count}; }
+    iterator end() const{ return {nullptr, 0}; }
+    bool empty() const{ return count == 0; }
+};
+
+// Playlist order by a list of fields, over keys gathered beforehand, every
+// one an integer. The first is also in node::sortKey (descending already
+// flipped), so most pairs are one compare; the rest break its ties.
+struct SongOrder{
+    vector<SortField> fields;
+    const SortKeyCache* keys = nullptr;
+
+    uint64_t key(SortKey k, const node& n) const{
+        switch(k){
+            case SortKey::Name:     return (*keys)[n.id].name;
+            case SortKey::Duration: return n.duration > 0 ? floatSortKey(n.duration) : SORT_UNKNOWN;
+            case SortKey::FileDate: return (*keys)[n.id].date;
+            case SortKey::Loudness: return (*keys)[n.id].loudness;
+        }
+        return SORT_UNKNOWN;
+    }
+
+    // Unknown values go last whichever way the field sorts
+    int compare(const SortField& f, const node& a, const node& b) const{
+        uint64_t x = key(f.key, a), y = key(f.key, b);
+        if(x == y) return 0;
+        if(x == SORT_UNKNOWN) return 1;
+        if(y == SORT_UNKNOWN) return -1;
+        return (x < y) != f.descending ? -1 : 1;
+    }
+
+    bool operator()(const node& a, const node& b) const{
+        if(a.sortKey != b.sortKey) return a.sortKey < b.sortKey;
+        for(const SortField& f : fields){
+            int c = compare(f, a, b);
+            if(c) return c < 0;
+        }
+        return false;
     }
 };
 
 class MusicPlayer{
 public:
+    static constexpr uint64_t COMPACT_BYTES = 4u << 20;   // journal size that triggers a snapshot
+    static constexpr float PLAYBACK_STEP = 5.0f;          // seconds of progress per PLAYBACK record
+    static constexpr size_t SEARCH_BATCH = 4096;          // restored songs indexed per update
+
     node* head;
     node* current;
     int size;
     atomic<bool> isPlaying;
     atomic<bool> isPaused;
     string logMsg;
+    unsigned long long generation; // bumped on every structural playlist change
+    NodePool pool;       // backing storage for every node
+    PlaylistIndex index; // positional lookups over the circular list
+    SearchIndex search;  // trigram index over song names
+    ShuffleOrder shuffle;
+    EditHistory history; // undo/redo over persistent versions of the order
+    SortKeyCache sortKeys;  // file dates and loudness for sorting, by handle
+    bool shuffleOn;      // next/prev/auto-advance follow the shuffled order
+
+    SpectrumAnalyzer spectrum;      // fed by the backend, read lock-free by the UI
+    WaveformCache waves{WAVEFORM_CACHE};
+    LoudnessCache loudness{LOUDNESS_INDEX};
+    bool normalizeLoudness = true;  // per-track gain towards -18 LUFS
+    FingerprintCache prints{FINGERPRINT_INDEX};
+    bool dedupeRunning = false;
+    float crossfadeSec = 0;         // overlap between tracks, 0 = gapless cut
+    FadeShape fadeShape = FadeShape::EqualPower;
+    unique_ptr<AudioBackend> audio; // playback, seek, volume and gapless changes
+
+    // transition stats
+    unsigned long long lastGapSamples = 0;  // silence inserted at the last automatic track change
+    float worstTransitionMs = 0;            // slowest frame right after the last track change
+    int framesSinceTransition = 1 << 30;
+    chrono::steady_clock::time_point lastUpdate = chrono::steady_clock::now();
 
-    sf::Music music;  // SFML music object — handles playback, seek, volume
+    // session journal; what was last written lets update() log only changes
+    JournalWriter journal;
+    bool journaling = false;        // off while a session is being replayed
+    uint64_t snapshotBytes = 0;
+    node* loggedCurrent = nullptr;
+    int loggedPos = 0;
+    float loggedOffset = 0, loggedVolume = 0;
+    bool loggedPlaying = false;
+    node* resumeNode = nullptr;     // restored current, first played from resumeOffset
+    float resumeOffset = 0;
+    vector<bool> searchPending;     // restored handles not in the search index yet
+    size_t searchCursor = 0;
 
-    MusicPlayer(){
+    // SFML output unless built with SOUNDLIST_NO_SFML, then a silent wall-clock one
+    static unique_ptr<AudioBackend> defaultBackend(){
+#ifndef SOUNDLIST_NO_SFML
+        return unique_ptr<AudioBackend>(new SfmlBackend());
+#else
+        return unique_ptr<AudioBackend>(new NullBackend());
+#endif
+    }
+
+    explicit MusicPlayer(unique_ptr<AudioBackend> backend = defaultBackend()) : audio(move(backend)){
         head = nullptr;
         current = nullptr;
         size = 0;
+        generation = 0;
+        shuffleOn = false;
+        shuffle.seed((uint64_t)chrono::steady_clock::now().time_since_epoch().count());
         isPlaying = false;
         isPaused = false;
         logMsg = "SYSTEM READY -- CIRCULAR DOUBLY LINKED LIST INITIALIZED";
-        music.setVolume(70); // default volume
+        audio->setVolume(70); // default volume
+        audio->setTap(&spectrum.tap);
     }
 
     void addMusic(const string& song){
-        node* newNode = new node(song);
+        NodeChain chain;
+        chain.push(pool.alloc(song));
+        spliceAt(size, chain);
+        remember("ADD \"" + song + "\"", {history.splice(size-1, 0, {chain.first->id})});
+        prints.request({songPath(chain.first)});    // flagged later if it is already listed under another name
+        logMsg = "ADDED: \"" + song + "\" -- NODE INSERTED AT TAIL";
+    }
+
+    // Bulk load from the library index — one log line for the whole batch
+    void addTracks(const vector<TrackInfo>& tracks){
+        NodeChain chain;
+        for(const TrackInfo& t : tracks){
+            node* n = pool.alloc(t.name);
+            n->path = t.path;
+            n->duration = t.wav.duration();
+            chain.push(n);
+        }
+        appendRecorded(chain, "LIBRARY " + to_string(tracks.size()) + " SONGS");
+        vector<string> paths;
+        paths.reserve(tracks.size());
+        for(const TrackInfo& t : tracks) paths.push_back(t.path);
+        loudness.request(paths);    // measured in the background, once per file
+        prints.request(paths);
+        if(!tracks.empty()) logMsg = "LIBRARY: " + to_string(tracks.size()) + " SONGS LOADED";
+    }
+
+    // M3U/M3U8/PLS import: entries stream straight into a detached chain
+    bool importPlaylist(const string& file){
+        NodeChain chain;
+        bool ok = readPlaylist(file, [&](const string& path, const string& title, float seconds){
+            node* n = pool.alloc(title.empty() ? fileStem(path) : title);
+            n->path = path;
+            n->duration = seconds;
+            chain.push(n);
+        });
+        if(!ok){ logMsg = "ERROR: Could not read playlist \"" + fileStem(file) + "\""; return false; }
+        vector<string> paths;
+        node* n = chain.first;
+        for(int i = 0; i < chain.count; i++, n = n->next) paths.push_back(songPath(n));
+        appendRecorded(chain, "IMPORT \"" + fileStem(file) + "\"");
+        prints.request(paths);
+        logMsg = "IMPORTED " + to_string(chain.count) + " SONGS FROM \"" + fileStem(file) + "\"";
+        return true;
+    }
+
+    // Writes the ring head to tail without building an intermediate list
+    bool exportPlaylist(const string& file){
+        PlaylistWriter w;
+        if(!w.open(file)){ logMsg = "ERROR: Could not write \"" + file + "\""; return false; }
+        if(head){
+            node* temp = head;
+            do{
+                w.add(songPath(temp), temp->song, temp->duration);
+                temp = temp->next;
+            } while(temp != head);
+        }
+        bool ok = w.close();
+        logMsg = ok ? "EXPORTED " + to_string(w.count) + " SONGS TO \"" + file + "\"" : "ERROR: Could not write \"" + file + "\"";
+        return ok;
+    }
+
+    // Links a detached chain in before 0-based position pos (size appends)
+    // in O(1), then indexes it. reindex = false leaves search and shuffle to
+    // the caller, for songs that only moved.
+    void spliceAt(int pos, NodeChain& chain, bool reindex = true){
+        if(!chain.count) return;
+        PROFILE_SCOPE("player.splice");
         if(head == nullptr){
-            head = newNode;
-            head->next = head;
-            head->prev = head;
+            head = chain.first;
+            chain.last->next = head;
+            head->prev = chain.last;
             current = head;
         } else {
-            node* tail = head->prev;
-            tail->next = newNode;
-            newNode->prev = tail;
-            newNode->next = head;
-            head->prev = newNode;
+            node* after = pos < size ? index.at(pos) : head;
+            node* before = after->prev;
+            before->next = chain.first;
+            chain.first->prev = before;
+            chain.last->next = after;
+            after->prev = chain.last;
+            if(pos == 0) head = chain.first;
         }
-        size++;
-        logMsg = "ADDED: \"" + song + "\" -- NODE INSERTED AT TAIL";
+        index.insertChain(pos, chain.first, chain.count);
+        node* n = chain.first;
+        for(int i = 0; reindex && i < chain.count; i++, n = n->next){
+            indexSong(n);
+            shuffle.add(n->id);
+        }
+        size += chain.count;
+        generation++;
+        if(journaling) logInsert(pos, chain);
     }
 
-    void deleteMusic(int i){
-        if(!head){ logMsg = "PLAYLIST IS EMPTY"; return; }
-        if(i<1 || i>size){ logMsg = "INVALID SONG NUMBER"; return; }
-        node* temp = head;
-        for(int j=1; j<i; j++) temp = temp->next;
-        string name = temp->song;
-        if(size == 1){
-            delete temp;
+    // Takes count songs from 0-based position pos out of the ring. Their
+    // pool slots stay taken while the edit history can bring them back.
+    void unlinkRange(int pos, int count, bool reindex = true){
+        if(count <= 0) return;
+        PROFILE_SCOPE("player.unlink");
+        node* first = index.at(pos);
+        node* last = first;
+        bool hadHead = false, hadCurrent = false;
+        for(int i = 0; i < count; i++){
+            if(i) last = last->next;
+            hadHead |= last == head;
+            hadCurrent |= last == current;
+            if(!reindex) continue;
+            unindexSong(last);
+            shuffle.remove(last->id);
+        }
+        index.eraseRange(pos, count);
+        if(count == size){
             head = nullptr;
             current = nullptr;
-            size = 0;
-            logMsg = "DELETED: \"" + name + "\"";
-            return;
+        } else {
+            node* after = last->next;
+            first->prev->next = after;
+            after->prev = first->prev;
+            if(hadHead) head = after;
+            if(hadCurrent) current = after;
+        }
+        last->next = nullptr;
+        for(node* n = first; n; ){
+            node* nx = n->next;
+            n->next = n->prev = nullptr;
+            n = nx;
+        }
+        size -= count;
+        generation++;
+        if(journaling){
+            RecordWriter r;
+            r.u32(pos);
+            r.u32(count);
+            journal.append(JournalOp::REMOVE, r);
         }
-        if(temp == current) current = temp->next;
-        if(temp == head) head = temp->next;
-        temp->prev->next = temp->next;
-        temp->next->prev = temp->prev;
-        delete temp;
-        size--;
+    }
+
+    void deleteMusic(int i){
+        if(!head){ logMsg = "PLAYLIST IS EMPTY"; return; }
+        if(i<1 || i>size){ logMsg = "INVALID SONG NUMBER"; return; }
+        string name = index.at(i-1)->song;
+        unlinkRange(i-1, 1);
+        remember("DELETE \"" + name + "\"", {history.splice(i-1, 1, {})});
         logMsg = "DELETED: \"" + name + "\"";
     }
 
-    // Load and play current song via SFML
+    // Moves the song at position from to position to (both 1-based)
+    void moveMusic(int from, int to){
+        if(from<1 || from>size || to<1 || to>size){ logMsg = "INVALID SONG NUMBER"; return; }
+        if(from == to) return;
+        node* n = index.at(from-1);
+        node* keep = current;
+        unlinkRange(from-1, 1, false);
+        NodeChain chain;
+        chain.push(n);
+        spliceAt(to-1, chain, false);
+        current = keep;
+        Splice out = history.splice(from-1, 1, {});
+        remember("MOVE \"" + n->song + "\"", {move(out), history.splice(to-1, 0, {n->id})});
+        logMsg = "MOVED: \"" + n->song + "\" TO #" + to_string(to);
+    }
+
+    void undo(){
+        if(!history.canUndo()){ logMsg = "NOTHING TO UNDO"; return; }
+        node* keep = current;
+        const EditStep& step = history.undo();
+        replay(step, false);
+        settle(keep);
+        logMsg = "UNDO: " + step.what;
+    }
+
+    void redo(){
+        if(!history.canRedo()){ logMsg = "NOTHING TO REDO"; return; }
+        node* keep = current;
+        const EditStep& step = history.redo();
+        replay(step, true);
+        settle(keep);
+        logMsg = "REDO: " + step.what;
+    }
+
+    // Turns the ring into the version on the other side of step, splice by
+    // splice; search and shuffle then only hear about songs that really left
+    // or came back, not ones a move took out and put in again
+    void replay(const EditStep& step, bool forward){
+        PROFILE_SCOPE("player.replay");
+        vector<uint32_t> out, in;
+        auto apply = [&](const Splice& s){
+            const PersistentSeq& from = forward ? s.before : s.after;
+            const PersistentSeq& to = forward ? s.after : s.before;
+            int take = forward ? s.removed : s.added;
+            int put = forward ? s.added : s.removed;
+            from.read(s.pos, take, out);
+            unlinkRange(s.pos, take, false);
+            size_t first = in.size();
+            to.read(s.pos, put, in);
+            NodeChain chain;
+            for(size_t i = first; i < in.size(); i++) chain.push(pool.get(in[i]));
+            spliceAt(s.pos, chain, false);
+        };
+        if(forward) for(const Splice& s : step.splices) apply(s);
+        else for(auto s = step.splices.rbegin(); s != step.splices.rend(); ++s) apply(*s);
+        sort(out.begin(), out.end());
+        sort(in.begin(), in.end());
+        vector<uint32_t> gone, back;
+        set_difference(out.begin(), out.end(), in.begin(), in.end(), back_inserter(gone));
+        set_difference(in.begin(), in.end(), out.begin(), out.end(), back_inserter(back));
+        for(uint32_t h : gone){
+            unindexSong(pool.get(h));
+            shuffle.remove(h);
+        }
+        for(uint32_t h : back){
+            indexSong(pool.get(h));
+            shuffle.add(h);
+        }
+    }
+
+    // After undo/redo: the song that was current stays so if it is still
+    // listed; if it went, playback of it stops
+    void settle(node* keep){
+        if(keep && keep->next){ current = keep; return; }
+        if(isPlaying) stopMusic();
+    }
+
+    // Appends chain as one undoable step
+    void appendRecorded(NodeChain& chain, const string& what){
+        if(!chain.count) return;
+        int pos = size;
+        spliceAt(pos, chain);
+        vector<uint32_t> handles;
+        handles.reserve(chain.count);
+        node* n = chain.first;
+        for(int i = 0; i < chain.count; i++, n = n->next) handles.push_back(n->id);
+        remember(what, {history.splice(pos, 0, handles)});
+    }
+
+    // Pushes an edit whose splices are already applied to the ring and to
+    // history.order, then frees songs no version can reach any more
+    void remember(const string& what, vector<Splice> splices){
+        vector<uint32_t> gone;
+        history.record({what, move(splices)}, gone);
+        sort(gone.begin(), gone.end());
+        gone.erase(unique(gone.begin(), gone.end()), gone.end());
+        for(uint32_t h : gone){
+            node* n = pool.get(h);
+            if(n && !n->next) freeSong(n);
+        }
+    }
+
+    void freeSong(node* n){
+        sortKeys.forget(n->id);
+        pool.release(n);
+    }
+
+    // Reorders the whole playlist by spec (see parseSortSpec) as one
+    // undoable step. The ring is merge sorted in place on all cores and
+    // current stays the song it was; the journal gets the permutation only.
+    void sortBy(const string& spec){
+        vector<SortField> fields;
+        if(!parseSortSpec(spec, fields)){ logMsg = "SORT: UNKNOWN KEY \"" + spec + "\""; return; }
+        string by;
+        for(const SortField& f : fields) by += (by.empty() ? "" : ", ") + string(sortKeyName(f.key)) + (f.descending ? " DESC" : "");
+        if(size < 2){ logMsg = "NOTHING TO SORT"; return; }
+        PROFILE_SCOPE("player.sort");
+        auto start = chrono::steady_clock::now();
+        vector<node*> songs;
+        songs.reserve(size);
+        for(node* n : visible(0, size)) songs.push_back(n);
+        SongOrder order = sortOrder(fields, songs);
+
+        vector<uint32_t> oldPos;    // by handle, for the journal
+        if(journaling){
+            oldPos.resize(sortKeys.size());
+            for(size_t i = 0; i < songs.size(); i++) oldPos[songs[i]->id] = (uint32_t)i;
+        }
+        vector<node*> was = songs;
+        SortRun<node> sorted = parallelSortList(songs, order);
+        sorted.first->prev = sorted.last;
+        sorted.last->next = sorted.first;
+        head = sorted.first;
+        bool moved = songs != was;
+        index.rebuild(songs);
+        generation++;
+        vector<uint32_t> now;
+        now.reserve(size);
+        for(node* s : songs) now.push_back(s->id);
+        float took = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+        char secs[32];
+        snprintf(secs, sizeof secs, "%.2fs", took);
+        if(!moved){ logMsg = "ALREADY SORTED BY " + by; return; }
+        if(journaling){
+            RecordWriter r;
+            r.u32(size);
+            for(uint32_t h : now) r.u32(oldPos[h]);
+            journal.append(JournalOp::ORDER, r);
+        }
+        remember("SORT BY " + by, {history.splice(0, size, now)});
+        logMsg = "SORTED " + to_string(size) + " SONGS BY " + by + " IN " + secs;
+        for(const SortField& f : fields){
+            if(f.key != SortKey::Loudness) continue;
+            int unmeasured = 0;
+            for(uint32_t h : now) unmeasured += !(sortKeys[h].have & SortKeyCache::LOUDNESS);
+            if(unmeasured) logMsg += " -- " + to_string(unmeasured) + " NOT MEASURED YET, LAST";
+            break;
+        }
+    }
+
+    // Comparator for fields over songs, with whatever keys they were missing
+    // fetched first (file dates on all cores) and sortKey set
+    SongOrder sortOrder(const vector<SortField>& fields, const vector<node*>& songs){
+        vector<uint32_t> handles;
+        handles.reserve(songs.size());
+        for(node* n : songs) handles.push_back(n->id);
+        uint8_t want = 0;
+        for(const SortField& f : fields){
+            if(f.key == SortKey::Name) want |= SortKeyCache::NAME;
+            if(f.key == SortKey::FileDate) want |= SortKeyCache::DATE;
+            if(f.key == SortKey::Loudness) want |= SortKeyCache::LOUDNESS;
+        }
+        sortKeys.fill(handles, want,
+            [&](uint32_t h) -> const string& { return pool.get(h)->song; },
+            [&](uint32_t h){
+                error_code ec;
+                auto t = fs::last_write_time(songPath(pool.get(h)), ec);
+                return ec ? SORT_UNKNOWN : dateSortKey((int64_t)t.time_since_epoch().count());
+            },
+            [&](uint32_t h, uint64_t& key){
+                TrackLoudness l;
+                if(!loudness.lookup(songPath(pool.get(h)), l)) return false;   // queued for measuring
+                key = floatSortKey(l.lufs);
+                return true;
+            });
+        SongOrder order;
+        order.fields = fields;
+        order.keys = &sortKeys;
+        const SortField& f = fields[0];
+        for(node* n : songs){
+            uint64_t k = order.key(f.key, *n);
+            n->sortKey = f.descending && k != SORT_UNKNOWN ? ~k : k;
+        }
+        return order;
+    }
+
+    string songPath(const node* n) const{
+        return n->path.empty() ? MUSIC_ROOT + n->song + ".wav" : n->path;
+    }
+
+    // Load and play current song, reusing the prefetched track when it matches
     bool loadAndPlay(){
         if(!current) return false;
-        string path = "C:\\Users\\DELL\\OneDrive\\Desktop\\DSA_FINAL_PROJECT\\Music\\" + current->song + ".wav";
-        if(!music.openFromFile(path)){
+        PROFILE_SCOPE("player.loadAndPlay");
+        if(!audio->open(songPath(current), current->id)){
             logMsg = "ERROR: Could not open \"" + current->song + "\"";
             return false;
         }
-        music.play();
+        applyGain();
+        if(current == resumeNode && resumeOffset > 0) audio->seek(resumeOffset);
+        resumeNode = nullptr;
+        audio->play();
+        beginTransition();
         logMsg = "PLAYING: \"" + current->song + "\"";
         return true;
     }
 
+    // Gain for the current track; unmeasured tracks play as they are
+    void applyGain(){
+        TrackLoudness l;
+        bool known = normalizeLoudness && current && loudness.lookup(songPath(current), l);
+        audio->setGain(known ? l.gain() : 1.0f);
+    }
+
+    // Keeps the upcoming track ready on the backend for a gapless change
+    void schedulePrefetch(){
+        if(!current || !audio->isOpen()) return;
+        node* nx = upcoming(false);
+        if(audio->queuedTag() == nx->id) return;
+        audio->prefetch(songPath(nx), nx->id);
+        waves.get(songPath(nx));
+        TrackLoudness l;
+        loudness.lookup(songPath(nx), l);   // queues it so the gain is ready in time
+    }
+
     void play(){
         if(!head){ logMsg = "PLAYLIST IS EMPTY"; return; }
         if(!current) current = head;
@@ -107,7 +800,7 @@ public:
         if(!isPlaying){ logMsg = "NOTHING IS PLAYING"; return; }
         if(isPaused){ logMsg = "ALREADY PAUSED"; return; }
         isPaused = true;
-        music.pause();
+        audio->pause();
         logMsg = "PAUSED: \"" + (current ? current->song : "") + "\"";
     }
 
@@ -115,82 +808,148 @@ public:
         if(!isPlaying){ logMsg = "NOTHING IS PLAYING"; return; }
         if(!isPaused){ logMsg = "NOT PAUSED"; return; }
         isPaused = false;
-        music.play();
+        audio->play();
         logMsg = "RESUMED: \"" + (current ? current->song : "") + "\"";
     }
 
     void stopMusic(){
         isPlaying = false;
         isPaused = false;
-        music.stop();
+        audio->stop();
         logMsg = "MUSIC STOPPED";
     }
 
     void next(){
         if(!current) return;
-        bool wasPlaying = isPlaying;
-        music.stop();
-        current = current->next;
-        isPlaying = false;
-        isPaused = false;
-        logMsg = "NEXT -> \"" + current->song + "\"";
-        if(wasPlaying) play();
+        changeTo(upcoming(true), "NEXT");
     }
 
     void prev(){
         if(!current) return;
-        bool wasPlaying = isPlaying;
-        music.stop();
-        current = current->prev;
-        isPlaying = false;
-        isPaused = false;
-        logMsg = "PREV -> \"" + current->song + "\"";
-        if(wasPlaying) play();
+        node* back = shuffleOn ? track(shuffle.prev()) : nullptr;
+        changeTo(back ? back : current->prev, "PREV");
     }
 
     void randomSong(){
         if(!head) return;
+        node* pick = track(shuffle.next()); // no-repeat shuffle pick, O(1)
+        changeTo(pick ? pick : current, "RANDOM PICK");
+    }
+
+    // Makes n current. While playing it fades in over the old track when the
+    // output can mix; otherwise playback stops and restarts on n if it was on.
+    void changeTo(node* n, const string& what){
+        if(!n) return;
+        if(isPlaying && !isPaused && audio->crossfadeTo(songPath(n), n->id)){
+            current = n;
+            applyGain();
+            beginTransition();
+            logMsg = what + " -> \"" + current->song + "\" (CROSSFADE)";
+            return;
+        }
         bool wasPlaying = isPlaying;
-        music.stop();
-        int idx = rand() % size;
-        current = head;
-        for(int i=0; i<idx; i++) current = current->next;
+        audio->stop();
+        current = n;
         isPlaying = false;
         isPaused = false;
-        logMsg = "RANDOM PICK -> \"" + current->song + "\"";
+        logMsg = what + " -> \"" + current->song + "\"";
         if(wasPlaying) play();
     }
 
+    // Fade length in seconds, 0 for plain gapless changes
+    void setCrossfade(float seconds, FadeShape shape){
+        crossfadeSec = max(0.0f, min(MAX_CROSSFADE, seconds));
+        fadeShape = shape;
+        audio->setCrossfade(crossfadeSec, shape);
+        logMsg = crossfadeSec > 0 ? "CROSSFADE " + to_string((int)crossfadeSec) + "s " + fadeShapeName(shape)
+                                  : "CROSSFADE OFF";
+    }
+
+    // Song that plays after current; advance = true also moves the shuffle cursor
+    node* upcoming(bool advance){
+        if(!shuffleOn) return current->next;
+        node* n = track(advance ? shuffle.next() : shuffle.peek());
+        return n ? n : current->next;
+    }
+
+    void toggleShuffle(){
+        shuffleOn = !shuffleOn;
+        if(shuffleOn && current) shuffle.startAt(current->id);
+        audio->dropQueued(); // the prefetched track followed the other order
+        logMsg = shuffleOn ? "SHUFFLE ON -- FISHER-YATES ORDER" : "SHUFFLE OFF -- LIST ORDER";
+    }
+
     void setByIndex(int index){
         if(index<1 || index>size) return;
-        current = head;
-        for(int i=1; i<index; i++) current = current->next;
+        current = this->index.at(index-1);
         logMsg = "SELECTED: \"" + current->song + "\"";
     }
 
-    
+    // 1-based position of the current song, 0 when empty
+    int currentIndex() const{
+        return current ? index.indexOf(current) + 1 : 0;
+    }
+
+    node* songAt(int i) const{
+        if(i<1 || i>size) return nullptr;
+        return index.at(i-1);
+    }
+
+    // 1-based position of n in the playlist
+    int positionOf(node* n) const{
+        return n ? index.indexOf(n) + 1 : 0;
+    }
+
+    // Ranked fuzzy matches for a partially typed name
+    vector<node*> find(const string& query, int limit){
+        PROFILE_SCOPE("player.find");
+        vector<node*> out;
+        auto matches = search.query(query, limit, [this](uint32_t h) -> const string*{
+            node* n = track(h);
+            return n ? &n->song : nullptr;
+        });
+        for(auto& m : matches) out.push_back(pool.get(m.handle));
+        return out;
+    }
+
+    // Up to count songs starting at 0-based offset, read straight from the list
+    PlaylistRange visible(int offset, int count) const{
+        if(offset < 0) offset = 0;
+        if(offset >= size || count <= 0) return {nullptr, 0};
+        return {index.at(offset), min(count, size - offset)};
+    }
+
     void seek(float delta){
-        if(!isPlaying || music.getDuration().asSeconds() == 0) return;
-        float total = music.getDuration().asSeconds();
-        float cur = music.getPlayingOffset().asSeconds();
+        if(!isPlaying || audio->duration() == 0) return;
+        float total = audio->duration();
+        float cur = audio->offset();
         float newPos = cur + delta * total * 0.1f; 
-        music.setPlayingOffset(sf::seconds(newPos));
+        audio->seek(newPos);
         logMsg = "SEEKED TO " + to_string((int)newPos) + "s";
     }
 
+    // Jump to an absolute position in the current song
+    void seekTo(float seconds){
+        if(!isPlaying) return;
+        audio->seek(max(0.0f, min(getDuration(), seconds)));
+    }
+
+    float getDuration(){ return audio->duration(); }
+    float getOffset(){ return audio->offset(); }
+
     // Returns 0.0 to 1.0 real progress
     float getProgress(){
-        if(!isPlaying || music.getDuration().asSeconds() == 0) return 0.0f;
-        return music.getPlayingOffset().asSeconds() / music.getDuration().asSeconds();
+        if(!isPlaying || audio->duration() == 0) return 0.0f;
+        return audio->offset() / audio->duration();
     }
 
     string getTimeElapsed(){
-        int s = (int)music.getPlayingOffset().asSeconds();
+        int s = (int)audio->offset();
         return to_string(s/60) + ":" + (s%60<10?"0":"") + to_string(s%60);
     }
 
     string getTimeDuration(){
-        int s = (int)music.getDuration().asSeconds();
+        int s = (int)audio->duration();
         if(s == 0) return "0:00";
         return to_string(s/60) + ":" + (s%60<10?"0":"") + to_string(s%60);
     }
@@ -198,42 +957,367 @@ public:
     // Volume 0-100
     void setVolume(float v){
         v = max(0.0f, min(100.0f, v));
-        music.setVolume(v);
+        audio->setVolume(v);
     }
 
     float getVolume(){
-        return music.getVolume();
+        return audio->volume();
     }
 
     // Call every frame — auto advance when song ends
     void update(){
+        PROFILE_SCOPE("player.update");
+        audio->tick();
+        auto now = chrono::steady_clock::now();
         if(isPlaying && !isPaused){
-            if(music.getStatus() == sf::SoundSource::Status::Stopped){
-                current = current->next;
+            if(audio->pollTransition()){
+                // spliced inside the audio callback: nothing to reopen, no silence
+                current = upcoming(true);
+                applyGain();
+                lastGapSamples = 0;
+                beginTransition();
+                logMsg = "PLAYING: \"" + current->song + "\" (GAPLESS)";
+            } else if(audio->status() == PlaybackStatus::Stopped){
+                // stream ran dry (no prefetch or format change): silence lasts at
+                // most from the previous frame until the reopened track starts
+                current = upcoming(true);
                 loadAndPlay();
+                float gap = chrono::duration<float>(chrono::steady_clock::now() - lastUpdate).count();
+                lastGapSamples = (unsigned long long)(gap * audio->sampleRate());
             }
+            schedulePrefetch();
+        }
+        string report;
+        if(loudness.takeReport(report)) logMsg = report;
+        vector<FingerprintDuplicate> dups;
+        if(prints.takeDuplicates(dups)) reportDuplicates(dups);
+        DedupeResult deduped;
+        if(prints.takeDedupe(deduped)) finishDedupe(deduped);
+        if(journaling){
+            logState();
+            if(journal.bytesSinceSnapshot() > max(COMPACT_BYTES, snapshotBytes / 2)) compact();
+            if(journal.takeError(report)) logMsg = report;
+        }
+        indexPending();
+        lastUpdate = now;
+    }
+
+    // Fingerprints every song on all cores; later copies of a song are
+    // removed as one undoable step once the result is back
+    void dedupe(){
+        if(dedupeRunning){ logMsg = "DEDUPE ALREADY RUNNING"; return; }
+        if(!head){ logMsg = "PLAYLIST IS EMPTY"; return; }
+        vector<string> paths;
+        paths.reserve(size);
+        for(node* n : visible(0, size)) paths.push_back(songPath(n));
+        prints.dedupe(move(paths), generation);
+        dedupeRunning = true;
+        logMsg = "DEDUPE: FINGERPRINTING " + to_string(size) + " SONGS ON " + to_string(workerCount()) + (workerCount() == 1 ? " CORE" : " CORES");
+    }
+
+    // Frames from here on are timed as this track change's
+    void beginTransition(){
+        worstTransitionMs = 0;
+        framesSinceTransition = 0;
+    }
+
+    // Feed the frame time so transition hitches can be measured
+    void noteFrame(float dt){
+        if(framesSinceTransition < 3) worstTransitionMs = max(worstTransitionMs, dt * 1000.0f);
+        framesSinceTransition++;
+    }
+
+    // Logs the newly added songs that sound like another song still listed
+    void reportDuplicates(const vector<FingerprintDuplicate>& dups){
+        unordered_map<string, const string*> listed;    // path -> song name
+        for(node* n : visible(0, size)) listed.emplace(songPath(n), &n->song);
+        const FingerprintDuplicate* first = nullptr;
+        unordered_set<string> flagged;      // a song matching several counts once
+        for(const FingerprintDuplicate& d : dups){
+            if(!listed.count(d.path) || !listed.count(d.of) || !flagged.insert(d.path).second) continue;
+            if(!first) first = &d;
         }
+        int count = (int)flagged.size();
+        if(!first) return;
+        logMsg = "DUPLICATE: \"" + *listed[first->path] + "\" = \"" + *listed[first->of] + "\" (" +
+                 to_string((int)(first->similarity * 100)) + "%)";
+        if(count > 1) logMsg += " +" + to_string(count - 1) + " MORE";
     }
 
-    vector<pair<string,bool>> getSongs(){
-        vector<pair<string,bool>> songs;
-        if(!head) return songs;
-        node* temp = head;
-        do{
-            songs.push_back({temp->song, temp==current});
-            temp = temp->next;
-        } while(temp != head);
-        return songs;
+    void finishDedupe(const DedupeResult& r){
+        dedupeRunning = false;
+        if(r.tag != generation || (int)r.dupOf.size() != size){
+            logMsg = "DEDUPE: PLAYLIST CHANGED MEANWHILE -- RUN IT AGAIN";
+            return;
+        }
+        // runs of adjacent copies, one unlink and one splice each; back to
+        // front, so the positions still ahead stay valid
+        int playing = current ? index.indexOf(current) : -1;
+        vector<Splice> splices;
+        int removed = 0;
+        for(int end = size; end > 0; ){
+            if(r.dupOf[end-1] < 0 || end-1 == playing){ end--; continue; }
+            int start = end - 1;
+            while(start > 0 && r.dupOf[start-1] >= 0 && start-1 != playing) start--;
+            unlinkRange(start, end - start);
+            splices.push_back(history.splice(start, end - start, {}));
+            removed += end - start;
+            end = start;
+        }
+        if(removed) remember("DEDUPE " + to_string(removed) + " SONGS", move(splices));
+        char took[32];
+        snprintf(took, sizeof took, "%.1fs", r.seconds);
+        logMsg = "DEDUPE: REMOVED " + to_string(removed) + " DUPLICATES (" + to_string(r.fingerprinted) +
+                 " FINGERPRINTED IN " + took + ")";
+    }
+
+    // Waveform overview of n, nullptr until it has been generated
+    shared_ptr<const WavePeaks> peaksFor(const node* n){
+        return n ? waves.get(songPath(n)) : nullptr;
+    }
+
+    // Song for a pool handle, nullptr if it was deleted
+    node* track(uint32_t h) const{
+        node* n = pool.get(h);
+        return (n && n->next) ? n : nullptr;
+    }
+
+    // Rebuilds playlist, current song, position in it and volume from the
+    // snapshot and journal in dir, then keeps journaling there. A torn
+    // record at the end of the journal (a crash mid-write) is cut off.
+    // Returns whether there was anything to restore.
+    bool openSession(const string& dir){
+        PROFILE_SCOPE("player.openSession");
+        bool found = false;
+        uint64_t seq = 0;
+        float offset = 0, vol = -1;
+        SnapshotView snap;
+        if(snap.open((fs::path(dir) / "playlist.snap").string())){
+            found = true;
+            seq = snap.header.seq;
+            NodeChain chain;
+            SnapshotView::Entry e;
+            for(uint32_t i = 0; i < snap.header.count && snap.at(i, e); i++){
+                node* n = pool.alloc(string(e.song, e.songLen));
+                n->path.assign(e.path, e.pathLen);
+                n->duration = e.duration;
+                chain.push(n);
+            }
+            spliceAt(0, chain, false);
+            current = songAt(snap.header.current + 1);
+            offset = snap.header.offset;
+            vol = snap.header.volume;
+            snapshotBytes = sizeof(SnapshotHeader) + chain.count * sizeof(SnapshotRecord) + snap.header.textBytes;
+        }
+        uint64_t last = seq;
+        uint64_t keep = readJournal((fs::path(dir) / "journal.log").string(), last,
+            [&](JournalOp op, uint64_t s, RecordReader& r){
+                if(s <= seq) return true;   // already in the snapshot
+                found = true;
+                return replayRecord(op, r, offset, vol);
+            });
+
+        // shuffle and history start from the restored order; search fills
+        // in over the next updates so a big playlist is usable at once
+        vector<uint32_t> handles;
+        handles.reserve(size);
+        searchPending.clear();
+        searchCursor = 0;
+        if(head){
+            node* n = head;
+            do{
+                handles.push_back(n->id);
+                shuffle.add(n->id);
+                if(n->id >= searchPending.size()) searchPending.resize(n->id + 1);
+                searchPending[n->id] = true;
+                n = n->next;
+            } while(n != head);
+        }
+        history.reset(handles);
+        if(vol >= 0) setVolume(vol);
+        resumeNode = current;
+        resumeOffset = offset;
+
+        journaling = journal.open(dir, keep, max(last, seq));
+        loggedCurrent = current;
+        loggedPos = currentIndex();
+        loggedOffset = offset;
+        loggedVolume = getVolume();
+        loggedPlaying = false;
+        if(found) logMsg = "SESSION RESTORED: " + to_string(size) + " SONGS";
+        return found;
+    }
+
+    // Applies one journal record to the playlist being restored; false
+    // when it does not fit, which ends the replay there
+    bool replayRecord(JournalOp op, RecordReader& r, float& offset, float& vol){
+        switch(op){
+            case JournalOp::INSERT:{
+                uint32_t pos = r.u32(), count = r.u32();
+                if(!r.ok || pos > (uint32_t)size) return false;
+                NodeChain chain;
+                for(uint32_t i = 0; i < count && r.ok; i++){
+                    node* n = pool.alloc("");
+                    n->duration = r.f32();
+                    r.str(n->song);
+                    r.str(n->path);
+                    chain.push(n);
+                }
+                if(!r.ok){
+                    for(node* n = chain.first; n; ){ node* nx = n->next; freeSong(n); n = nx; }
+                    return false;
+                }
+                spliceAt(pos, chain, false);
+                return true;
+            }
+            case JournalOp::REMOVE:{
+                uint32_t pos = r.u32(), count = r.u32();
+                if(!r.ok || (uint64_t)pos + count > (uint64_t)size) return false;
+                if(!count) return true;
+                vector<node*> gone;
+                gone.reserve(count);
+                for(node* n = index.at(pos); gone.size() < count; n = n->next) gone.push_back(n);
+                unlinkRange(pos, count, false);
+                for(node* n : gone) freeSong(n);
+                return true;
+            }
+            case JournalOp::ORDER:{
+                uint32_t count = r.u32();
+                if(!r.ok || count != (uint32_t)size) return false;
+                if(!count) return true;
+                vector<node*> was;
+                was.reserve(count);
+                for(node* n : visible(0, size)) was.push_back(n);
+                vector<node*> now(count);
+                for(uint32_t i = 0; i < count; i++){
+                    uint32_t from = r.u32();
+                    if(!r.ok || from >= count || !was[from]) return false;
+                    now[i] = was[from];
+                    was[from] = nullptr;
+                }
+                for(uint32_t i = 0; i < count; i++){
+                    now[i]->next = now[(i + 1) % count];
+                    now[i]->prev = now[(i + count - 1) % count];
+                }
+                head = now[0];
+                index.rebuild(now);
+                generation++;
+                return true;
+            }
+            case JournalOp::CURRENT:{
+                uint32_t pos = r.u32();
+                if(!r.ok || pos > (uint32_t)size) return false;
+                current = songAt(pos);
+                return true;
+            }
+            case JournalOp::PLAYBACK:
+                offset = r.f32();
+                vol = r.f32();
+                return r.ok;
+        }
+        return false;
+    }
+
+    void logInsert(int pos, const NodeChain& chain){
+        RecordWriter r;
+        r.u32(pos);
+        r.u32(chain.count);
+        node* n = chain.first;
+        for(int i = 0; i < chain.count; i++, n = n->next){
+            r.f32(n->duration);
+            r.str(n->song);
+            r.str(n->path);
+        }
+        journal.append(JournalOp::INSERT, r);
+    }
+
+    // Journals the current song when it or its position changed, and where
+    // playback stands every PLAYBACK_STEP seconds or on pause, stop and volume
+    void logState(){
+        int pos = currentIndex();
+        bool moved = current != loggedCurrent || pos != loggedPos;
+        if(moved){
+            RecordWriter r;
+            r.u32(pos);
+            journal.append(JournalOp::CURRENT, r);
+            if(current != loggedCurrent) resumeNode = nullptr;
+            loggedCurrent = current;
+            loggedPos = pos;
+        }
+        bool playing = isPlaying && !isPaused;
+        float off = isPlaying ? getOffset() : current && current == resumeNode ? resumeOffset : 0;
+        float vol = getVolume();
+        if(moved || playing != loggedPlaying || vol != loggedVolume || fabs(off - loggedOffset) >= PLAYBACK_STEP){
+            RecordWriter r;
+            r.f32(off);
+            r.f32(vol);
+            journal.append(JournalOp::PLAYBACK, r);
+            loggedOffset = off;
+            loggedVolume = vol;
+            loggedPlaying = playing;
+        }
+    }
+
+    // Replaces the journal with a snapshot of the whole playlist. Only the
+    // image is built here; the journal thread writes it.
+    void compact(){
+        PROFILE_SCOPE("player.compact");
+        SessionImage img;
+        img.records.reserve(size);
+        size_t text = 0;
+        for(node* n : visible(0, size)) text += n->song.size() + n->path.size();
+        img.text.reserve(text);
+        for(node* n : visible(0, size)) img.add(n->song, n->path, n->duration);
+        img.header.current = loggedPos - 1;
+        img.header.offset = loggedOffset;
+        img.header.volume = loggedVolume;
+        snapshotBytes = img.bytes();
+        journal.snapshot(move(img));
+    }
+
+    // Search index upkeep that knows about songs still waiting from a restore
+    void indexSong(node* n){
+        if(n->id < searchPending.size()) searchPending[n->id] = false;
+        search.add(n->id, n->song);
+    }
+
+    void unindexSong(node* n){
+        if(n->id < searchPending.size() && searchPending[n->id]) searchPending[n->id] = false;
+        else search.remove(n->id, n->song);
+    }
+
+    // Indexes the next SEARCH_BATCH handles left over from openSession
+    void indexPending(){
+        if(searchPending.empty()) return;
+        PROFILE_SCOPE("player.indexPending");
+        size_t end = min(searchPending.size(), searchCursor + SEARCH_BATCH);
+        for(; searchCursor < end; searchCursor++){
+            if(!searchPending[searchCursor]) continue;
+            searchPending[searchCursor] = false;
+            node* n = pool.get((uint32_t)searchCursor);
+            search.add(n->id, n->song);
+        }
+        if(searchCursor == searchPending.size()){
+            searchPending = vector<bool>();
+            searchCursor = 0;
+        }
+    }
+
+    // Writes where playback stands and syncs the journal; call while the
+    // state is still the one to come back to
+    void closeSession(){
+        if(!journaling) return;
+        logState();
+        journal.close();
+        journaling = false;
     }
 
     ~MusicPlayer(){
-        music.stop();
-        if(!head) return;
-        node* temp = head;
-        do{
-            node* next = temp->next;
-            delete temp;
-            temp = next;
-        } while(temp != head);
+        closeSession();
+        audio->stop();
+        index.clear();
+        search.clear();
+        shuffle.clear();
+        pool.clear();
     }
 };
\ No newline at end of file
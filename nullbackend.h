@@ -0,0 +1,173 @@
+#pragma once
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include "audiobackend.h"
+#include "wavheader.h"
+using namespace std;
+
+// Backend whose clock is advanced by the caller instead of a sound device.
+// Position is counted in frames of the current track; running past the end
+// continues into the queued track at the same instant, so transitions are
+// sample exact. Subclasses decide what "playing" a span of frames means.
+class ClockBackend : public AudioBackend{
+public:
+    bool open(const string& path, uint32_t tag) override{
+        stop();
+        Track t;
+        t.path = path;
+        t.tag = tag;
+        if(hasNext && next.tag == tag && next.path == path) t = next;
+        else if(!load(t)) return false;
+        cur = t;
+        hasCur = true;
+        hasNext = false;
+        next = Track();
+        pos = 0;
+        return true;
+    }
+
+    bool isOpen() const override{ return hasCur; }
+    void play() override{ if(hasCur) st = PlaybackStatus::Playing; }
+    void pause() override{ if(st == PlaybackStatus::Playing) st = PlaybackStatus::Paused; }
+    void stop() override{ st = PlaybackStatus::Stopped; pos = 0; }
+    PlaybackStatus status() const override{ return st; }
+
+    void seek(float seconds) override{
+        if(!hasCur) return;
+        pos = min<uint64_t>((uint64_t)(max(0.0f, seconds) * cur.rate), cur.frames);
+        onSeek();
+    }
+    float offset() const override{ return hasCur && cur.rate ? (float)pos / cur.rate : 0.0f; }
+    float duration() const override{ return hasCur && cur.rate ? (float)cur.frames / cur.rate : 0.0f; }
+    unsigned sampleRate() const override{ return hasCur ? cur.rate : 0; }
+
+    void setVolume(float v) override{ vol = max(0.0f, min(100.0f, v)); }
+    float volume() const override{ return vol; }
+    void setGain(float g) override{ gain = max(0.0f, g); }
+
+    void prefetch(const string& path, uint32_t tag) override{
+        if(!hasCur || (hasNext && next.tag == tag && next.path == path)) return;
+        Track t;
+        t.path = path;
+        t.tag = tag;
+        hasNext = load(t);
+        next = hasNext ? t : Track();
+    }
+    uint32_t queuedTag() const override{ return hasNext ? next.tag : NIL; }
+    void dropQueued() override{ hasNext = false; next = Track(); }
+
+    bool pollTransition() override{
+        if(!transitions) return false;
+        transitions--;
+        return true;
+    }
+
+    // Runs the clock forward by seconds of output time
+    void advance(double seconds){
+        seconds += carry;   // rounding left over from the last call, so odd rates don't drift
+        carry = 0;
+        while(seconds > 0){
+            if(st != PlaybackStatus::Playing || !hasCur){
+                produceSilence(seconds);
+                return;
+            }
+            uint64_t left = cur.frames - pos;
+            uint64_t want = (uint64_t)(seconds * cur.rate + 0.5);
+            uint64_t k = min(left, want);
+            if(k) produce(k);
+            pos += k;
+            seconds -= (double)k / cur.rate;
+            if(pos < cur.frames){
+                if(k == want){ carry = seconds; return; }
+                continue;
+            }
+            if(hasNext){
+                cur = next;
+                hasNext = false;
+                next = Track();
+                pos = 0;
+                transitions++;
+                onSwitch();
+            } else {
+                st = PlaybackStatus::Stopped;
+            }
+        }
+    }
+
+protected:
+    struct Track{
+        string path;
+        uint32_t tag = NIL;
+        uint64_t frames = 0;
+        unsigned rate = 0;
+        unsigned channels = 0;
+    };
+
+    Track cur, next;
+    bool hasCur = false, hasNext = false;
+    uint64_t pos = 0;
+    PlaybackStatus st = PlaybackStatus::Stopped;
+    float vol = 100;
+    float gain = 1;
+    unsigned transitions = 0;
+    double carry = 0;
+
+    // Fills frames/rate/channels for t.path
+    virtual bool load(Track& t) = 0;
+    virtual void produce(uint64_t frames){ (void)frames; }
+    virtual void produceSilence(double seconds){ (void)seconds; }
+    virtual void onSwitch(){}
+    virtual void onSeek(){}
+};
+
+// No output at all: durations come from WAV headers (or a fixed stand-in when
+// files are missing) and time passes either with the wall clock or only when
+// advance() is called, for fully deterministic runs.
+class NullBackend : public ClockBackend{
+public:
+    bool realtime;
+    float fakeDuration;   // seconds for unreadable files, 0 = fail like a real backend
+
+    explicit NullBackend(bool realtime = true, float fakeDuration = 0)
+        : realtime(realtime), fakeDuration(fakeDuration){}
+
+    void tick() override{
+        auto now = chrono::steady_clock::now();
+        if(realtime && ticked) advance(chrono::duration<double>(now - last).count());
+        last = now;
+        ticked = true;
+    }
+
+protected:
+    bool load(Track& t) override{
+        FILE* f = fopen(t.path.c_str(), "rb");
+        WavInfo w;
+        bool ok = false;
+        if(f){
+            fseek(f, 0, SEEK_END);
+            uint64_t size = (uint64_t)ftell(f);
+            ok = parseWavHeader([f](uint64_t off, void* dst, size_t n) -> size_t{
+                if(fseek(f, (long)off, SEEK_SET) != 0) return 0;
+                return fread(dst, 1, n, f);
+            }, size, w);
+            fclose(f);
+        }
+        if(ok){
+            t.rate = w.sampleRate;
+            t.channels = w.channels;
+            t.frames = w.frames();
+            return t.rate > 0;
+        }
+        if(fakeDuration <= 0) return false;
+        t.rate = 44100;
+        t.channels = 2;
+        t.frames = (uint64_t)(fakeDuration * t.rate);
+        return true;
+    }
+
+private:
+    chrono::steady_clock::time_point last;
+    bool ticked = false;
+};
@@ -0,0 +1,234 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+using namespace std;
+
+// Node storage shared by every version of a PersistentSeq. Nodes are
+// reference counted by their parents and by the versions holding them as
+// root; slabs never move, and freed slots are reused.
+class SeqStore{
+public:
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+    static constexpr uint32_t SLAB_BITS = 12;
+    static constexpr uint32_t SLAB_SIZE = 1u << SLAB_BITS;
+    static constexpr uint32_t DEAD = 0xFFFFFFFFu;   // refs of a freed slot
+
+    struct Node{
+        uint32_t left, right;
+        uint32_t handle;
+        uint32_t pri;
+        uint32_t cnt;
+        uint32_t refs;
+    };
+
+    size_t live = 0;
+
+    Node& operator[](uint32_t i){ return slabs[i >> SLAB_BITS][i & (SLAB_SIZE-1)]; }
+    uint32_t count(uint32_t t){ return t == NIL ? 0 : (*this)[t].cnt; }
+
+    // New unreferenced node over children that gain a reference
+    uint32_t make(uint32_t handle, uint32_t pri, uint32_t left, uint32_t right){
+        uint32_t i = alloc();
+        Node& n = (*this)[i];
+        n.left = left;
+        n.right = right;
+        n.handle = handle;
+        n.pri = pri;
+        n.cnt = 1 + count(left) + count(right);
+        n.refs = 0;
+        if(left != NIL) (*this)[left].refs++;
+        if(right != NIL) (*this)[right].refs++;
+        fresh.push_back(i);
+        return i;
+    }
+
+    uint32_t nextPri(){ seed ^= seed<<13; seed ^= seed>>17; seed ^= seed<<5; return seed; }
+
+    void retain(uint32_t t){ if(t != NIL) (*this)[t].refs++; }
+
+    void release(uint32_t t){
+        if(t == NIL || --(*this)[t].refs) return;
+        destroy(t);
+    }
+
+    // Frees the nodes an edit built and then dropped on the way to its result
+    void sweep(){
+        for(uint32_t i : fresh) if((*this)[i].refs == 0) destroy(i);
+        fresh.clear();
+    }
+
+private:
+    vector<unique_ptr<Node[]>> slabs;
+    uint32_t used = SLAB_SIZE;      // slots taken in the last slab
+    vector<uint32_t> freeSlots;
+    vector<uint32_t> fresh;         // made since the last sweep
+    vector<uint32_t> stack;
+    unsigned seed = 2463534242u;
+
+    uint32_t alloc(){
+        live++;
+        if(!freeSlots.empty()){
+            uint32_t i = freeSlots.back();
+            freeSlots.pop_back();
+            return i;
+        }
+        if(used == SLAB_SIZE){
+            slabs.emplace_back(new Node[SLAB_SIZE]);
+            used = 0;
+        }
+        return (uint32_t)((slabs.size()-1) << SLAB_BITS | used++);
+    }
+
+    // t has no references left: free it and whatever only it held
+    void destroy(uint32_t t){
+        stack.push_back(t);
+        while(!stack.empty()){
+            uint32_t i = stack.back();
+            stack.pop_back();
+            Node& n = (*this)[i];
+            for(uint32_t c : {n.left, n.right})
+                if(c != NIL && --(*this)[c].refs == 0) stack.push_back(c);
+            n.refs = DEAD;
+            freeSlots.push_back(i);
+            live--;
+        }
+    }
+};
+
+// Immutable sequence of 32-bit handles: an implicit treap with path copying.
+// An edit copies only the O(log n) nodes on its path and shares everything
+// else with the version it started from, so keeping hundreds of versions of
+// a million-entry list costs a few KB each. Copies are O(1).
+class PersistentSeq{
+public:
+    static constexpr uint32_t NIL = SeqStore::NIL;
+
+    PersistentSeq() = default;
+    explicit PersistentSeq(SeqStore* s) : store(s){}
+    PersistentSeq(const PersistentSeq& o) : store(o.store), root(o.root){ if(store) store->retain(root); }
+    PersistentSeq(PersistentSeq&& o) noexcept : store(o.store), root(o.root){ o.root = NIL; }
+    PersistentSeq& operator=(PersistentSeq o){ swap(store, o.store); swap(root, o.root); return *this; }
+    ~PersistentSeq(){ if(store) store->release(root); }
+
+    int size() const{ return store ? (int)store->count(root) : 0; }
+
+    // 0-based position -> handle
+    uint32_t at(int i) const{
+        uint32_t t = root;
+        while(t != NIL){
+            SeqStore::Node& n = (*store)[t];
+            int l = (int)store->count(n.left);
+            if(i < l) t = n.left;
+            else if(i == l) return n.handle;
+            else { i -= l+1; t = n.right; }
+        }
+        return NIL;
+    }
+
+    // count handles from position pos, appended to out in order
+    void read(int pos, int count, vector<uint32_t>& out) const{
+        if(count > 0) collect(root, pos, pos + count, out);
+    }
+
+    // This sequence with handles put in before position pos
+    PersistentSeq inserted(int pos, const vector<uint32_t>& handles) const{
+        if(handles.empty()) return *this;
+        uint32_t a, b;
+        split(root, pos, a, b);
+        return adopt(merge(merge(a, build(handles)), b));
+    }
+
+    // This sequence without count handles from position pos
+    PersistentSeq erased(int pos, int count) const{
+        if(count <= 0) return *this;
+        uint32_t a, b, mid, c;
+        split(root, pos, a, b);
+        split(b, count, mid, c);
+        return adopt(merge(a, c));
+    }
+
+private:
+    SeqStore* store = nullptr;
+    uint32_t root = NIL;
+
+    PersistentSeq(SeqStore* s, uint32_t r) : store(s), root(r){}
+
+    PersistentSeq adopt(uint32_t r) const{
+        store->retain(r);
+        store->sweep();
+        return PersistentSeq(store, r);
+    }
+
+    uint32_t copyWith(uint32_t t, uint32_t left, uint32_t right) const{
+        SeqStore::Node& n = (*store)[t];
+        return store->make(n.handle, n.pri, left, right);
+    }
+
+    uint32_t merge(uint32_t a, uint32_t b) const{
+        if(a == NIL) return b;
+        if(b == NIL) return a;
+        if((*store)[a].pri > (*store)[b].pri){
+            uint32_t r = merge((*store)[a].right, b);
+            return copyWith(a, (*store)[a].left, r);
+        }
+        uint32_t l = merge(a, (*store)[b].left);
+        return copyWith(b, l, (*store)[b].right);
+    }
+
+    // first k handles -> a, rest -> b
+    void split(uint32_t t, int k, uint32_t& a, uint32_t& b) const{
+        if(t == NIL){ a = b = NIL; return; }
+        int l = (int)store->count((*store)[t].left);
+        if(l < k){
+            uint32_t ra;
+            split((*store)[t].right, k - l - 1, ra, b);
+            a = copyWith(t, (*store)[t].left, ra);
+        } else {
+            uint32_t lb;
+            split((*store)[t].left, k, a, lb);
+            b = copyWith(t, lb, (*store)[t].right);
+        }
+    }
+
+    // Treap over handles in O(n): built left to right on a stack, the way
+    // PlaylistIndex::insertChain does; parents are fixed up as nodes finish
+    uint32_t build(const vector<uint32_t>& handles) const{
+        vector<uint32_t> stack;
+        SeqStore& s = *store;
+        auto finish = [&s](uint32_t t){
+            SeqStore::Node& n = s[t];
+            n.cnt = 1 + s.count(n.left) + s.count(n.right);
+            if(n.left != NIL) s[n.left].refs = 1;
+            if(n.right != NIL) s[n.right].refs = 1;
+        };
+        for(uint32_t h : handles){
+            uint32_t t = s.make(h, s.nextPri(), NIL, NIL);
+            uint32_t last = NIL;
+            while(!stack.empty() && s[stack.back()].pri < s[t].pri){
+                last = stack.back();
+                stack.pop_back();
+                finish(last);
+            }
+            s[t].left = last;
+            if(!stack.empty()) s[stack.back()].right = t;
+            stack.push_back(t);
+        }
+        uint32_t top = stack.empty() ? NIL : stack.front();
+        while(!stack.empty()){ finish(stack.back()); stack.pop_back(); }
+        return top;
+    }
+
+    void collect(uint32_t t, int from, int to, vector<uint32_t>& out) const{
+        while(t != NIL && from < to){
+            SeqStore::Node& n = (*store)[t];
+            int l = (int)store->count(n.left);
+            if(from < l) collect(n.left, from, min(to, l), out);
+            if(from <= l && l < to) out.push_back(n.handle);
+            // continue right without recursing
+            from = max(0, from - l - 1);
+            to -= l + 1;
+            t = n.right;
+        }
+    }
+};
@@ -0,0 +1,360 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include "musicplayer.h"
+using namespace std;
+
+// Bounded multi-producer / single-consumer ring (Vyukov's sequence-number
+// scheme). Producers claim a slot with one CAS; nobody ever takes a lock.
+template<class T, size_t N>
+class CommandRing{
+    static_assert((N & (N-1)) == 0, "ring size must be a power of two");
+public:
+    CommandRing(){
+        for(size_t i = 0; i < N; i++) slots[i].seq.store(i, memory_order_relaxed);
+    }
+
+    bool push(T&& v){
+        size_t pos = tail.load(memory_order_relaxed);
+        while(true){
+            Slot& s = slots[pos & (N-1)];
+            size_t seq = s.seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if(dif == 0){
+                if(tail.compare_exchange_weak(pos, pos+1, memory_order_relaxed)){
+                    s.value = move(v);
+                    s.seq.store(pos+1, memory_order_release);
+                    return true;
+                }
+            } else if(dif < 0){
+                return false;   // full
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& out){
+        Slot& s = slots[head & (N-1)];
+        size_t seq = s.seq.load(memory_order_acquire);
+        if((intptr_t)seq - (intptr_t)(head+1) < 0) return false;  // empty
+        out = move(s.value);
+        s.seq.store(head + N, memory_order_release);
+        head++;
+        return true;
+    }
+
+private:
+    struct Slot{
+        atomic<size_t> seq;
+        T value;
+    };
+    Slot slots[N];
+    alignas(64) atomic<size_t> tail{0};
+    alignas(64) size_t head = 0;      // consumer only
+};
+
+// Lock-free triple buffer: the writer always has a private back slot, the
+// reader always has a private front slot, and they trade through the middle.
+template<class T>
+class TripleBuffer{
+public:
+    T& back(){ return buf[backIdx]; }
+
+    void publish(){
+        backIdx = middle.exchange(backIdx | FRESH, memory_order_acq_rel) & INDEX;
+    }
+
+    // Latest published value; stays the same until something newer arrives
+    const T& read(){
+        if(middle.load(memory_order_acquire) & FRESH)
+            frontIdx = middle.exchange(frontIdx, memory_order_acq_rel) & INDEX;
+        return buf[frontIdx];
+    }
+
+private:
+    static constexpr int FRESH = 4;
+    static constexpr int INDEX = 3;
+    T buf[3];
+    int backIdx = 0;
+    int frontIdx = 1;
+    atomic<int> middle{2};
+};
+
+enum class Cmd{ PLAY, PAUSE, RESUME, STOP, NEXT, PREV, RANDOM, SHUFFLE, SELECT, REMOVE, ADD, IMPORT, EXPORT, ADD_TRACKS, SEARCH, CROSSFADE, FADESHAPE, MOVE, UNDO, REDO, DEDUPE, SORT, LOG };
+
+struct Command{
+    Cmd type = Cmd::LOG;
+    int pos = 0;
+    int to = 0;         // MOVE destination
+    string text;
+    vector<TrackInfo> tracks;
+};
+
+// One playlist row as the UI sees it
+struct RowView{
+    string song;
+    int pos;
+    bool isCurrent;
+};
+
+// Everything the frontend draws, copied out by the control thread
+struct PlayerSnapshot{
+    bool isPlaying = false;
+    bool isPaused = false;
+    bool shuffleOn = false;
+    bool canUndo = false, canRedo = false;
+    bool hasCurrent = false;
+    string currentSong;
+    int currentIndex = 0;
+    int size = 0;
+    unsigned long long generation = 0;
+    float offset = 0, duration = 0, progress = 0, volume = 70;
+    string elapsed = "0:00", total = "0:00";
+    float bands[SpectrumAnalyzer::BANDS] = {};  // 0..1, low to high frequency
+    float level = 0;
+    shared_ptr<const WavePeaks> peaks;   // current track, null while generating
+    float crossfade = 0;                 // seconds, 0 = off
+    FadeShape fadeShape = FadeShape::EqualPower;
+    unsigned long long underruns = 0;    // times the output ran dry
+    size_t nodesLive = 0, nodeSlabs = 0; // songs in the pool, heap allocations it made
+    unsigned long long gapSamples = 0;   // silence at the last automatic track change
+    float transitionMs = 0;              // slowest frame right after the last track change
+    string logMsg;
+    int viewOffset = 0;
+    vector<RowView> rows;       // playlist window starting at viewOffset
+    string query;
+    vector<RowView> matches;    // ranked results for query
+    unsigned long long applied = 0;      // commands applied before this was published
+    bool working = false;                // waveforms still being built, so later snapshots differ
+};
+
+// Owns the MusicPlayer on its own thread. The UI enqueues commands without
+// blocking, and reads an immutable snapshot each frame. Seeks and volume are
+// last-writer-wins values, so a drag that fires every frame costs one seek.
+class PlayerController{
+public:
+    static constexpr int SEARCH_LIMIT = 50;
+    static constexpr int TICK_MS = 5;           // while playing: transitions, meters
+    static constexpr int IDLE_TICK_MS = 20;     // otherwise commands wake it anyway
+    static constexpr int TICK_COMMANDS = 1024;  // per tick, so a flood cannot hold back snapshots
+
+    // sessionDir holds the journaled playlist; empty runs without one
+    explicit PlayerController(int rows, unique_ptr<AudioBackend> backend = MusicPlayer::defaultBackend(),
+                              const string& sessionDir = SESSION_DIR)
+        : player(move(backend)), viewRows(rows){
+        if(!sessionDir.empty()) restoredSession = player.openSession(sessionDir);
+        restoredVolume = player.getVolume();
+        worker = thread(&PlayerController::run, this);
+    }
+
+    ~PlayerController(){
+        quit = true;
+        cv.notify_one();
+        worker.join();
+    }
+
+    // Any command, already filled in
+    void post(Command&& c){
+        posted++;
+        while(!ring.push(move(c))) this_thread::yield(); // 1024 deep: only a flood can fill it
+        cv.notify_one();
+    }
+
+    void send(Cmd type, int pos = 0, const string& text = ""){
+        Command c;
+        c.type = type;
+        c.pos = pos;
+        c.text = text;
+        post(move(c));
+    }
+
+    void moveSong(int from, int to){
+        Command c;
+        c.type = Cmd::MOVE;
+        c.pos = from;
+        c.to = to;
+        post(move(c));
+    }
+
+    void addTracks(vector<TrackInfo> tracks){
+        if(tracks.empty()) return;
+        Command c;
+        c.type = Cmd::ADD_TRACKS;
+        c.tracks = move(tracks);
+        post(move(c));
+    }
+
+    // Called on the control thread after every snapshot it publishes; must
+    // be quick. Set it before anything else talks to the controller.
+    void onPublish(function<void()> fn){
+        lock_guard<mutex> lock(hookMutex);
+        publishHook = move(fn);
+    }
+
+    void seekTo(float seconds){ pendingSeek.store(seconds); cv.notify_one(); }
+    void setVolume(float v){ pendingVolume.store(max(0.0f, min(100.0f, v))); cv.notify_one(); }
+    void setView(int offset){ viewOffset.store(offset); }
+    void noteFrame(float dt){ frameDt.store(dt); frames++; }
+
+    const PlayerSnapshot& snapshot(){ return snap.read(); }
+
+    // Whether s already shows every command posted so far and the control
+    // thread has nothing else under way that would change the next one
+    bool settled(const PlayerSnapshot& s) const{ return s.applied == posted.load() && !s.working; }
+
+    // Whether the last session's playlist came back, and the volume it had
+    bool restored() const{ return restoredSession; }
+    float startVolume() const{ return restoredVolume; }
+
+private:
+    MusicPlayer player;     // touched only by the control thread
+    CommandRing<Command, 1024> ring;
+    TripleBuffer<PlayerSnapshot> snap;
+    thread worker;
+    atomic<bool> quit{false};
+    mutex sleepMutex;       // only for the idle wait, never held by the UI
+    condition_variable cv;
+    atomic<float> pendingSeek{NAN};
+    atomic<float> pendingVolume{NAN};
+    atomic<int> viewOffset{0};
+    atomic<float> frameDt{0};
+    atomic<unsigned long long> frames{0};
+    unsigned long long seenFrames = 0;
+    atomic<unsigned long long> posted{0};
+    unsigned long long appliedTotal = 0;
+    int viewRows;
+    bool restoredSession = false;
+    float restoredVolume = 70;
+    string query;
+    int warmedView = -1;
+    unsigned long long warmedGeneration = ~0ull;
+    mutex hookMutex;        // only contended while the hook is being set
+    function<void()> publishHook;
+
+    void run(){
+        Profiler::nameThread("control");
+        while(!quit){
+            Command c;
+            int applied = 0;
+            while(applied < TICK_COMMANDS && ring.pop(c)){
+                PROFILE_SCOPE("ctl.command");
+                apply(c);
+                applied++;
+                appliedTotal++;
+            }
+            float seek = pendingSeek.exchange(NAN);
+            if(!isnan(seek)) player.seekTo(seek);
+            float vol = pendingVolume.exchange(NAN);
+            if(!isnan(vol)) player.setVolume(vol);
+            player.update();
+            unsigned long long f = frames.load();
+            if(f != seenFrames){ player.noteFrame(frameDt.load()); seenFrames = f; }
+            publish();
+            if(applied == TICK_COMMANDS) continue;  // more may be queued
+            unique_lock<mutex> lock(sleepMutex);
+            cv.wait_for(lock, chrono::milliseconds(player.isPlaying ? TICK_MS : IDLE_TICK_MS));
+        }
+        player.closeSession();  // before stopping, so the position is kept
+        player.stopMusic();
+    }
+
+    void apply(Command& c){
+        switch(c.type){
+            case Cmd::PLAY:    player.play(); break;
+            case Cmd::PAUSE:   player.pause(); break;
+            case Cmd::RESUME:  player.resume(); break;
+            case Cmd::STOP:    player.stopMusic(); break;
+            case Cmd::NEXT:    player.next(); break;
+            case Cmd::PREV:    player.prev(); break;
+            case Cmd::RANDOM:  player.randomSong(); break;
+            case Cmd::SHUFFLE: player.toggleShuffle(); break;
+            case Cmd::SELECT:
+                if(player.isPlaying) player.changeTo(player.songAt(c.pos), "SELECTED");
+                else player.setByIndex(c.pos);
+                break;
+            case Cmd::REMOVE:
+                if(!player.isPlaying) player.deleteMusic(c.pos);
+                else player.logMsg = "STOP PLAYBACK BEFORE DELETING";
+                break;
+            case Cmd::ADD:        player.addMusic(c.text); break;
+            case Cmd::IMPORT:     player.importPlaylist(c.text); break;
+            case Cmd::EXPORT:     player.exportPlaylist(c.text); break;
+            case Cmd::ADD_TRACKS: player.addTracks(c.tracks); break;
+            case Cmd::SEARCH:     query = c.text; break;
+            case Cmd::CROSSFADE:  player.setCrossfade((float)c.pos, player.fadeShape); break;
+            case Cmd::FADESHAPE:  player.setCrossfade(player.crossfadeSec, (FadeShape)c.pos); break;
+            case Cmd::MOVE:       player.moveMusic(c.pos, c.to); break;
+            case Cmd::UNDO:       player.undo(); break;
+            case Cmd::REDO:       player.redo(); break;
+            case Cmd::DEDUPE:     player.dedupe(); break;
+            case Cmd::SORT:       player.sortBy(c.text); break;
+            case Cmd::LOG:        player.logMsg = c.text; break;
+        }
+    }
+
+    void publish(){
+        PROFILE_SCOPE("ctl.publish");
+        PlayerSnapshot& s = snap.back();
+        s.isPlaying = player.isPlaying;
+        s.isPaused = player.isPaused;
+        s.shuffleOn = player.shuffleOn;
+        s.canUndo = player.history.canUndo();
+        s.canRedo = player.history.canRedo();
+        s.hasCurrent = player.current != nullptr;
+        s.currentSong = player.current ? player.current->song : "";
+        s.currentIndex = player.currentIndex();
+        s.size = player.size;
+        s.offset = player.getOffset();
+        s.duration = player.getDuration();
+        s.progress = player.getProgress();
+        s.volume = player.getVolume();
+        s.elapsed = player.getTimeElapsed();
+        s.total = player.getTimeDuration();
+        for(int b = 0; b < SpectrumAnalyzer::BANDS; b++) s.bands[b] = player.spectrum.band(b);
+        s.level = player.spectrum.level();
+        s.peaks = player.peaksFor(player.current);
+        s.crossfade = player.crossfadeSec;
+        s.fadeShape = player.fadeShape;
+        s.underruns = player.audio->underruns();
+        s.nodesLive = player.pool.live;
+        s.nodeSlabs = player.pool.slabAllocs;
+        s.gapSamples = player.lastGapSamples;
+        s.transitionMs = player.worstTransitionMs;
+        s.logMsg = player.logMsg;
+
+        s.viewOffset = viewOffset.load();
+        s.rows.clear();
+        bool warm = s.viewOffset != warmedView || player.generation != warmedGeneration;
+        for(node* n : player.visible(s.viewOffset, viewRows)){
+            s.rows.push_back({n->song, 0, n == player.current});
+            if(warm) player.peaksFor(n);    // so selecting a visible row shows its waveform at once
+        }
+        warmedView = s.viewOffset;
+        warmedGeneration = player.generation;
+        for(size_t i = 0; i < s.rows.size(); i++) s.rows[i].pos = s.viewOffset + (int)i + 1;
+
+        // results only change with the query or the playlist
+        if(query != s.query || player.generation != s.generation){
+            s.matches.clear();
+            if(!query.empty())
+                for(node* n : player.find(query, SEARCH_LIMIT))
+                    s.matches.push_back({n->song, player.positionOf(n), false});
+            s.query = query;
+        }
+        for(RowView& r : s.matches) r.isCurrent = player.current && r.pos == s.currentIndex;
+        s.generation = player.generation;
+        s.applied = appliedTotal;
+        s.working = player.waves.busy();
+        snap.publish();
+        lock_guard<mutex> lock(hookMutex);
+        if(publishHook) publishHook();
+    }
+};
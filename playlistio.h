@@ -0,0 +1,161 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+using namespace std;
+
+enum class PlaylistFormat{ M3U, PLS, UNKNOWN };
+
+inline PlaylistFormat playlistFormatOf(const string& path){
+    size_t dot = path.find_last_of('.');
+    if(dot == string::npos) return PlaylistFormat::UNKNOWN;
+    string ext = path.substr(dot + 1);
+    for(char& c : ext) if(c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    if(ext == "m3u" || ext == "m3u8") return PlaylistFormat::M3U;
+    if(ext == "pls") return PlaylistFormat::PLS;
+    return PlaylistFormat::UNKNOWN;
+}
+
+// "dir/Some Song.wav" -> "Some Song"
+inline string fileStem(const string& path){
+    size_t slash = path.find_last_of("/\\");
+    size_t start = slash == string::npos ? 0 : slash + 1;
+    size_t dot = path.find_last_of('.');
+    if(dot == string::npos || dot < start) dot = path.size();
+    return path.substr(start, dot - start);
+}
+
+inline bool isAbsolutePath(const string& p){
+    return (!p.empty() && (p[0] == '/' || p[0] == '\\')) ||
+           (p.size() > 1 && p[1] == ':') || p.find("://") != string::npos;
+}
+
+// Streams a playlist in 64 KB chunks and calls onTrack(path, title, seconds)
+// for every entry, reusing the same strings throughout. Relative paths are
+// resolved against the playlist's own directory. PLS entries are emitted as
+// soon as their number changes, which covers the File/Title/Length grouping
+// every writer uses.
+template<class OnTrack>
+bool readPlaylist(const string& file, OnTrack onTrack){
+    PlaylistFormat fmt = playlistFormatOf(file);
+    if(fmt == PlaylistFormat::UNKNOWN) return false;
+    FILE* f = fopen(file.c_str(), "rb");
+    if(!f) return false;
+
+    size_t slash = file.find_last_of("/\\");
+    string dir = slash == string::npos ? "" : file.substr(0, slash + 1);
+
+    vector<char> chunk(1 << 16);
+    string line, path, title;
+    float seconds = 0;
+    int plsEntry = -1;
+    bool first = true;
+
+    auto emit = [&]{
+        if(path.empty()) return;
+        if(!isAbsolutePath(path)) path.insert(0, dir);
+        onTrack(path, title, seconds);
+        path.clear();
+        title.clear();
+        seconds = 0;
+    };
+
+    auto handle = [&](const char* s, size_t n){
+        if(first){
+            first = false;
+            if(n >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0){ s += 3; n -= 3; } // UTF-8 BOM
+        }
+        while(n && (s[n-1] == '\r' || s[n-1] == ' ' || s[n-1] == '\t')) n--;
+        while(n && (*s == ' ' || *s == '\t')){ s++; n--; }
+        if(!n) return;
+        if(fmt == PlaylistFormat::M3U){
+            if(*s == '#'){
+                if(n > 8 && memcmp(s, "#EXTINF:", 8) == 0){
+                    const char* comma = (const char*)memchr(s, ',', n);
+                    seconds = (float)atof(string(s + 8, comma ? comma - s - 8 : n - 8).c_str());
+                    if(seconds < 0) seconds = 0;    // -1: length unknown, as for streams
+                    if(comma) title.assign(comma + 1, s + n - comma - 1);
+                }
+                return;
+            }
+            path.assign(s, n);
+            emit();
+        } else {
+            const char* eq = (const char*)memchr(s, '=', n);
+            if(!eq) return;
+            size_t keyLen = eq - s;
+            size_t digits = 0;
+            while(digits < keyLen && s[keyLen-1-digits] >= '0' && s[keyLen-1-digits] <= '9') digits++;
+            if(!digits) return;
+            int entry = atoi(string(s + keyLen - digits, digits).c_str());
+            if(entry != plsEntry){ emit(); plsEntry = entry; }
+            string key(s, keyLen - digits);
+            const char* val = eq + 1;
+            size_t valLen = s + n - val;
+            if(key == "File") path.assign(val, valLen);
+            else if(key == "Title") title.assign(val, valLen);
+            else if(key == "Length"){ seconds = (float)atof(string(val, valLen).c_str()); if(seconds < 0) seconds = 0; }
+        }
+    };
+
+    size_t got;
+    while((got = fread(chunk.data(), 1, chunk.size(), f)) > 0){
+        const char* p = chunk.data();
+        const char* end = p + got;
+        while(p < end){
+            const char* nl = (const char*)memchr(p, '\n', end - p);
+            if(!nl){ line.append(p, end - p); break; }
+            if(line.empty()) handle(p, nl - p);
+            else { line.append(p, nl - p); handle(line.data(), line.size()); line.clear(); }
+            p = nl + 1;
+        }
+    }
+    if(!line.empty()) handle(line.data(), line.size());
+    if(fmt == PlaylistFormat::PLS) emit();
+    fclose(f);
+    return true;
+}
+
+// Writes entries as they are handed over — nothing is collected first.
+// PLS needs the entry count at the end, which the format allows.
+class PlaylistWriter{
+public:
+    ~PlaylistWriter(){ close(); }
+
+    bool open(const string& file){
+        fmt = playlistFormatOf(file);
+        if(fmt == PlaylistFormat::UNKNOWN) return false;
+        f = fopen(file.c_str(), "wb");
+        if(!f) return false;
+        setvbuf(f, nullptr, _IOFBF, 1 << 16);
+        count = 0;
+        fputs(fmt == PlaylistFormat::M3U ? "#EXTM3U\n" : "[playlist]\n", f);
+        return true;
+    }
+
+    void add(const string& path, const string& title, float seconds){
+        count++;
+        if(fmt == PlaylistFormat::M3U){
+            fprintf(f, "#EXTINF:%d,%s\n%s\n", seconds > 0 ? (int)seconds : -1, title.c_str(), path.c_str());
+        } else {
+            fprintf(f, "File%d=%s\nTitle%d=%s\nLength%d=%d\n", count, path.c_str(), count, title.c_str(), count, seconds > 0 ? (int)seconds : -1);
+        }
+    }
+
+    bool close(){
+        if(!f) return false;
+        if(fmt == PlaylistFormat::PLS) fprintf(f, "NumberOfEntries=%d\nVersion=2\n", count);
+        bool ok = ferror(f) == 0;
+        ok = fclose(f) == 0 && ok;
+        f = nullptr;
+        return ok;
+    }
+
+    int count = 0;
+
+private:
+    FILE* f = nullptr;
+    PlaylistFormat fmt = PlaylistFormat::UNKNOWN;
+};
@@ -0,0 +1,301 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include "threadpool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUNDLIST_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define SOUNDLIST_PREFETCH(p) ((void)(p))
+#endif
+using namespace std;
+
+enum class SortKey : uint8_t{ Name, Duration, FileDate, Loudness };
+
+struct SortField{
+    SortKey key = SortKey::Name;
+    bool descending = false;
+};
+
+inline const char* sortKeyName(SortKey k){
+    switch(k){
+        case SortKey::Name:     return "NAME";
+        case SortKey::Duration: return "DURATION";
+        case SortKey::FileDate: return "DATE";
+        case SortKey::Loudness: return "LOUDNESS";
+    }
+    return "?";
+}
+
+// "name", "duration", "date" or "loudness", comma separated, most
+// significant first; a leading '-' sorts that field descending
+inline bool parseSortSpec(const string& spec, vector<SortField>& out){
+    out.clear();
+    size_t at = 0;
+    while(at <= spec.size()){
+        size_t end = spec.find(',', at);
+        if(end == string::npos) end = spec.size();
+        string word;
+        for(size_t i = at; i < end; i++) if(spec[i] != ' ') word += (char)tolower((unsigned char)spec[i]);
+        SortField f;
+        if(!word.empty() && word[0] == '-'){ f.descending = true; word.erase(0, 1); }
+        if(word == "name" || word == "title") f.key = SortKey::Name;
+        else if(word == "duration" || word == "length" || word == "time") f.key = SortKey::Duration;
+        else if(word == "date" || word == "mtime") f.key = SortKey::FileDate;
+        else if(word == "loudness" || word == "lufs") f.key = SortKey::Loudness;
+        else return false;
+        out.push_back(f);
+        at = end + 1;
+    }
+    return !out.empty();
+}
+
+// Keys as unsigned integers that order the way the values do, so a
+// comparison is one integer compare. UNKNOWN sorts after every real value.
+const uint64_t SORT_UNKNOWN = ~0ull;
+
+inline uint64_t floatSortKey(float v){
+    uint32_t b;
+    memcpy(&b, &v, 4);
+    return (b & 0x80000000u) ? ~b : b | 0x80000000u;
+}
+
+inline uint64_t dateSortKey(int64_t ticks){
+    return (uint64_t)ticks ^ 0x8000000000000000ull;
+}
+
+inline unsigned char foldCase(unsigned char c){ return c >= 'a' && c <= 'z' ? c - 32 : c; }
+
+inline int compareNames(const string& a, const string& b){
+    size_t n = min(a.size(), b.size());
+    for(size_t i = 0; i < n; i++){
+        unsigned char x = foldCase((unsigned char)a[i]), y = foldCase((unsigned char)b[i]);
+        if(x != y) return x < y ? -1 : 1;
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+// Keys that cost a string compare, a system call or a lookup, per pool
+// handle. A name's key is its rank among every name cached, equal names
+// equal ranks, so sorting by name compares integers; the names are kept in
+// order, and a song added later is ranked with a binary search. A handle's
+// entry is dropped when its song is freed, so a reused slot starts clean.
+class SortKeyCache{
+public:
+    static constexpr uint8_t NAME = 1, DATE = 2, LOUDNESS = 4;
+
+    struct Entry{
+        uint64_t name = 0;
+        uint64_t date = SORT_UNKNOWN;
+        uint64_t loudness = SORT_UNKNOWN;
+        uint8_t have = 0;
+    };
+
+    const Entry& operator[](uint32_t h) const{ return entries[h]; }
+
+    void forget(uint32_t h){
+        if(h >= entries.size()) return;
+        forgotten |= (entries[h].have & NAME) != 0;
+        entries[h] = Entry();
+    }
+
+    // Fills in the wanted keys the handles lack. name(h) gives the song
+    // name; date(h) and loudness(h, key) may block, and run across threads;
+    // loudness returns false while the track is not measured yet, so it is
+    // asked again next time. Returns how many handles lacked something.
+    template<class Name, class Date, class Loudness>
+    size_t fill(const vector<uint32_t>& handles, uint8_t want, Name name, Date date, Loudness loudness, unsigned threads = 0){
+        uint32_t top = 0;
+        for(uint32_t h : handles) top = max(top, h + 1);
+        if(entries.size() < top) entries.resize(top);
+        vector<uint32_t> missing, unnamed;
+        for(uint32_t h : handles){
+            if(want & ~entries[h].have & (DATE | LOUDNESS)) missing.push_back(h);
+            if(want & ~entries[h].have & NAME) unnamed.push_back(h);
+        }
+        parallelFor(missing.size(), [&](size_t i){
+            Entry& e = entries[missing[i]];
+            uint8_t need = want & ~e.have;
+            if(need & DATE){ e.date = date(missing[i]); e.have |= DATE; }
+            if((need & LOUDNESS) && loudness(missing[i], e.loudness)) e.have |= LOUDNESS;
+        }, threads);
+        if(!unnamed.empty()) rankNames(unnamed, name);
+        return missing.size() + unnamed.size();
+    }
+
+    size_t size() const{ return entries.size(); }
+
+private:
+    vector<Entry> entries;
+    vector<uint32_t> byName;    // every handle with a NAME key, in name order
+    vector<bool> sameName;      // byName[i] has the name of byName[i-1]
+    bool forgotten = false;     // byName holds freed handles
+
+    template<class Name>
+    void rankNames(vector<uint32_t>& fresh, Name name){
+        auto less = [&](uint32_t a, uint32_t b){ return compareNames(name(a), name(b)) < 0; };
+        if(forgotten){
+            // a song kept has the name of the one kept before it if every
+            // song in between, freed ones included, had the name before it
+            size_t out = 0;
+            bool chain = true;
+            for(size_t i = 0; i < byName.size(); i++){
+                chain = chain && sameName[i];
+                if(!(entries[byName[i]].have & NAME)) continue;
+                byName[out] = byName[i];
+                sameName[out] = out && chain;
+                out++;
+                chain = true;
+            }
+            byName.resize(out);
+            sameName.resize(out);
+            forgotten = false;
+        }
+        stable_sort(fresh.begin(), fresh.end(), less);
+        // each goes after the equal names already there, so a group of
+        // equal names is never split and only new entries need a compare
+        vector<uint32_t> merged;
+        vector<bool> same;
+        merged.reserve(byName.size() + fresh.size());
+        same.reserve(byName.size() + fresh.size());
+        size_t at = 0;
+        for(uint32_t h : fresh){
+            size_t to = upper_bound(byName.begin() + at, byName.end(), h, less) - byName.begin();
+            for(; at < to; at++){ merged.push_back(byName[at]); same.push_back(sameName[at]); }
+            same.push_back(!merged.empty() && compareNames(name(merged.back()), name(h)) == 0);
+            merged.push_back(h);
+        }
+        for(; at < byName.size(); at++){ merged.push_back(byName[at]); same.push_back(sameName[at]); }
+        byName.swap(merged);
+        sameName.swap(same);
+        uint64_t rank = 0;
+        for(size_t i = 0; i < byName.size(); i++){
+            rank += i && !sameName[i];
+            entries[byName[i]].name = rank;
+            entries[byName[i]].have |= NAME;
+        }
+    }
+};
+
+// Stable merge sort over nodes linked by next and prev. Both links are
+// kept right as nodes are merged, while they are in cache: on a shuffled
+// list every extra pass over it is a cache miss per node.
+template<class Node>
+struct SortRun{
+    Node* first = nullptr;
+    Node* last = nullptr;
+};
+
+// a's nodes come first in the original order, so they win ties. With
+// order, the merged nodes are also written there in sequence.
+template<class Node, class Less>
+SortRun<Node> mergeSortedRuns(SortRun<Node> a, SortRun<Node> b, const Less& less, Node** order = nullptr){
+    if(!a.first || !b.first){
+        SortRun<Node> only = a.first ? a : b;
+        for(Node* n = only.first; order && n; n = n->next) *order++ = n;
+        return only;
+    }
+    SortRun<Node> out;
+    Node* x = a.first;
+    Node* y = b.first;
+    Node* tail;
+    if(less(*y, *x)){ tail = y; y = y->next; }
+    else { tail = x; x = x->next; }
+    out.first = tail;
+    if(order) *order++ = tail;
+    while(x && y){
+        // the node after each head is the next miss either way: ask for
+        // both now, so the two chains are fetched side by side
+        SOUNDLIST_PREFETCH(x->next);
+        SOUNDLIST_PREFETCH(y->next);
+        Node*& take = less(*y, *x) ? y : x;
+        tail->next = take;
+        take->prev = tail;
+        tail = take;
+        take = take->next;
+        if(order) *order++ = tail;
+    }
+    tail->next = x ? x : y;
+    tail->next->prev = tail;
+    for(Node* n = tail->next; order && n; n = n->next) *order++ = n;
+    out.last = x ? a.last : b.last;
+    return out;
+}
+
+// Bottom-up over natural runs, all along next: the list is cut into
+// stretches already in order, and bin i holds a merge of up to 2^i of
+// them, like std::list::sort. An ordered list is one run, so resorting it
+// is O(n). Needs no memory, but on a big list that is shuffled in memory
+// every level waits on a miss per node.
+template<class Node, class Less>
+SortRun<Node> mergeSortList(Node* list, const Less& less){
+    SortRun<Node> bins[64];
+    int used = 0;
+    while(list){
+        SortRun<Node> run;
+        run.first = run.last = list;
+        while(run.last->next && !less(*run.last->next, *run.last)) run.last = run.last->next;
+        list = run.last->next;
+        run.last->next = nullptr;
+        int i = 0;
+        for(; i < 63 && bins[i].first; i++){
+            run = mergeSortedRuns(bins[i], run, less);
+            bins[i] = SortRun<Node>();
+        }
+        bins[i] = run;
+        used = max(used, i + 1);
+    }
+    SortRun<Node> out;
+    for(int i = 0; i < used; i++) out = mergeSortedRuns(bins[i], out, less);
+    return out;
+}
+
+// Sorts and relinks the nodes of a ring, given in ring order, and leaves
+// them in nodes in sorted order. Node has a sortKey that decides unless it
+// ties. The nodes are cut into one piece per thread and every piece is
+// sorted at the same time as an array of (sortKey, node) pairs, where
+// comparisons touch no node unless keys tie and the misses of a shuffled
+// list overlap instead of queueing along next. Each piece is then
+// relinked, and the pieces are merged as lists pairwise, each round in
+// parallel. Returns the ends of the sorted chain; first->prev and
+// last->next are null.
+template<class Node, class Less>
+SortRun<Node> parallelSortList(vector<Node*>& nodes, const Less& less, unsigned threads = 0){
+    if(nodes.empty()) return SortRun<Node>();
+    if(!threads) threads = workerCount();
+    const size_t MIN_PIECE = 1 << 14;   // below this a thread costs more than it saves
+    size_t pieces = min<size_t>(threads, max<size_t>(1, nodes.size() / MIN_PIECE));
+    vector<SortRun<Node>> runs(pieces);
+    parallelFor(pieces, [&](size_t p){
+        size_t from = nodes.size() * p / pieces, to = nodes.size() * (p + 1) / pieces;
+        vector<pair<uint64_t, Node*>> keyed;
+        keyed.reserve(to - from);
+        for(size_t i = from; i < to; i++) keyed.push_back({nodes[i]->sortKey, nodes[i]});
+        stable_sort(keyed.begin(), keyed.end(), [&](const pair<uint64_t, Node*>& a, const pair<uint64_t, Node*>& b){
+            return a.first != b.first ? a.first < b.first : less(*a.second, *b.second);
+        });
+        for(size_t i = 0; i < keyed.size(); i++){
+            nodes[from + i] = keyed[i].second;
+            if(i + 1 == keyed.size()) break;
+            keyed[i].second->next = keyed[i+1].second;
+            keyed[i+1].second->prev = keyed[i].second;
+        }
+        runs[p].first = keyed.front().second;
+        runs[p].last = keyed.back().second;
+        runs[p].last->next = nullptr;
+    }, threads);
+    while(runs.size() > 1){
+        vector<SortRun<Node>> merged((runs.size() + 1) / 2);
+        Node** order = merged.size() == 1 ? nodes.data() : nullptr;     // the last merge tells the order
+        parallelFor(merged.size(), [&](size_t i){
+            merged[i] = 2*i + 1 < runs.size() ? mergeSortedRuns(runs[2*i], runs[2*i + 1], less, order) : runs[2*i];
+        }, threads);
+        runs.swap(merged);
+    }
+    runs[0].first->prev = nullptr;
+    return runs[0];
+}
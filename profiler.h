@@ -0,0 +1,211 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+
+// Scoped timers for the per-frame hot paths. Each thread records into a ring
+// of its own, so a timed section costs two clock reads and a few relaxed
+// stores and never takes a lock; while profiling is off it costs one relaxed
+// load. Build with SOUNDLIST_NO_PROFILER to compile the timers out.
+
+struct ProfileEvent{
+    const char* name;   // string literal of the section
+    uint64_t start;     // ns since the profiler started
+    uint64_t end;
+};
+
+// Single-writer ring of the latest events of one thread. Every slot carries
+// the number of the event in it, so a reader can tell a slot the writer was
+// overwriting while it read apart from a good one.
+class ProfileRing{
+public:
+    static constexpr size_t SIZE = 1 << 14;    // events kept per thread
+
+    string thread;
+    int tid;
+
+    ProfileRing(string name, int id) : thread(move(name)), tid(id), slots(new Slot[SIZE]){}
+
+    void push(const char* name, uint64_t start, uint64_t end){
+        size_t i = count.load(memory_order_relaxed);
+        Slot& s = slots[i & (SIZE-1)];
+        s.seq.store(0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        s.name.store(name, memory_order_relaxed);
+        s.start.store(start, memory_order_relaxed);
+        s.end.store(end, memory_order_relaxed);
+        s.seq.store(i + 1, memory_order_release);
+        count.store(i + 1, memory_order_release);
+    }
+
+    // Appends the events that ended at or after since, oldest first
+    void read(uint64_t since, vector<ProfileEvent>& out) const{
+        size_t n = count.load(memory_order_acquire);
+        for(size_t i = n > SIZE ? n - SIZE : 0; i < n; i++){
+            const Slot& s = slots[i & (SIZE-1)];
+            uint64_t seq = s.seq.load(memory_order_acquire);
+            ProfileEvent e{s.name.load(memory_order_relaxed), s.start.load(memory_order_relaxed),
+                           s.end.load(memory_order_relaxed)};
+            atomic_thread_fence(memory_order_acquire);
+            if(seq != i + 1 || s.seq.load(memory_order_relaxed) != seq) continue;  // lapped by the writer
+            if(e.end >= since) out.push_back(e);
+        }
+    }
+
+private:
+    struct Slot{
+        atomic<uint64_t> seq{0};    // event number + 1, 0 while being written
+        atomic<const char*> name{nullptr};
+        atomic<uint64_t> start{0}, end{0};
+    };
+    unique_ptr<Slot[]> slots;
+    atomic<size_t> count{0};
+};
+
+// p50/p99 of one section over the stats window
+struct SectionStats{
+    string name;
+    int calls;
+    float p50, p99, worst;  // ms
+};
+
+class Profiler{
+public:
+    static Profiler& get(){
+        static Profiler p;
+        return p;
+    }
+
+    atomic<bool> enabled{false};
+
+    uint64_t now() const{
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    void record(const char* name, uint64_t start, uint64_t end){ ring().push(name, start, end); }
+
+    // Label for this thread in the overlay and trace; call before its first section
+    static void nameThread(const char* name){ threadName() = name; }
+
+    // Per-section percentiles over the last windowSec, slowest p99 first
+    vector<SectionStats> stats(float windowSec){
+        uint64_t t = now(), span = (uint64_t)(windowSec * 1e9f);
+        vector<ProfileEvent> events;
+        for(const ProfileRing* r : snapshotRings()) r->read(t > span ? t - span : 0, events);
+        unordered_map<string, vector<float>> times;
+        for(const ProfileEvent& e : events) times[e.name].push_back((e.end - e.start) / 1e6f);
+        vector<SectionStats> out;
+        for(auto& kv : times){
+            vector<float>& v = kv.second;
+            sort(v.begin(), v.end());
+            out.push_back({kv.first, (int)v.size(), v[v.size() / 2], v[min(v.size() - 1, v.size() * 99 / 100)], v.back()});
+        }
+        sort(out.begin(), out.end(), [](const SectionStats& a, const SectionStats& b){ return a.p99 > b.p99; });
+        return out;
+    }
+
+    // Everything still in the rings as Chrome trace JSON (chrome://tracing,
+    // Perfetto): one complete event per section, one track per thread
+    bool writeTrace(const string& path){
+        FILE* f = fopen(path.c_str(), "w");
+        if(!f) return false;
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        vector<ProfileEvent> events;
+        for(const ProfileRing* r : snapshotRings()){
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", r->tid, r->thread.c_str());
+            first = false;
+            events.clear();
+            r->read(0, events);
+            for(const ProfileEvent& e : events)
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        e.name, r->tid, e.start / 1e3, (e.end - e.start) / 1e3);
+        }
+        fprintf(f, "\n]}\n");
+        bool ok = ferror(f) == 0;
+        return fclose(f) == 0 && ok;
+    }
+
+private:
+    chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+    mutex m;        // guards rings, taken once per thread and by readers
+    vector<unique_ptr<ProfileRing>> rings;  // kept after their thread ends, for the trace
+
+    static const char*& threadName(){
+        static thread_local const char* name = nullptr;
+        return name;
+    }
+
+    ProfileRing& ring(){
+        static thread_local ProfileRing* mine = nullptr;
+        if(!mine){
+            lock_guard<mutex> lock(m);
+            int tid = (int)rings.size() + 1;
+            const char* name = threadName();
+            rings.emplace_back(new ProfileRing(name ? name : "thread " + to_string(tid), tid));
+            mine = rings.back().get();
+        }
+        return *mine;
+    }
+
+    vector<const ProfileRing*> snapshotRings(){
+        lock_guard<mutex> lock(m);
+        vector<const ProfileRing*> out;
+        for(auto& r : rings) out.push_back(r.get());
+        return out;
+    }
+};
+
+#ifndef SOUNDLIST_NO_PROFILER
+// Times the enclosing block under name, which must be a string literal.
+// next() closes the section and opens another, for code that runs as a
+// sequence of phases sharing locals.
+class ProfileScope{
+public:
+    explicit ProfileScope(const char* name) : name(name){
+        Profiler& p = Profiler::get();
+        on = p.enabled.load(memory_order_relaxed);
+        if(on) start = p.now();
+    }
+    ~ProfileScope(){
+        if(!on) return;
+        Profiler& p = Profiler::get();
+        p.record(name, start, p.now());
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    void next(const char* section){
+        Profiler& p = Profiler::get();
+        uint64_t t = on ? p.now() : 0;
+        if(on) p.record(name, start, t);
+        name = section;
+        on = p.enabled.load(memory_order_relaxed);
+        if(on) start = t ? t : p.now();
+    }
+
+private:
+    const char* name;
+    uint64_t start = 0;
+    bool on;
+};
+#else
+class ProfileScope{
+public:
+    explicit ProfileScope(const char*){}
+    void next(const char*){}
+};
+#endif
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
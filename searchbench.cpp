@@ -0,0 +1,85 @@
+// Times the trigram search against a plain substring scan on a generated
+// playlist. The scan is what the playlist did before the index: copy every
+// name out of the ring, then keep those containing the query, case folded.
+// Then times deleting a tenth of the songs from the index, compactions
+// included, and the same queries again.
+//
+//   searchbench [songs] [queries]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#define SOUNDLIST_NO_SFML
+#include "musicplayer.h"
+using namespace std;
+
+const int LIMIT = 50;          // rows the search panel asks for
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+static string lower(string s){
+    for(char& c : s) c = (char)tolower((unsigned char)c);
+    return s;
+}
+
+// The old way: every name copied out, then a case-insensitive find on each
+static size_t scan(MusicPlayer& p, const string& query){
+    vector<pair<string,bool>> songs;
+    for(node* n : p.visible(0, p.size)) songs.push_back({n->song, n == p.current});
+    string q = lower(query);
+    size_t found = 0;
+    for(auto& s : songs) found += lower(s.first).find(q) != string::npos;
+    return found;
+}
+
+int main(int argc, char** argv){
+    int songs = argc > 1 ? atoi(argv[1]) : 1000000;
+    int queries = argc > 2 ? atoi(argv[2]) : 20;
+
+    MusicPlayer p(unique_ptr<AudioBackend>(new NullBackend()));
+    mt19937 rng(7);
+    static const char* WORDS[] = {"love", "night", "blue", "fire", "home", "rain", "gold", "dream", "city", "heart",
+                                  "road", "light", "river", "storm", "dance", "echo"};
+    NodeChain chain;
+    for(int i = 0; i < songs; i++){
+        string name = "Artist " + to_string(rng() % 5000) + " - ";
+        for(int w = 0, words = 1 + rng() % 3; w < words; w++) name += string(w ? " " : "") + WORDS[rng() % 16];
+        chain.push(p.pool.alloc(name));
+    }
+    auto t = chrono::steady_clock::now();
+    p.spliceAt(0, chain);
+    printf("%d songs, indexed with the splice in %.1f ms\n", songs, msSince(t));
+
+    const char* QUERIES[] = {"love", "artist 42", "nite", "gold river", "dre", "zzz"};
+    auto timeQueries = [&](const char* when){
+        for(const char* q : QUERIES){
+            size_t hits = 0, matches = 0;
+            t = chrono::steady_clock::now();
+            for(int i = 0; i < queries; i++) hits = p.find(q, LIMIT).size();
+            double indexed = msSince(t) / queries;
+            t = chrono::steady_clock::now();
+            for(int i = 0; i < queries; i++) matches = scan(p, q);
+            double scanned = msSince(t) / queries;
+            printf("  %-8s %-12s index %8.3f ms (%zu shown), substring scan %8.2f ms (%zu match)\n", when,
+                   ("\"" + string(q) + "\"").c_str(), indexed, hits, scanned, matches);
+        }
+    };
+    timeQueries("before");
+
+    vector<node*> all;
+    for(node* n : p.visible(0, p.size)) all.push_back(n);
+    shuffle(all.begin(), all.end(), rng);
+    all.resize(songs / 10);
+    t = chrono::steady_clock::now();
+    for(node* n : all) p.search.remove(n->id, n->song);
+    double removed = msSince(t);
+    printf("  removed %zu songs from the index in %.1f ms, %.2f us each\n", all.size(), removed, removed * 1e3 / all.size());
+    // the ring still holds them, so the scan keeps finding them; the index does not
+    timeQueries("after");
+    return 0;
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cctype>
+using namespace std;
+
+// Trigram inverted index over song names, keyed by NodePool handle.
+// Every word start is padded with two markers, so "ab" matches names with a
+// word beginning "ab" and full-word prefixes rank above mid-word hits.
+// Overlap counting makes it typo tolerant: one wrong letter costs at most
+// three of the query's trigrams.
+class SearchIndex{
+public:
+    struct Match{
+        uint32_t handle;
+        float score;
+    };
+
+    // Posting lists stay sorted by handle so big lists can be probed by
+    // galloping search; fresh handles are nearly always the largest, so this is
+    // an append in the common case
+    void add(uint32_t h, const string& name){
+        if(h >= hits.size()){ hits.resize(h + 1, 0); live.resize(h + 1, false); }
+        auto old = removedNames.find(h);
+        if(old != removedNames.end()){ purge(h, old->second); removedNames.erase(old); }
+        for(uint32_t g : grams(name)){
+            Posting& p = postings[g];
+            vector<uint32_t>& list = p.handles;
+            if(list.empty() || list.back() < h) list.push_back(h);
+            else list.insert(upper_bound(list.begin(), list.end(), h), h);
+            if(!p.bits.empty()){
+                if(h / 64 >= p.bits.size()) p.bits.resize(h / 64 + 1, 0);
+                p.bits[h / 64] |= 1ull << (h % 64);
+            }
+            entries++;
+        }
+        live[h] = true;
+    }
+
+    // Only marks h dead: its entries stay in the lists, skipped by queries,
+    // until they are a DEAD_FRACTION of all entries and every list is
+    // compacted in one pass. A handle added again before that drops its old
+    // entries first, so a reused slot never matches its old name.
+    void remove(uint32_t h, const string& name){
+        if(h >= live.size() || !live[h]) return;
+        live[h] = false;
+        removedNames.emplace(h, name);
+        dead += grams(name).size();
+        if(dead > entries * DEAD_FRACTION) compact();
+    }
+
+    void clear(){
+        postings.clear();
+        hits.clear();
+        live.clear();
+        removedNames.clear();
+        entries = dead = 0;
+    }
+
+    // Best matches for query, highest score first. nameOf(handle) returns the
+    // song name so candidates can be re-ranked on the real text.
+    template<class NameOf>
+    vector<Match> query(const string& q, size_t limit, NameOf nameOf){
+        vector<Match> out;
+        vector<uint32_t> qg = grams(q);
+        if(qg.empty()) return out;
+
+        // rarest trigrams first: small lists seed the candidate set, big ones
+        // are only probed for candidates already found
+        vector<Posting*> lists;
+        for(uint32_t g : qg){
+            auto it = postings.find(g);
+            if(it != postings.end()) lists.push_back(&it->second);
+        }
+        if(lists.empty()) return out;
+        sort(lists.begin(), lists.end(), [](const Posting* a, const Posting* b){ return a->handles.size() < b->handles.size(); });
+
+        // A rarest list longer than the cap is sampled at an even stride, so
+        // the seeds spread over the whole playlist instead of its oldest songs
+        size_t seedCap = max<size_t>(limit * 32, 1024);
+        touched.clear();
+        bool sorted = true;
+        for(Posting* p : lists){
+            const vector<uint32_t>* list = &p->handles;
+            if(touched.empty()){
+                size_t step = list->size() > seedCap ? list->size() / seedCap : 1;
+                for(size_t i = 0; i < list->size(); i += step){
+                    uint32_t h = (*list)[i];
+                    if(!live[h]) continue;
+                    hits[h] = 1;
+                    touched.push_back(h);
+                }
+            } else if(list->size() <= SMALL_LIST && touched.size() < seedCap){
+                for(uint32_t h : *list){
+                    if(live[h] && hits[h]++ == 0){ touched.push_back(h); sorted = false; }
+                }
+            } else if(list->size() >= SMALL_LIST && list->size() * DENSE_SHARE >= hits.size()){
+                // a bit test per candidate: the list would be a cache miss per step
+                if(p->bits.empty()) fillBits(*p);
+                const vector<uint64_t>& bits = p->bits;
+                for(uint32_t h : touched) hits[h] += h / 64 < bits.size() && (bits[h / 64] >> (h % 64) & 1);
+            } else {
+                if(!sorted){ sort(touched.begin(), touched.end()); sorted = true; }
+                probe(*list);
+            }
+        }
+
+        // keep only the best overlaps before touching any name text: one
+        // wrong letter costs at most three trigrams, so anything further
+        // behind the best cannot outrank it
+        vector<pair<uint16_t,uint32_t>> cand;
+        cand.reserve(touched.size());
+        uint16_t best = 0;
+        for(uint32_t h : touched) best = max(best, hits[h]);
+        for(uint32_t h : touched){
+            if(hits[h] + 3 >= best) cand.push_back({hits[h], h});
+            hits[h] = 0;
+        }
+        size_t shortlist = limit * 4;
+        if(cand.size() > shortlist){
+            nth_element(cand.begin(), cand.begin() + shortlist, cand.end(), [](const pair<uint16_t,uint32_t>& a, const pair<uint16_t,uint32_t>& b){ return a.first > b.first; });
+            cand.resize(shortlist);
+        }
+
+        string lq = normalize(q), ln;
+        for(auto& c : cand){
+            const string* name = nameOf(c.second);
+            if(!name) continue;
+            ln.assign(*name);
+            lower(ln);
+            out.push_back({c.second, score(lq, ln, (float)c.first / qg.size())});
+        }
+        size_t k = min(limit, out.size());
+        partial_sort(out.begin(), out.begin() + k, out.end(), [](const Match& a, const Match& b){ return a.score > b.score; });
+        out.resize(k);
+        return out;
+    }
+
+private:
+    static constexpr size_t SMALL_LIST = 1 << 12;
+    static constexpr size_t DENSE_SHARE = 16;        // lists holding 1/16 of all handles get a bitmap
+    static constexpr unsigned char MARK = 1;
+    static constexpr double DEAD_FRACTION = 0.25;    // of all entries, before a compaction
+
+    struct Posting{
+        vector<uint32_t> handles;
+        vector<uint64_t> bits;   // the same handles as a bitmap, once a query found the list dense
+    };
+
+    unordered_map<uint32_t, Posting> postings;
+    vector<uint16_t> hits;       // per-handle overlap counter, zeroed after each query
+    vector<uint32_t> touched;
+    vector<bool> live;           // handle is in the index; dead ones still have entries
+    unordered_map<uint32_t, string> removedNames;   // dead handles with entries left
+    size_t entries = 0, dead = 0;
+
+    // Counts a hit for every touched handle in list. Both are sorted, so
+    // each lookup gallops on from where the last one stopped: O(touched *
+    // log gap) instead of a full binary search per handle.
+    void probe(const vector<uint32_t>& list){
+        auto at = list.begin();
+        for(uint32_t h : touched){
+            size_t gap = 1;
+            auto hi = at;
+            while(hi != list.end() && *hi < h){
+                at = hi;
+                hi = (size_t)(list.end() - hi) > gap ? hi + gap : list.end();
+                gap *= 2;
+            }
+            at = lower_bound(at, hi, h);
+            if(at == list.end()) return;
+            if(*at == h) hits[h]++;
+        }
+    }
+
+    // Sized for every handle so far; add grows it for later ones
+    void fillBits(Posting& p){
+        p.bits.assign(hits.size() / 64 + 1, 0);
+        for(uint32_t h : p.handles) p.bits[h / 64] |= 1ull << (h % 64);
+    }
+
+    // Drops every dead entry, one pass per list
+    void compact(){
+        for(auto it = postings.begin(); it != postings.end();){
+            vector<uint32_t>& list = it->second.handles;
+            vector<uint64_t>& bits = it->second.bits;
+            list.erase(remove_if(list.begin(), list.end(), [&](uint32_t h){
+                if(live[h]) return false;
+                if(!bits.empty()) bits[h / 64] &= ~(1ull << (h % 64));
+                return true;
+            }), list.end());
+            if(list.empty()) it = postings.erase(it);
+            else ++it;
+        }
+        entries -= dead;
+        dead = 0;
+        removedNames.clear();
+    }
+
+    // The old entries of a dead handle, right away
+    void purge(uint32_t h, const string& name){
+        for(uint32_t g : grams(name)){
+            auto it = postings.find(g);
+            if(it == postings.end()) continue;
+            vector<uint32_t>& list = it->second.handles;
+            auto pos = lower_bound(list.begin(), list.end(), h);
+            if(pos != list.end() && *pos == h){ list.erase(pos); entries--; dead--; }
+            if(!it->second.bits.empty()) it->second.bits[h / 64] &= ~(1ull << (h % 64));
+            if(list.empty()) postings.erase(it);
+        }
+    }
+
+    static void lower(string& s){
+        for(char& c : s) if(c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    }
+
+    static string normalize(const string& s){
+        string r = s;
+        lower(r);
+        return r;
+    }
+
+    static bool isWordChar(unsigned char c){ return c >= 128 || isalnum(c); }
+
+    static vector<uint32_t> grams(const string& s){
+        vector<uint32_t> out;
+        string n = normalize(s);
+        unsigned char a = MARK, b = MARK;
+        bool inWord = false;
+        for(unsigned char c : n){
+            if(!isWordChar(c)){ inWord = false; continue; }
+            if(!inWord){ a = b = MARK; inWord = true; }
+            out.push_back((uint32_t)a << 16 | (uint32_t)b << 8 | c);
+            a = b;
+            b = c;
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+
+    // Trigram overlap plus bonuses for where the query text actually appears
+    static float score(const string& q, const string& name, float overlap){
+        float s = overlap;
+        size_t at = name.find(q);
+        if(at == 0) s += 1.0f;
+        else if(at != string::npos) s += (!isWordChar((unsigned char)name[at-1])) ? 0.75f : 0.5f;
+        s -= min(0.25f, name.size() / 400.0f); // shorter names win ties
+        return s;
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <memory>
+#include <SFML/Audio.hpp>
+#include "audiobackend.h"
+#include "trackstream.h"
+using namespace std;
+
+// Real playback through the gapless TrackStream, with a worker prefetching
+// the upcoming track
+class SfmlBackend : public AudioBackend{
+public:
+    bool open(const string& path, uint32_t tag) override{
+        unique_ptr<PreparedTrack> t = prepared(path, tag);
+        if(!t) return false;
+        stream.start(move(t));
+        return true;
+    }
+
+    bool isOpen() const override{ return stream.isOpen(); }
+    void play() override{
+        stream.markRestart();
+        stream.play();
+    }
+    void pause() override{ stream.pause(); }
+    void stop() override{ stream.stop(); }
+
+    PlaybackStatus status() const override{
+        switch(stream.getStatus()){
+            case sf::SoundSource::Status::Playing: return PlaybackStatus::Playing;
+            case sf::SoundSource::Status::Paused:  return PlaybackStatus::Paused;
+            default:                               return PlaybackStatus::Stopped;
+        }
+    }
+
+    void seek(float seconds) override{ stream.setTrackOffset(sf::seconds(seconds)); }
+    float offset() const override{ return stream.trackOffset().asSeconds(); }
+    float duration() const override{ return stream.getDuration().asSeconds(); }
+    unsigned sampleRate() const override{ return stream.getSampleRate(); }
+
+    void setVolume(float v) override{ userVolume = v; applyVolume(); }
+    float volume() const override{ return userVolume; }
+    void setGain(float g) override{ gain = g; applyVolume(); }
+
+    void prefetch(const string& path, uint32_t tag) override{
+        if(!stream.isOpen() || stream.queuedTag() == tag) return;
+        if(stream.queuedTag() != NIL) stream.dropQueued(); // stale after next/prev/random
+        unique_ptr<PreparedTrack> t = prefetcher.take(tag);
+        if(t && t->path == path) stream.queue(move(t));
+        else prefetcher.request(path, tag);
+    }
+
+    uint32_t queuedTag() const override{ return stream.queuedTag(); }
+    void dropQueued() override{ stream.dropQueued(); }
+    bool pollTransition() override{ return stream.pollTransition(); }
+    void setTap(SampleTap* tap) override{ stream.setTap(tap); }
+
+    void setCrossfade(float seconds, FadeShape shape) override{ stream.setCrossfade(seconds, shape); }
+
+    bool crossfadeTo(const string& path, uint32_t tag) override{
+        if(!stream.canCrossfade()) return false;
+        unique_ptr<PreparedTrack> t = prepared(path, tag);
+        if(!t) return false;
+        stream.crossfadeTo(move(t));
+        return true;
+    }
+
+    unsigned long long underruns() const override{ return stream.underruns(); }
+
+private:
+    TrackStream stream;
+    Prefetcher prefetcher;
+    float userVolume = 100;
+    float gain = 1;
+
+    // The queued or prefetched track when it is the one asked for, else opened now
+    unique_ptr<PreparedTrack> prepared(const string& path, uint32_t tag){
+        unique_ptr<PreparedTrack> t = stream.takeQueued();
+        if(!t || t->tag != tag || t->path != path) t = prefetcher.take(tag);
+        if(!t || t->path != path) t = PreparedTrack::open(path, tag);
+        return t;
+    }
+
+    // OpenAL may clamp gains above one, so boosts stop at full volume
+    void applyVolume(){ stream.setVolume(min(100.0f, userVolume * gain)); }
+};
@@ -0,0 +1,203 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// xoshiro128** — small, fast, good enough for picking songs
+struct ShuffleRng{
+    uint32_t s[4];
+
+    explicit ShuffleRng(uint64_t seed = 0x9E3779B97F4A7C15ull){
+        for(int i = 0; i < 4; i++){   // splitmix64 to spread the seed
+            seed += 0x9E3779B97F4A7C15ull;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            s[i] = (uint32_t)(z ^ (z >> 31));
+        }
+    }
+
+    static uint32_t rotl(uint32_t x, int k){ return (x << k) | (x >> (32 - k)); }
+
+    uint32_t next(){
+        uint32_t r = rotl(s[1] * 5, 7) * 9;
+        uint32_t t = s[1] << 9;
+        s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 11);
+        return r;
+    }
+
+    // Unbiased value in [0, n) — Lemire's multiply-and-reject
+    uint32_t below(uint32_t n){
+        uint64_t m = (uint64_t)next() * n;
+        uint32_t low = (uint32_t)m;
+        if(low < n){
+            uint32_t floor = (0u - n) % n;
+            while(low < floor){ m = (uint64_t)next() * n; low = (uint32_t)m; }
+        }
+        return (uint32_t)(m >> 32);
+    }
+};
+
+// Shuffled play order over NodePool handles, generated one pick at a time.
+// order[0, generated) is the history of this cycle, order[generated, end) the
+// songs not yet picked; each pick is one Fisher–Yates step. Adding a song
+// appends it to the unpicked part, deleting an unpicked song is a swap-pop,
+// and deleting a played one leaves a tombstone that is skipped and swept out
+// when the cycle wraps. A song is never picked again within `window` picks:
+// unpicked songs heard that recently sit in the last `held` slots, outside
+// the range picks are drawn from, until they age out.
+class ShuffleOrder{
+public:
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+
+    int window = 16;
+    unsigned long long picks = 0;
+
+    void seed(uint64_t s){ rng = ShuffleRng(s); }
+
+    void add(uint32_t h){
+        grow(h);
+        lastPick[h] = 0;
+        where[h] = (uint32_t)order.size();
+        order.push_back(h);
+        if(held) swapTo(order.size() - 1, order.size() - 1 - held);    // in front of the held songs
+        live++;
+    }
+
+    void remove(uint32_t h){
+        if(h >= where.size() || where[h] == NIL) return;
+        uint32_t i = where[h];
+        live--;
+        if(i >= generated){
+            size_t heldAt = order.size() - held;
+            if(i < heldAt) swapTo(i, heldAt - 1);   // the gap moves to the end of the pickable songs,
+            else held--;
+            swapTo(where[h], order.size() - 1);     // then past the held ones
+            order.pop_back();
+            where[h] = NIL;
+        } else {
+            where[h] = NIL;
+            order[i] = NIL;   // keep history positions stable
+        }
+    }
+
+    void clear(){
+        order.clear();
+        where.clear();
+        lastPick.clear();
+        generated = 0;
+        cursor = -1;
+        live = 0;
+        held = 0;
+    }
+
+    // Makes h the start of a fresh cycle so shuffle continues from the current song
+    void startAt(uint32_t h){
+        wrap();
+        if(h < where.size() && where[h] != NIL){
+            swapTo(0, where[h]);
+            generated = 1;
+            cursor = 0;
+            stamp(h);
+        }
+    }
+
+    // Handle that next() will return, generated now if needed
+    uint32_t peek(){
+        if(live == 0) return NIL;
+        long long c = cursor + 1;
+        while(true){
+            while(c < (long long)generated && order[c] == NIL) c++;
+            if(c < (long long)generated) return order[c];
+            if(generated == order.size()){
+                wrap();
+                c = 0;
+                continue;
+            }
+            generate();
+        }
+    }
+
+    uint32_t next(){
+        uint32_t h = peek();
+        if(h == NIL) return NIL;
+        cursor = where[h];
+        stamp(h);
+        return h;
+    }
+
+    // Steps back through this cycle's history, NIL at its start
+    uint32_t prev(){
+        long long c = cursor - 1;
+        while(c >= 0 && order[c] == NIL) c--;
+        if(c < 0) return NIL;
+        cursor = c;
+        return order[c];
+    }
+
+private:
+    ShuffleRng rng;
+    vector<uint32_t> order;
+    vector<uint32_t> where;                 // handle -> slot in order
+    vector<unsigned long long> lastPick;    // handle -> pick serial, 0 = never
+    size_t generated = 0;
+    long long cursor = -1;
+    size_t live = 0;
+    size_t held = 0;                        // recently heard songs at the end of order
+
+    void grow(uint32_t h){
+        if(h >= where.size()){
+            where.resize(h + 1, NIL);
+            lastPick.resize(h + 1, 0);
+        }
+    }
+
+    void swapTo(size_t i, size_t j){
+        swap(order[i], order[j]);
+        if(order[i] != NIL) where[order[i]] = (uint32_t)i;
+        if(order[j] != NIL) where[order[j]] = (uint32_t)j;
+    }
+
+    void stamp(uint32_t h){ lastPick[h] = ++picks; }
+
+    bool recent(uint32_t h) const{
+        int w = min<long long>(window, (long long)live - 1);
+        return w > 0 && lastPick[h] && picks - lastPick[h] < (unsigned long long)w;
+    }
+
+    // One Fisher–Yates step over the songs not held back. Held songs that
+    // aged out rejoin them first, at most `window` checks.
+    void generate(){
+        for(size_t k = order.size() - held; k < order.size(); k++){
+            if(recent(order[k])) continue;
+            swapTo(k, order.size() - held);
+            held--;
+        }
+        if(order.size() - held == generated){
+            // only recent songs left: the one heard longest ago goes back
+            size_t oldest = generated;
+            for(size_t k = generated; k < order.size(); k++) if(lastPick[order[k]] < lastPick[order[oldest]]) oldest = k;
+            swapTo(oldest, generated);
+            held--;
+        }
+        uint32_t n = (uint32_t)(order.size() - held - generated);
+        swapTo(generated, generated + rng.below(n));
+        generated++;
+    }
+
+    // New cycle: sweep tombstones, everything becomes unpicked again except
+    // the songs heard last, which are held back
+    void wrap(){
+        order.erase(std::remove(order.begin(), order.end(), NIL), order.end());
+        held = 0;
+        for(size_t i = order.size(); i-- > 0;){
+            if(recent(order[i])) swap(order[i], order[order.size() - ++held]);
+        }
+        for(size_t i = 0; i < order.size(); i++) where[order[i]] = (uint32_t)i;
+        generated = 0;
+        cursor = -1;
+    }
+};
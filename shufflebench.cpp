@@ -0,0 +1,60 @@
+// Times ShuffleOrder at 20, 10k, 100k and 1M songs: picks per second over a
+// few whole cycles (wraps and held back recent songs included), then the
+// cost of an update, a delete of a random song and an add, while picks go
+// on. Also counts how often a song came back within the no-repeat window.
+//
+//   shufflebench [window]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include "shuffle.h"
+using namespace std;
+
+const int CYCLES = 3;
+const int UPDATES = 200000;
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+int main(int argc, char** argv){
+    int window = argc > 1 ? atoi(argv[1]) : 16;
+    mt19937 rng(7);
+
+    for(uint32_t songs : {20u, 10000u, 100000u, 1000000u}){
+        ShuffleOrder s;
+        s.seed(songs);
+        s.window = window;
+        for(uint32_t h = 0; h < songs; h++) s.add(h);
+
+        vector<unsigned long long> last(songs, 0);
+        size_t repeats = 0;
+        auto check = [&](uint32_t h){
+            if(last[h] && s.picks - last[h] < (unsigned long long)window) repeats++;
+            last[h] = s.picks;
+        };
+        auto t = chrono::steady_clock::now();
+        for(uint64_t i = 0; i < (uint64_t)songs * CYCLES; i++) check(s.next());
+        double picked = msSince(t);
+
+        // every update paired with a pick, the song deleted added back under a new handle
+        vector<uint32_t> handles(songs);
+        for(uint32_t h = 0; h < songs; h++) handles[h] = h;
+        last.resize(songs + UPDATES, 0);
+        t = chrono::steady_clock::now();
+        for(int i = 0; i < UPDATES; i++){
+            uint32_t& h = handles[rng() % songs];
+            s.remove(h);
+            h = songs + i;
+            s.add(h);
+            check(s.next());
+        }
+        double updated = msSince(t);
+
+        printf("%8u songs  %6.1f M picks/s, delete + add + pick %6.3f us, %zu picks within the window of %d\n", songs,
+               songs * CYCLES / picked / 1e3, updated * 1e3 / UPDATES, repeats, window);
+    }
+    return 0;
+}
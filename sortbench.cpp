@@ -0,0 +1,128 @@
+// Times MusicPlayer::sortBy on a large generated playlist: per key, a cold
+// sort of the list as loaded (keys fetched), a resort of a shuffled list
+// with the keys cached, and a sort of a list already in order. Then the
+// sort alone three ways (sortBy's pieces sorted as arrays then merged as
+// lists, a merge sort all along next, and copying the nodes out to a
+// vector, std::stable_sort and relinking), from load order and from a shuffle: a
+// shuffled ring is what a playlist sorted once before looks like in memory.
+// Loudness is left out, it needs measured files.
+//
+//   sortbench [songs] [threads]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#define SOUNDLIST_NO_SFML
+#include "musicplayer.h"
+using namespace std;
+
+static double msSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t).count();
+}
+
+// Puts the ring back in the order of nodes, the way the journal replays ORDER
+static void relink(MusicPlayer& p, const vector<node*>& nodes){
+    size_t n = nodes.size();
+    for(size_t i = 0; i < n; i++){
+        nodes[i]->next = nodes[(i + 1) % n];
+        nodes[i]->prev = nodes[(i + n - 1) % n];
+    }
+    p.head = nodes[0];
+    p.index.rebuild(nodes);
+}
+
+int main(int argc, char** argv){
+    int songs = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : 0;
+    if(!threads) threads = workerCount();
+
+    MusicPlayer p(unique_ptr<AudioBackend>(new NullBackend()));
+    mt19937 rng(7);
+    static const char* WORDS[] = {"love", "night", "blue", "fire", "home", "rain", "gold", "dream", "city", "heart",
+                                  "road", "light", "river", "storm", "dance", "echo"};
+    NodeChain chain;
+    vector<uint32_t> handles;
+    for(int i = 0; i < songs; i++){
+        string name = "Artist " + to_string(rng() % 5000) + " - ";
+        for(int w = 0, words = 1 + rng() % 3; w < words; w++) name += string(w ? " " : "") + WORDS[rng() % 16];
+        node* n = p.pool.alloc(name);
+        n->path = "/nonexistent/" + to_string(i) + ".wav";
+        n->duration = 60 + (rng() % 540000) / 1000.0f;
+        chain.push(n);
+        handles.push_back(n->id);
+    }
+    p.spliceAt(0, chain, false);
+    p.history.reset(handles);
+    vector<node*> original;
+    for(node* n : p.visible(0, p.size)) original.push_back(n);
+    vector<node*> shuffled = original;
+    shuffle(shuffled.begin(), shuffled.end(), rng);
+    printf("%d songs, %u thread(s)\n", songs, threads);
+
+    const char* SPECS[] = {"name", "duration", "-duration,name", "date,name"};
+    for(const char* spec : SPECS){
+        relink(p, original);
+        auto t = chrono::steady_clock::now();
+        p.sortBy(spec);
+        double cold = msSince(t);
+        relink(p, shuffled);
+        t = chrono::steady_clock::now();
+        p.sortBy(spec);
+        double warm = msSince(t);
+        t = chrono::steady_clock::now();
+        p.sortBy(spec);
+        double again = msSince(t);
+        printf("  sortBy(%-15s) cold %7.1f ms, resort %7.1f ms, already sorted %6.1f ms\n", ("\"" + string(spec) + "\"").c_str(),
+               cold, warm, again);
+    }
+
+    // the sort alone, same comparator and input both ways
+    vector<SortField> fields;
+    for(const char* spec : {"name", "duration"})
+    for(const vector<node*>* from : {&original, &shuffled}){
+        parseSortSpec(spec, fields);
+        SongOrder order = p.sortOrder(fields, original);
+
+        // what sortBy does: pieces sorted as arrays, merged as lists
+        relink(p, *from);
+        auto t = chrono::steady_clock::now();
+        vector<node*> listed = *from;
+        SortRun<node> run = parallelSortList(listed, order, threads);
+        run.first->prev = run.last;
+        run.last->next = run.first;
+        p.head = run.first;
+        p.index.rebuild(listed);
+        double hybrid = msSince(t);
+
+        // everything along next
+        relink(p, *from);
+        t = chrono::steady_clock::now();
+        p.head->prev->next = nullptr;
+        run = mergeSortList(p.head, order);
+        run.first->prev = run.last;
+        run.last->next = run.first;
+        p.head = run.first;
+        vector<node*> walked;
+        walked.reserve(p.size);
+        for(node* n = p.head; walked.size() < (size_t)p.size; n = n->next) walked.push_back(n);
+        p.index.rebuild(walked);
+        double inList = msSince(t);
+
+        relink(p, *from);
+        t = chrono::steady_clock::now();
+        vector<node*> v;
+        v.reserve(p.size);
+        for(node* n : p.visible(0, p.size)) v.push_back(n);
+        stable_sort(v.begin(), v.end(), [&](const node* a, const node* b){ return order(*a, *b); });
+        relink(p, v);
+        double copied = msSince(t);
+        bool same = v == listed && v == walked;
+
+        printf("  %-8s from %-7s pieces + list merge %7.1f ms, list merge sort %7.1f ms, vector stable_sort + relink %7.1f ms%s\n",
+               spec, from == &original ? "load" : "shuffle", hybrid, inList, copied, same ? "" : "  ORDER DIFFERS");
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUNDLIST_FFT_SSE 1
+#endif
+using namespace std;
+
+// Where the audio thread drops what it hands to the device. Single producer,
+// never blocks: it keeps the most recent samples as a mono mix and the reader
+// copies out a window, retrying if the producer lapped it meanwhile. Devices
+// buffer ahead, so the producer also says how many frames are still queued
+// in front of the speaker and the reader lines the window up with what is
+// audible right now.
+class SampleTap{
+public:
+    static constexpr size_t CAPACITY = 1 << 16;   // ~1.4 s at 48 kHz
+
+    atomic<unsigned> sampleRate{0};
+
+    SampleTap() : ring(CAPACITY){}
+
+    // interleaved: count samples, channels per frame
+    void push(const int16_t* samples, size_t count, unsigned channels, unsigned rate, uint64_t latencyFrames = 0){
+        if(!channels) return;
+        uint64_t w = written.load(memory_order_relaxed);
+        float scale = 1.0f / (32768.0f * channels);
+        for(size_t i = 0; i + channels <= count; i += channels){
+            int sum = 0;
+            for(unsigned c = 0; c < channels; c++) sum += samples[i + c];
+            ring[w++ & (CAPACITY-1)].store(sum * scale, memory_order_relaxed);
+        }
+        sampleRate.store(rate, memory_order_relaxed);
+        lag.store(min<uint64_t>(latencyFrames, CAPACITY / 2), memory_order_relaxed);
+        pushedAt.store(nowNs(), memory_order_relaxed);
+        written.store(w, memory_order_release);
+    }
+
+    // The n samples ending at the audible position; stamp identifies that
+    // position. False if there is not enough yet or the producer overwrote
+    // them while copying.
+    bool latest(float* out, size_t n, uint64_t& stamp) const{
+        uint64_t w = written.load(memory_order_acquire);
+        uint64_t l = lag.load(memory_order_relaxed);
+        double since = (nowNs() - pushedAt.load(memory_order_relaxed)) * 1e-9;
+        uint64_t heard = min<uint64_t>(l, (uint64_t)(max(0.0, since) * sampleRate.load(memory_order_relaxed)));
+        uint64_t end = w - l + heard;
+        stamp = end;
+        if(end < n || n > CAPACITY / 2 || w < l) return false;
+        uint64_t from = end - n;
+        for(size_t i = 0; i < n; i++) out[i] = ring[(from + i) & (CAPACITY-1)].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        return written.load(memory_order_relaxed) - from <= CAPACITY;
+    }
+
+private:
+    vector<atomic<float>> ring;   // relaxed: a torn window is detected and dropped
+    atomic<uint64_t> written{0};
+    atomic<uint64_t> lag{0};
+    atomic<int64_t> pushedAt{0};
+
+    static int64_t nowNs(){
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// In-place radix-2 FFT over split real/imaginary arrays. Twiddles are stored
+// per stage and contiguously, so every butterfly pass from width 8 up runs
+// four lanes at a time on SSE; the first passes and other targets use the
+// scalar loop, which is also kept as the reference.
+class Fft{
+public:
+    static constexpr double PI = 3.14159265358979323846;
+
+    explicit Fft(size_t n = 2048) : n(n), rev(n){
+        int bits = 0;
+        while(((size_t)1 << bits) < n) bits++;
+        for(size_t i = 0; i < n; i++){
+            size_t r = 0;
+            for(int b = 0; b < bits; b++) if(i >> b & 1) r |= (size_t)1 << (bits - 1 - b);
+            rev[i] = (uint32_t)r;
+        }
+        // stage with half-width h keeps its h twiddles at offset h-1
+        wr.resize(n);
+        wi.resize(n);
+        for(size_t h = 1; h < n; h <<= 1)
+            for(size_t j = 0; j < h; j++){
+                double a = -PI * (double)j / (double)h;
+                wr[h - 1 + j] = (float)cos(a);
+                wi[h - 1 + j] = (float)sin(a);
+            }
+    }
+
+    size_t size() const{ return n; }
+
+    void transform(float* re, float* im) const{
+        permute(re, im);
+#ifdef SOUNDLIST_FFT_SSE
+        size_t h = 1;
+        for(; h < 4 && h < n; h <<= 1) pass(re, im, h);
+        for(; h < n; h <<= 1) passSse(re, im, h);
+#else
+        for(size_t h = 1; h < n; h <<= 1) pass(re, im, h);
+#endif
+    }
+
+    void transformScalar(float* re, float* im) const{
+        permute(re, im);
+        for(size_t h = 1; h < n; h <<= 1) pass(re, im, h);
+    }
+
+private:
+    size_t n;
+    vector<uint32_t> rev;
+    vector<float> wr, wi;
+
+    void permute(float* re, float* im) const{
+        for(size_t i = 0; i < n; i++){
+            size_t r = rev[i];
+            if(r > i){ swap(re[i], re[r]); swap(im[i], im[r]); }
+        }
+    }
+
+    void pass(float* re, float* im, size_t h) const{
+        const float* cr = &wr[h - 1];
+        const float* ci = &wi[h - 1];
+        for(size_t s = 0; s < n; s += 2*h)
+            for(size_t j = 0; j < h; j++){
+                size_t a = s + j, b = a + h;
+                float tr = re[b]*cr[j] - im[b]*ci[j];
+                float ti = re[b]*ci[j] + im[b]*cr[j];
+                re[b] = re[a] - tr;  im[b] = im[a] - ti;
+                re[a] += tr;         im[a] += ti;
+            }
+    }
+
+#ifdef SOUNDLIST_FFT_SSE
+    void passSse(float* re, float* im, size_t h) const{
+        const float* cr = &wr[h - 1];
+        const float* ci = &wi[h - 1];
+        for(size_t s = 0; s < n; s += 2*h)
+            for(size_t j = 0; j < h; j += 4){
+                size_t a = s + j, b = a + h;
+                __m128 c = _mm_loadu_ps(cr + j), d = _mm_loadu_ps(ci + j);
+                __m128 br = _mm_loadu_ps(re + b), bi = _mm_loadu_ps(im + b);
+                __m128 ar = _mm_loadu_ps(re + a), ai = _mm_loadu_ps(im + a);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(br, c), _mm_mul_ps(bi, d));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(br, d), _mm_mul_ps(bi, c));
+                _mm_storeu_ps(re + b, _mm_sub_ps(ar, tr));
+                _mm_storeu_ps(im + b, _mm_sub_ps(ai, ti));
+                _mm_storeu_ps(re + a, _mm_add_ps(ar, tr));
+                _mm_storeu_ps(im + a, _mm_add_ps(ai, ti));
+            }
+    }
+#endif
+};
+
+// Turns the tap into BANDS log-spaced magnitudes (0..1, roughly -60..0 dB)
+// plus an overall level, about 60 times a second on its own thread. Results
+// are plain atomics: a reader may see bands from two neighbouring frames,
+// which is invisible on screen and keeps both sides lock-free.
+class SpectrumAnalyzer{
+public:
+    static constexpr int BANDS = 16;
+    static constexpr size_t WINDOW = 2048;
+
+    SampleTap tap;
+
+    SpectrumAnalyzer() : fft(WINDOW), window(WINDOW), in(WINDOW), re(WINDOW), im(WINDOW){
+        for(size_t i = 0; i < WINDOW; i++)
+            window[i] = 0.5f - 0.5f * (float)cos(2 * Fft::PI * i / (WINDOW - 1));   // Hann
+        worker = thread(&SpectrumAnalyzer::run, this);
+    }
+
+    ~SpectrumAnalyzer(){
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+    }
+
+    float band(int b) const{ return bands[b].load(memory_order_relaxed); }
+    float level() const{ return levelA.load(memory_order_relaxed); }
+
+    // One analysis step; the worker calls this every frame interval
+    void analyze(){
+        uint64_t stamp;
+        float target[BANDS] = {};
+        float lvl = 0;
+        if(tap.latest(in.data(), WINDOW, stamp) && stamp != lastStamp){
+            lastStamp = stamp;
+            unsigned rate = tap.sampleRate.load(memory_order_relaxed);
+            float sum = 0;
+            for(size_t i = 0; i < WINDOW; i++){
+                sum += in[i] * in[i];
+                re[i] = in[i] * window[i];
+                im[i] = 0;
+            }
+            fft.transform(re.data(), im.data());
+            lvl = toUnit(sqrt(sum / WINDOW));
+            if(rate != bandRate) layoutBands(rate);
+            // Hann has a coherent gain of 0.5, so a full-scale sine peaks at N/4
+            float norm = 4.0f / WINDOW;
+            for(int b = 0; b < BANDS; b++){
+                float peak = 0;
+                for(size_t k = edges[b]; k < edges[b+1]; k++) peak = max(peak, re[k]*re[k] + im[k]*im[k]);
+                target[b] = toUnit(sqrt(peak) * norm);
+            }
+        }
+        // fast attack, slow release, so bars fall smoothly when playback stops
+        for(int b = 0; b < BANDS; b++){
+            float v = smooth[b];
+            v = target[b] > v ? target[b] : v * DECAY;
+            smooth[b] = v;
+            bands[b].store(v, memory_order_relaxed);
+        }
+        smoothLevel = lvl > smoothLevel ? lvl : smoothLevel * DECAY;
+        levelA.store(smoothLevel, memory_order_relaxed);
+    }
+
+private:
+    static constexpr float DECAY = 0.85f;
+    static constexpr float FLOOR_DB = -60.0f;
+
+    Fft fft;
+    vector<float> window, in, re, im;
+    size_t edges[BANDS + 1] = {};
+    unsigned bandRate = 0;
+    uint64_t lastStamp = 0;
+    float smooth[BANDS] = {};
+    float smoothLevel = 0;
+    atomic<float> bands[BANDS] = {};
+    atomic<float> levelA{0};
+
+    thread worker;
+    mutex m;
+    condition_variable cv;
+    bool quit = false;
+
+    static float toUnit(float amp){
+        if(amp <= 0) return 0;
+        float db = 20.0f * log10f(amp);
+        return max(0.0f, min(1.0f, (db - FLOOR_DB) / -FLOOR_DB));
+    }
+
+    // 40 Hz .. 16 kHz (or Nyquist) split evenly on a log scale, at least one bin each
+    void layoutBands(unsigned rate){
+        bandRate = rate;
+        double nyq = rate ? rate / 2.0 : 24000.0;
+        double lo = 40.0, hi = min(16000.0, nyq);
+        double binHz = 2 * nyq / WINDOW;
+        size_t last = WINDOW / 2;
+        edges[0] = max<size_t>(1, (size_t)(lo / binHz));
+        for(int b = 1; b <= BANDS; b++){
+            size_t e = (size_t)(lo * pow(hi / lo, (double)b / BANDS) / binHz);
+            edges[b] = min(last, max(e, edges[b-1] + 1));
+        }
+    }
+
+    void run(){
+        unique_lock<mutex> lock(m);
+        auto nextAt = chrono::steady_clock::now();
+        while(!quit){
+            nextAt += chrono::microseconds(16667);
+            if(cv.wait_until(lock, nextAt, [this]{ return quit; })) return;
+            lock.unlock();
+            analyze();
+            lock.lock();
+            auto now = chrono::steady_clock::now();
+            if(now > nextAt + chrono::milliseconds(100)) nextAt = now;   // don't burst after a stall
+        }
+    }
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+using namespace std;
+
+inline unsigned workerCount(){
+    unsigned n = thread::hardware_concurrency();
+    return n ? n : 4;
+}
+
+// Runs fn(i) for every i in [0, n) across all cores. Items are handed out
+// one at a time, so uneven work (big files next to small ones) still balances.
+template<class Fn>
+void parallelFor(size_t n, Fn fn, unsigned threads = 0){
+    if(n == 0) return;
+    if(!threads) threads = workerCount();
+    threads = (unsigned)min<size_t>(threads, n);
+    atomic<size_t> nextItem(0);
+    auto work = [&]{
+        for(size_t i = nextItem++; i < n; i = nextItem++) fn(i);
+    };
+    vector<thread> pool;
+    for(unsigned t = 1; t < threads; t++) pool.emplace_back(work);
+    work();
+    for(thread& t : pool) t.join();
+}
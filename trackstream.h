@@ -0,0 +1,516 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <SFML/Audio.hpp>
+#include "spectrum.h"
+#include "mappedwav.h"
+#include "mixer.h"
+#include "profiler.h"
+using namespace std;
+
+// An opened track ready to be spliced into the stream without touching the
+// disk on the audio thread. PCM WAV is memory-mapped with its first half
+// second already faulted in; anything else goes through an SFML decoder with
+// its first half second decoded into head.
+struct PreparedTrack{
+    unique_ptr<MappedWav> wav;
+    unique_ptr<sf::InputSoundFile> file;
+    vector<sf::Int16> head;   // pre-decoded leading samples (decoder only)
+    size_t headPos = 0;
+    string path;
+    uint32_t tag = 0;         // node handle this track was prepared for
+
+    static unique_ptr<PreparedTrack> open(const string& path, uint32_t tag){
+        unique_ptr<PreparedTrack> t(new PreparedTrack());
+        t->path = path;
+        t->tag = tag;
+        t->wav.reset(new MappedWav());
+        if(t->wav->open(path)){
+            t->wav->warm(t->wav->info.sampleRate / 2);
+            return t;
+        }
+        t->wav.reset();
+        t->file.reset(new sf::InputSoundFile());
+        if(!t->file->openFromFile(path)) return nullptr;
+        t->head.resize(t->file->getSampleRate() * t->file->getChannelCount() / 2);
+        t->head.resize((size_t)t->file->read(t->head.data(), t->head.size()));
+        return t;
+    }
+
+    unsigned channelCount() const{ return wav ? wav->info.channels : file->getChannelCount(); }
+    unsigned sampleRate() const{ return wav ? wav->info.sampleRate : file->getSampleRate(); }
+    float duration() const{ return wav ? wav->info.duration() : file->getDuration().asSeconds(); }
+
+    // Frames not yet read, counting the rest of the pre-decoded head
+    uint64_t remaining() const{
+        if(wav) return wav->frames() - wav->tell();
+        uint64_t left = (head.size() - headPos) + (file->getSampleCount() - file->getSampleOffset());
+        return left / channelCount();
+    }
+
+    // Copies count samples into out: the pre-decoded head first, then the source
+    size_t read(sf::Int16* out, size_t count){
+        if(wav) return wav->readFrames(out, count / wav->info.channels) * wav->info.channels;
+        size_t n = min(count, head.size() - headPos);
+        if(n){ memcpy(out, head.data() + headPos, n * sizeof(sf::Int16)); headPos += n; }
+        if(n < count) n += (size_t)file->read(out + n, count - n);
+        return n;
+    }
+
+    // Up to count samples, pointed to in the mapping when the data is already
+    // 16-bit, otherwise read into scratch
+    size_t next(sf::Int16* scratch, size_t count, const sf::Int16*& out){
+        if(wav && wav->direct()){
+            const int16_t* p;
+            size_t n = wav->view(count / wav->info.channels, p) * wav->info.channels;
+            out = p;
+            return n;
+        }
+        out = scratch;
+        return read(scratch, count);
+    }
+
+    void seek(sf::Time t){
+        headPos = head.size();
+        if(wav) wav->seekFrame((uint64_t)(max(0.0f, t.asSeconds()) * wav->info.sampleRate));
+        else file->seek(t);
+    }
+
+    bool sameFormat(const PreparedTrack& o) const{
+        return channelCount() == o.channelCount() && sampleRate() == o.sampleRate();
+    }
+};
+
+// A track as the stream plays it, in the stream's channel count and rate.
+// Tracks that already match go through untouched; any other is channel-mapped
+// and resampled by linear interpolation as it is pulled.
+class Voice{
+public:
+    static constexpr size_t BLOCK = 4096;   // source frames converted per refill
+
+    unique_ptr<PreparedTrack> track;
+
+    Voice(unique_ptr<PreparedTrack> t, unsigned rate, unsigned channels)
+        : track(move(t)), outRate(rate), outCh(channels), step((double)track->sampleRate() / rate){}
+
+    bool passthrough() const{ return track->sampleRate() == outRate && track->channelCount() == outCh; }
+
+    // Output frames still to come
+    uint64_t remaining() const{
+        if(passthrough()) return track->remaining();
+        double left = (double)track->remaining() + srcFrames - pos;
+        return left > 1 ? (uint64_t)((left - 1) / step) : 0;
+    }
+
+    // Up to frames output frames as floats in [-1, 1); fewer only at the end
+    size_t pull(float* out, size_t frames){
+        if(passthrough()){
+            raw.resize(frames * outCh);
+            const sf::Int16* p;
+            size_t n = track->next(raw.data(), raw.size(), p);
+            for(size_t i = 0; i < n; i++) out[i] = p[i] * (1.0f / 32768);
+            return n / outCh;
+        }
+        size_t done = 0;
+        for(; done < frames; done++, pos += step){
+            while((size_t)pos + 1 >= srcFrames) if(!refill()) return done;
+            size_t i = (size_t)pos;
+            float f = (float)(pos - i);
+            const float* x0 = &src[i * outCh];
+            const float* x1 = x0 + outCh;
+            for(unsigned c = 0; c < outCh; c++) out[done*outCh + c] = x0[c] + (x1[c] - x0[c]) * f;
+        }
+        return done;
+    }
+
+    void seek(sf::Time t){
+        track->seek(t);
+        srcFrames = 0;
+        pos = 0;
+    }
+
+private:
+    unsigned outRate, outCh;
+    double step;            // source frames per output frame
+    double pos = 0;         // read position in src, in source frames
+    size_t srcFrames = 0;
+    vector<sf::Int16> raw;
+    vector<float> src;      // converted source frames, outCh wide
+
+    // Keeps the last frame to interpolate from and converts the next block
+    bool refill(){
+        size_t keep = 0;
+        if(srcFrames){
+            memmove(src.data(), &src[(srcFrames - 1) * outCh], outCh * sizeof(float));
+            pos -= srcFrames - 1;
+            keep = 1;
+        }
+        unsigned inCh = track->channelCount();
+        raw.resize(BLOCK * inCh);
+        size_t got = track->read(raw.data(), raw.size()) / inCh;
+        srcFrames = keep;
+        if(!got) return false;
+        src.resize((keep + got) * outCh);
+        for(size_t i = 0; i < got; i++){
+            const sf::Int16* x = &raw[i * inCh];
+            float* y = &src[(keep + i) * outCh];
+            if(outCh == 1 && inCh > 1){
+                int sum = 0;
+                for(unsigned c = 0; c < inCh; c++) sum += x[c];
+                y[0] = sum * (1.0f / 32768) / inCh;
+            }
+            else{
+                // mono is copied to every channel; extra source channels are dropped
+                for(unsigned c = 0; c < outCh; c++)
+                    y[c] = inCh == 1 ? x[0] * (1.0f / 32768) : c < inCh ? x[c] * (1.0f / 32768) : 0.0f;
+            }
+        }
+        srcFrames = keep + got;
+        return true;
+    }
+};
+
+// Sound stream that plays one track and, when a next track has been queued,
+// continues into it inside the same audio callback — no gap, no reopen. With
+// a crossfade time set, the queued track fades in over the end of the playing
+// one instead, converted to the stream's format if it differs. Stream time
+// keeps running across a change, so the position inside the audible track is
+// measured from the sample where the new track started.
+class TrackStream : public sf::SoundStream{
+public:
+    static constexpr sf::Uint64 NO_SWITCH = ~0ull;
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+    static constexpr size_t FADE_STEP = 64;    // frames per linear piece of a curved fade
+
+    // the streaming thread must be gone before our members are
+    ~TrackStream(){ stop(); }
+
+    // Stops playback and makes t the active track
+    void start(unique_ptr<PreparedTrack> t){
+        stop();
+        lock_guard<mutex> lock(m);
+        unsigned ch = t->channelCount(), rate = t->sampleRate();
+        active.reset(new Voice(move(t), rate, ch));
+        incoming.reset();
+        pendingFade.reset();
+        queued.reset();
+        retired.reset();
+        queuedTagA = NIL;
+        buf.assign(rate * ch / 10, 0);
+        initialize(ch, rate);
+        delivered = 0;
+        base = 0;
+        switchAt = NO_SWITCH;
+        switchSilent = false;
+        durationSec = active->track->duration();
+        fadeTag = NIL;
+        opened = true;
+        restart = true;
+    }
+
+    bool isOpen() const{ return opened.load(); }
+
+    void queue(unique_ptr<PreparedTrack> t){
+        lock_guard<mutex> lock(m);
+        queued = move(t);
+        queuedTagA = queued ? queued->tag : NIL;
+    }
+
+    // Removes and returns the queued track, if any
+    unique_ptr<PreparedTrack> takeQueued(){
+        lock_guard<mutex> lock(m);
+        queuedTagA = NIL;
+        return move(queued);
+    }
+
+    void dropQueued(){ queue(nullptr); }
+
+    // Tag of the queued track, NIL when nothing is queued. Lock-free for the UI.
+    uint32_t queuedTag() const{ return queuedTagA.load(); }
+
+    // 0 seconds turns crossfading off and restores plain gapless splices
+    void setCrossfade(float seconds, FadeShape shape){
+        fadeSeconds = max(0.0f, seconds);
+        fadeShape = (int)shape;
+    }
+
+    bool canCrossfade() const{
+        return opened.load() && fadeSeconds.load() > 0 && getStatus() == sf::SoundSource::Status::Playing;
+    }
+
+    // Fades from what is playing into t, for a change the caller has already
+    // made (next, prev, a pick), so pollTransition will not report it
+    void crossfadeTo(unique_ptr<PreparedTrack> t){
+        lock_guard<mutex> lock(m);
+        // already fading into it on our own, but not heard yet: just keep quiet about it
+        if(fadeTag.load() == t->tag && fadePath == t->path && switchAt.load() != NO_SWITCH && !pendingFade){
+            switchSilent = true;
+            return;
+        }
+        pendingFade = move(t);
+    }
+
+    // Times the device was left waiting for data
+    unsigned long long underruns() const{ return underrunCount.load(); }
+
+    // Play after a pause: the time spent paused is not starvation
+    void markRestart(){ restart = true; }
+
+    // True once the audio device has actually reached a track the stream
+    // moved on to by itself
+    bool pollTransition(){
+        sf::Uint64 at = switchAt.load();
+        if(at == NO_SWITCH) return false;
+        if(getStatus() != sf::SoundSource::Status::Stopped && streamSamples() < at) return false;
+        base = at;
+        durationSec = nextDurationSec.load();
+        switchAt = NO_SWITCH;
+        return !switchSilent.exchange(false);
+    }
+
+    sf::Time getDuration() const{ return sf::seconds(durationSec.load()); }
+
+    // Position inside the audible track
+    sf::Time trackOffset() const{
+        if(!opened.load()) return sf::seconds(0);
+        sf::Uint64 s = streamSamples(), b = base.load();
+        sf::Uint64 at = switchAt.load();
+        if(at != NO_SWITCH && s >= at) b = at;
+        return sf::seconds((float)(s > b ? s - b : 0) / (getSampleRate() * getChannelCount()));
+    }
+
+    void setTrackOffset(sf::Time t){ setPlayingOffset(t); }
+
+    void setTap(SampleTap* t){ tap.store(t); }
+
+protected:
+    // Only this thread replaces active and incoming while the stream runs,
+    // and it holds m to do so; start and onSeek replace them while it is
+    // stopped. Other threads never read the pointers, only opened and
+    // fadeTag, so decoding and mixing run without the lock the UI thread
+    // contends on. Mapped 16-bit tracks are handed to SFML in place; it copies
+    // each chunk into its own buffer before the next call, so the pointer stays
+    // valid. Fades and converted tracks are mixed into buf.
+    bool onGetData(Chunk& data) override{
+        PROFILE_SCOPE("audio.mix");
+        retired.reset();
+        if(!active) return false;
+        countUnderrun();
+        unsigned ch = getChannelCount();
+        size_t frames = buf.size() / ch;
+        {
+            lock_guard<mutex> lock(m);
+            uint64_t fade = (uint64_t)(fadeSeconds.load() * getSampleRate());
+            if(pendingFade) beginFade(move(pendingFade), fade, true);
+            else if(!incoming && queued && fade){
+                uint64_t left = active->remaining();
+                if(left <= fade){
+                    beginFade(move(queued), left, false);
+                    queuedTagA = NIL;
+                }
+                // stop this chunk where the fade has to begin
+                else if(left - fade < frames) frames = (size_t)(left - fade);
+            }
+        }
+        const sf::Int16* out = buf.data();
+        size_t got;
+        if(incoming) got = mixFade(frames) * ch;
+        else if(active->passthrough()) got = active->track->next(buf.data(), frames * ch, out);
+        else{
+            fa.resize(frames * ch);
+            got = active->pull(fa.data(), frames) * ch;
+            rampMix(fa.data(), fa.data(), buf.data(), got / ch, ch, 1, 1, 0, 0);
+        }
+        bool more = got == frames * ch;
+        if(!more && !incoming){
+            lock_guard<mutex> lock(m);
+            if(queued && queued->sampleRate() == getSampleRate() && queued->channelCount() == ch){
+                switchAt = delivered + got;
+                nextDurationSec = queued->duration();
+                retired = move(active);
+                active.reset(new Voice(move(queued), getSampleRate(), ch));
+                queuedTagA = NIL;
+                fadeTag = NIL;
+                // a chunk already pointing into the old mapping ends here and
+                // the new track starts with the next one; a copied one is topped up
+                if(!got) got = active->track->next(buf.data(), buf.size(), out);
+                else if(out == buf.data()) got += active->track->read(buf.data() + got, buf.size() - got);
+                more = got > 0;
+            }
+        }
+        delivered += got;
+        slack += (double)got / (getSampleRate() * ch);
+        // this chunk queues behind the ones SFML already holds (three buffers)
+        if(SampleTap* t = tap.load(memory_order_relaxed))
+            t->push(out, got, ch, getSampleRate(), 3 * (uint64_t)got / ch);
+        data.samples = out;
+        data.sampleCount = got;
+        return more;
+    }
+
+    void onSeek(sf::Time t) override{
+        lock_guard<mutex> lock(m);
+        if(!active) return;
+        // a fade in progress ends at once in the track it was going to
+        if(incoming) active = move(incoming);
+        fadeTag = NIL;
+        // a change that was delivered but not yet heard becomes current now
+        if(switchAt != NO_SWITCH) switchAt = 0;
+        active->seek(t);
+        delivered = (sf::Uint64)(t.asSeconds() * getSampleRate()) * getChannelCount();
+        base = 0;
+        restart = true;
+    }
+
+private:
+    mutex m;
+    unique_ptr<Voice> active;
+    unique_ptr<Voice> incoming;                // fading in over active
+    unique_ptr<Voice> retired;                 // spliced out; its mapping may back the chunk just returned
+    unique_ptr<PreparedTrack> queued;
+    unique_ptr<PreparedTrack> pendingFade;     // crossfadeTo target, picked up by the next chunk
+    vector<sf::Int16> buf;
+    vector<float> fa, fb;                      // float mix buffers
+    uint64_t fadeLen = 0, fadePos = 0;         // frames
+    sf::Uint64 delivered = 0;                  // stream samples handed to the device
+    atomic<sf::Uint64> base{0};                // stream sample where the audible track began
+    atomic<sf::Uint64> switchAt{NO_SWITCH};    // stream sample of a pending change
+    atomic<bool> switchSilent{false};          // pending change was asked for, not automatic
+    atomic<float> durationSec{0};
+    atomic<float> nextDurationSec{0};
+    atomic<uint32_t> queuedTagA{NIL};
+    atomic<uint32_t> fadeTag{NIL};             // tag of incoming while a fade runs, else NIL
+    string fadePath;                           // and its path; under m
+    atomic<bool> opened{false};                // start has given the stream a track
+    atomic<SampleTap*> tap{nullptr};
+    atomic<float> fadeSeconds{0};
+    atomic<int> fadeShape{(int)FadeShape::EqualPower};
+    atomic<unsigned long long> underrunCount{0};
+    atomic<bool> restart{true};
+    double slack = 0;                          // seconds of audio queued ahead of the device
+    chrono::steady_clock::time_point lastCall;
+
+    sf::Uint64 streamSamples() const{
+        return (sf::Uint64)(getPlayingOffset().asSeconds() * getSampleRate()) * getChannelCount();
+    }
+
+    // Called with m held. A fade while another is running continues from the
+    // track that was coming in.
+    void beginFade(unique_ptr<PreparedTrack> t, uint64_t frames, bool silent){
+        if(incoming) active = move(incoming);
+        nextDurationSec = t->duration();
+        fadeTag = t->tag;
+        fadePath = t->path;
+        incoming.reset(new Voice(move(t), getSampleRate(), getChannelCount()));
+        fadeLen = max<uint64_t>(1, frames);
+        fadePos = 0;
+        switchAt = delivered;
+        switchSilent = silent;
+    }
+
+    // Sums up to frames of the outgoing and incoming track into buf along the
+    // fade curve; once it has run its length the incoming track takes over
+    size_t mixFade(size_t frames){
+        unsigned ch = getChannelCount();
+        fa.assign(frames * ch, 0.0f);
+        fb.assign(frames * ch, 0.0f);
+        size_t ga = active->pull(fa.data(), frames);
+        size_t gb = incoming->pull(fb.data(), frames);
+        size_t n = max(ga, gb);
+        FadeShape shape = (FadeShape)fadeShape.load();
+        for(size_t f = 0; f < n; f += FADE_STEP){
+            size_t k = min(FADE_STEP, n - f);
+            float a0, a1, b0, b1;
+            fadeGains(shape, (float)fadePos / fadeLen, a0, b0);
+            fadePos = min(fadePos + k, fadeLen);
+            fadeGains(shape, (float)fadePos / fadeLen, a1, b1);
+            rampMix(fa.data() + f*ch, fb.data() + f*ch, buf.data() + f*ch, k, ch, a0, a1, b0, b1);
+        }
+        if(fadePos >= fadeLen){
+            lock_guard<mutex> lock(m);
+            retired = move(active);
+            active = move(incoming);
+            fadeTag = NIL;
+        }
+        return n;
+    }
+
+    // The device has drained what was queued if more wall time passed since
+    // the last call than the audio handed over covers
+    void countUnderrun(){
+        auto now = chrono::steady_clock::now();
+        if(restart.exchange(false)) slack = 0;
+        else{
+            slack -= chrono::duration<double>(now - lastCall).count();
+            if(slack < 0){
+                underrunCount++;
+                slack = 0;
+            }
+        }
+        lastCall = now;
+    }
+};
+
+// Single worker that opens and pre-buffers the upcoming track off the UI thread.
+// Only the most recent request matters; stale results are thrown away.
+class Prefetcher{
+public:
+    Prefetcher(){ worker = thread(&Prefetcher::run, this); }
+
+    ~Prefetcher(){
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+    }
+
+    void request(const string& path, uint32_t tag){
+        {
+            lock_guard<mutex> lock(m);
+            if(wantTag == tag && wantPath == path) return; // already fetched or failed
+            wantPath = path;
+            wantTag = tag;
+            pending = true;
+            done.reset();
+        }
+        cv.notify_one();
+    }
+
+    // The finished track for tag, or nullptr if it is not ready
+    unique_ptr<PreparedTrack> take(uint32_t tag){
+        lock_guard<mutex> lock(m);
+        if(!done || done->tag != tag) return nullptr;
+        return move(done);
+    }
+
+private:
+    thread worker;
+    mutex m;
+    condition_variable cv;
+    bool quit = false;
+    bool pending = false;
+    string wantPath;
+    uint32_t wantTag = 0xFFFFFFFFu;
+    unique_ptr<PreparedTrack> done;
+
+    void run(){
+        unique_lock<mutex> lock(m);
+        while(true){
+            cv.wait(lock, [this]{ return quit || pending; });
+            if(quit) return;
+            pending = false;
+            string path = wantPath;
+            uint32_t tag = wantTag;
+            lock.unlock();
+            unique_ptr<PreparedTrack> t = PreparedTrack::open(path, tag);
+            lock.lock();
+            if(t && tag == wantTag && path == wantPath) done = move(t);
+        }
+    }
+};
@@ -0,0 +1,192 @@
+// Open and seek latency of the WAV readers a track can go through: MappedWav
+// (what PreparedTrack uses for PCM WAV), WavReader (stdio) and, when SFML is
+// there to link against, sf::InputSoundFile, the decoder every track went
+// through before the mapping. An open is timed with the first half second
+// read, the way PreparedTrack warms a track; a seek with the first 100 ms
+// chunk after it, touched sample by sample. Without a file argument a five
+// minute 44.1 kHz stereo WAV is written to wavbench.wav and removed after,
+// so it is timed from the page cache.
+//
+//   wavbench [file.wav] [seeks]
+//   (with SFML: g++ -std=c++17 -O2 wavbench.cpp -lsfml-audio -lsfml-system)
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "mappedwav.h"
+#include "wavreader.h"
+#if !defined(SOUNDLIST_NO_SFML) && __has_include(<SFML/Audio.hpp>)
+#include <SFML/Audio.hpp>
+#define WAVBENCH_SFML 1
+#endif
+using namespace std;
+
+const int OPENS = 200;
+const unsigned GEN_RATE = 44100, GEN_CHANNELS = 2, GEN_SECONDS = 300;
+volatile int sink;    // keeps the reads from being optimized out
+
+static double usSince(chrono::steady_clock::time_point t){
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - t).count();
+}
+
+static void putLE(unsigned char* p, uint32_t v, int bytes){ for(int i = 0; i < bytes; i++) p[i] = (unsigned char)(v >> (8*i)); }
+
+// 16-bit PCM: a tone with a little noise, so no page is all zeros
+static bool writeWav(const string& path){
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f) return false;
+    uint32_t frames = GEN_RATE * GEN_SECONDS, data = frames * GEN_CHANNELS * 2;
+    unsigned char h[44];
+    memcpy(h, "RIFF", 4);
+    putLE(h + 4, 36 + data, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    putLE(h + 16, 16, 4);
+    putLE(h + 20, 1, 2);
+    putLE(h + 22, GEN_CHANNELS, 2);
+    putLE(h + 24, GEN_RATE, 4);
+    putLE(h + 28, GEN_RATE * GEN_CHANNELS * 2, 4);
+    putLE(h + 32, GEN_CHANNELS * 2, 2);
+    putLE(h + 34, 16, 2);
+    memcpy(h + 36, "data", 4);
+    putLE(h + 40, data, 4);
+    fwrite(h, 1, sizeof h, f);
+    mt19937 rng(7);
+    vector<int16_t> block(GEN_RATE * GEN_CHANNELS);
+    for(uint32_t s = 0; s < GEN_SECONDS; s++){
+        for(uint32_t i = 0; i < GEN_RATE; i++){
+            int16_t v = (int16_t)(8000 * sin(2 * 3.14159265 * 440 * i / GEN_RATE) + (int)(rng() % 512) - 256);
+            for(unsigned c = 0; c < GEN_CHANNELS; c++) block[i * GEN_CHANNELS + c] = v;
+        }
+        fwrite(block.data(), sizeof(int16_t), block.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+static int touch(const int16_t* p, size_t n){
+    int sum = 0;
+    for(size_t i = 0; i < n; i++) sum += p[i];
+    return sum;
+}
+
+struct Timing{
+    double mean = 0, worst = 0;
+    void add(double us, int count){
+        mean += us / count;
+        worst = max(worst, us);
+    }
+};
+
+static void report(const char* name, const Timing& open, const Timing& seek){
+    printf("  %-18s open %9.1f us (worst %9.1f), seek + first chunk %8.1f us (worst %9.1f)\n", name, open.mean,
+           open.worst, seek.mean, seek.worst);
+}
+
+int main(int argc, char** argv){
+    string path = argc > 1 ? argv[1] : "wavbench.wav";
+    int seeks = argc > 2 ? atoi(argv[2]) : 1000;
+    bool generated = argc < 2;
+    if(generated && !writeWav(path)){ printf("cannot write %s\n", path.c_str()); return 1; }
+
+    MappedWav probe;
+    if(!probe.open(path)){ printf("%s is not a PCM WAV either reader takes\n", path.c_str()); return 1; }
+    WavInfo info = probe.info;
+    size_t head = info.sampleRate / 2, chunk = info.sampleRate / 10;   // frames
+    mt19937 rng(7);
+    vector<uint64_t> at(seeks);
+    for(uint64_t& f : at) f = rng() % (probe.frames() - chunk);
+    vector<int16_t> buf(head * info.channels);
+    printf("%s: %u Hz, %u channels, %u bits, %.1f s, %d opens, %d seeks\n", path.c_str(), info.sampleRate,
+           info.channels, info.bitsPerSample, info.duration(), OPENS, seeks);
+
+    // the mapping against stdio, sample for sample, at every seek position
+    bool same = true;
+    {
+        MappedWav m;
+        WavReader r;
+        m.open(path);
+        r.open(path);
+        vector<int16_t> a(chunk * info.channels), b(chunk * info.channels);
+        for(uint64_t f : at){
+            m.seekFrame(f);
+            r.seekFrame(f);
+            m.readFrames(a.data(), chunk);
+            r.readFrames(b.data(), chunk);
+            same = same && a == b;
+        }
+    }
+
+    Timing open, seek;
+    for(int i = 0; i < OPENS; i++){
+        auto t = chrono::steady_clock::now();
+        MappedWav m;
+        m.open(path);
+        m.warm(head);
+        open.add(usSince(t), OPENS);
+    }
+    {
+        MappedWav m;
+        m.open(path);
+        for(uint64_t f : at){
+            auto t = chrono::steady_clock::now();
+            m.seekFrame(f);
+            const int16_t* p = buf.data();
+            size_t got = m.direct() ? m.view(chunk, p) : m.readFrames(buf.data(), chunk);
+            sink = touch(p, got * info.channels);
+            seek.add(usSince(t), seeks);
+        }
+    }
+    report("MappedWav", open, seek);
+
+    open = seek = Timing();
+    for(int i = 0; i < OPENS; i++){
+        auto t = chrono::steady_clock::now();
+        WavReader r;
+        r.open(path);
+        sink = touch(buf.data(), r.readFrames(buf.data(), head) * info.channels);
+        open.add(usSince(t), OPENS);
+    }
+    {
+        WavReader r;
+        r.open(path);
+        for(uint64_t f : at){
+            auto t = chrono::steady_clock::now();
+            r.seekFrame(f);
+            sink = touch(buf.data(), r.readFrames(buf.data(), chunk) * info.channels);
+            seek.add(usSince(t), seeks);
+        }
+    }
+    report("WavReader", open, seek);
+
+#ifdef WAVBENCH_SFML
+    open = seek = Timing();
+    vector<sf::Int16> samples(head * info.channels);
+    for(int i = 0; i < OPENS; i++){
+        auto t = chrono::steady_clock::now();
+        sf::InputSoundFile s;
+        s.openFromFile(path);
+        sink = touch(samples.data(), (size_t)s.read(samples.data(), samples.size()));
+        open.add(usSince(t), OPENS);
+    }
+    {
+        sf::InputSoundFile s;
+        s.openFromFile(path);
+        for(uint64_t f : at){
+            auto t = chrono::steady_clock::now();
+            s.seek(f * info.channels);
+            sink = touch(samples.data(), (size_t)s.read(samples.data(), chunk * info.channels));
+            seek.add(usSince(t), seeks);
+        }
+    }
+    report("sf::InputSoundFile", open, seek);
+#else
+    printf("  sf::InputSoundFile not timed: built without SFML\n");
+#endif
+
+    if(!same) printf("  MappedWav and WavReader DISAGREE on the samples after a seek\n");
+    if(generated) remove(path.c_str());
+    return same ? 0 : 1;
+}
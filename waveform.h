@@ -0,0 +1,246 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+#include "wavreader.h"
+#include "threadpool.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+// Min/max overview of a whole track. Level 0 holds one (min, max) pair per
+// BLOCK frames of the mono mix; every further level halves the resolution,
+// down to a single pair, so any bar width is drawn from about as many bins
+// as it has pixels.
+struct WavePeaks{
+    static constexpr uint32_t BLOCK = 256;
+
+    uint64_t frames = 0;
+    uint32_t sampleRate = 0;
+    vector<vector<int8_t>> levels;   // interleaved min, max
+
+    void buildLevels(){
+        levels.resize(1);
+        while(levels.back().size() > 2){
+            const vector<int8_t>& src = levels.back();
+            size_t bins = src.size() / 2;
+            vector<int8_t> dst((bins + 1) / 2 * 2);
+            for(size_t i = 0; i < bins; i += 2){
+                int8_t lo = src[2*i], hi = src[2*i + 1];
+                if(i + 1 < bins){ lo = min(lo, src[2*i + 2]); hi = max(hi, src[2*i + 3]); }
+                dst[i] = lo;
+                dst[i + 1] = hi;
+            }
+            levels.push_back(move(dst));
+        }
+    }
+
+    // width (min, max) columns into out, from the coarsest level that still
+    // has at least one bin per column
+    void columns(int width, vector<int8_t>& out) const{
+        out.assign(max(0, width) * 2, 0);
+        if(width <= 0 || levels.empty() || levels[0].empty()) return;
+        size_t lv = 0;
+        while(lv + 1 < levels.size() && levels[lv + 1].size() / 2 >= (size_t)width) lv++;
+        const vector<int8_t>& src = levels[lv];
+        size_t bins = src.size() / 2;
+        for(int x = 0; x < width; x++){
+            size_t a = bins * x / width, b = max(a + 1, bins * (x + 1) / width);
+            int8_t lo = 127, hi = -128;
+            for(size_t i = a; i < b && i < bins; i++){ lo = min(lo, src[2*i]); hi = max(hi, src[2*i + 1]); }
+            out[2*x] = lo;
+            out[2*x + 1] = hi;
+        }
+    }
+};
+
+// Builds peak pyramids off the caller's thread and keeps them in memory and in
+// a cache directory, one small file per track keyed by path, size and mtime.
+// get() never waits: it returns what is ready and queues the rest. Everything
+// queued since the last batch is generated in parallel, one track per core.
+class WaveformCache{
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t MEMORY_TRACKS = 64;
+
+    explicit WaveformCache(const string& dir = "waveforms") : dir(dir){
+        worker = thread(&WaveformCache::run, this);
+    }
+
+    ~WaveformCache(){
+        { lock_guard<mutex> lock(m); quit = true; }
+        cv.notify_one();
+        worker.join();
+    }
+
+    // Tracks queued and not built yet: their peaks will still show up
+    bool busy(){
+        lock_guard<mutex> lock(m);
+        return !queued.empty();
+    }
+
+    // Ready pyramid for path, or nullptr after queueing it
+    shared_ptr<const WavePeaks> get(const string& path){
+        if(path.empty()) return nullptr;
+        {
+            lock_guard<mutex> lock(m);
+            auto it = ready.find(path);
+            if(it != ready.end()) return it->second;
+            if(!failed.count(path) && queued.insert(path).second) pending.push_back(path);
+        }
+        cv.notify_one();
+        return nullptr;
+    }
+
+private:
+    string dir;
+    mutex m;
+    condition_variable cv;
+    thread worker;
+    bool quit = false;
+    unordered_map<string, shared_ptr<const WavePeaks>> ready;
+    deque<string> order;                    // eviction order for ready
+    unordered_set<string> queued;           // pending or being built
+    unordered_set<string> failed;           // not a readable WAV; don't retry
+    vector<string> pending;
+
+#pragma pack(push, 1)
+    struct FileHeader{
+        char magic[4];        // "SLWF"
+        uint32_t version;
+        uint64_t size;        // of the source file
+        int64_t mtime;
+        uint64_t frames;
+        uint32_t sampleRate;
+        uint32_t bins;        // level 0 pairs that follow
+    };
+#pragma pack(pop)
+
+    void run(){
+        unique_lock<mutex> lock(m);
+        while(true){
+            cv.wait(lock, [this]{ return quit || !pending.empty(); });
+            if(quit) return;
+            vector<string> batch;
+            batch.swap(pending);
+            lock.unlock();
+            vector<shared_ptr<const WavePeaks>> built(batch.size());
+            parallelFor(batch.size(), [&](size_t i){ built[i] = loadOrBuild(batch[i]); });
+            lock.lock();
+            for(size_t i = 0; i < batch.size(); i++){
+                queued.erase(batch[i]);
+                if(!built[i]){ failed.insert(batch[i]); continue; }
+                if(ready.emplace(batch[i], built[i]).second) order.push_back(batch[i]);
+                while(order.size() > MEMORY_TRACKS){ ready.erase(order.front()); order.pop_front(); }
+            }
+        }
+    }
+
+    string cacheFile(const string& path) const{
+        uint64_t h = 1469598103934665603ull;    // FNV-1a
+        for(unsigned char c : path){ h ^= c; h *= 1099511628211ull; }
+        char name[32];
+        snprintf(name, sizeof name, "%016llx.pk", (unsigned long long)h);
+        return (fs::path(dir) / name).string();
+    }
+
+    shared_ptr<const WavePeaks> loadOrBuild(const string& path){
+        error_code ec;
+        uint64_t size = fs::file_size(path, ec);
+        if(ec) return nullptr;
+        int64_t mtime = (int64_t)fs::last_write_time(path, ec).time_since_epoch().count();
+        if(ec) return nullptr;
+        string file = cacheFile(path);
+        shared_ptr<WavePeaks> p = load(file, size, mtime);
+        if(p) return p;
+        p = build(path);
+        if(p) save(file, *p, size, mtime);
+        return p;
+    }
+
+    static shared_ptr<WavePeaks> load(const string& file, uint64_t size, int64_t mtime){
+        FILE* f = fopen(file.c_str(), "rb");
+        if(!f) return nullptr;
+        FileHeader h;
+        shared_ptr<WavePeaks> p;
+        if(fread(&h, sizeof h, 1, f) == 1 && memcmp(h.magic, "SLWF", 4) == 0 &&
+           h.version == VERSION && h.size == size && h.mtime == mtime){
+            p = make_shared<WavePeaks>();
+            p->frames = h.frames;
+            p->sampleRate = h.sampleRate;
+            p->levels.assign(1, vector<int8_t>((size_t)h.bins * 2));
+            if(fread(p->levels[0].data(), 1, p->levels[0].size(), f) == p->levels[0].size()) p->buildLevels();
+            else p.reset();
+        }
+        fclose(f);
+        return p;
+    }
+
+    // Written under a temp name and renamed, so a crash never leaves half a file
+    void save(const string& file, const WavePeaks& p, uint64_t size, int64_t mtime) const{
+        error_code ec;
+        fs::create_directories(dir, ec);
+        string tmp = file + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return;
+        FileHeader h;
+        memcpy(h.magic, "SLWF", 4);
+        h.version = VERSION;
+        h.size = size;
+        h.mtime = mtime;
+        h.frames = p.frames;
+        h.sampleRate = p.sampleRate;
+        h.bins = (uint32_t)(p.levels[0].size() / 2);
+        fwrite(&h, sizeof h, 1, f);
+        fwrite(p.levels[0].data(), 1, p.levels[0].size(), f);
+        bool good = ferror(f) == 0;
+        good = fclose(f) == 0 && good;
+        if(good) fs::rename(tmp, file, ec);
+        else fs::remove(tmp, ec);
+    }
+
+    static shared_ptr<WavePeaks> build(const string& path){
+        WavReader r;
+        if(!r.open(path) || !r.info.channels) return nullptr;
+        shared_ptr<WavePeaks> p = make_shared<WavePeaks>();
+        p->frames = r.frames();
+        p->sampleRate = r.info.sampleRate;
+        unsigned ch = r.info.channels;
+        vector<int8_t>& out = p->levels.emplace_back();
+        out.reserve((size_t)((p->frames + WavePeaks::BLOCK - 1) / WavePeaks::BLOCK) * 2);
+        vector<int16_t> buf((size_t)WavePeaks::BLOCK * 64 * ch);
+        int lo = 32767, hi = -32768;
+        uint32_t inBlock = 0;
+        size_t got;
+        while((got = r.readFrames(buf.data(), buf.size() / ch)) > 0){
+            for(size_t i = 0; i < got; i++){
+                int sum = 0;
+                for(unsigned c = 0; c < ch; c++) sum += buf[i*ch + c];
+                int v = sum / (int)ch;
+                lo = min(lo, v);
+                hi = max(hi, v);
+                if(++inBlock == WavePeaks::BLOCK){
+                    out.push_back((int8_t)(lo >> 8));
+                    out.push_back((int8_t)(hi >> 8));
+                    lo = 32767; hi = -32768; inBlock = 0;
+                }
+            }
+        }
+        if(inBlock){
+            out.push_back((int8_t)(lo >> 8));
+            out.push_back((int8_t)(hi >> 8));
+        }
+        p->buildLevels();
+        return p;
+    }
+};
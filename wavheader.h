@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Layout of a RIFF/WAVE file as far as playback cares — no audio is decoded
+struct WavInfo{
+    uint16_t format = 0;          // 1 = PCM, 3 = IEEE float (extensible files report their sub-format)
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitsPerSample = 0;
+    uint16_t blockAlign = 0;      // bytes per frame
+    uint64_t dataOffset = 0;      // file offset of the first sample
+    uint64_t dataBytes = 0;
+
+    uint64_t frames() const{ return blockAlign ? dataBytes / blockAlign : 0; }
+    float duration() const{ return sampleRate ? (float)frames() / sampleRate : 0.0f; }
+};
+
+static inline uint32_t wavLE32(const unsigned char* p){ return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24; }
+static inline uint16_t wavLE16(const unsigned char* p){ return (uint16_t)(p[0] | p[1]<<8); }
+
+// Walks the RIFF chunk list through readAt(offset, dst, bytes) -> bytes read,
+// so it works the same over a FILE* or a memory mapping.
+template<class ReadAt>
+bool parseWavHeader(ReadAt readAt, uint64_t fileSize, WavInfo& out){
+    unsigned char hdr[12];
+    if(readAt(0, hdr, 12) != 12) return false;
+    if(memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr+8, "WAVE", 4) != 0) return false;
+    bool haveFmt = false;
+    uint64_t pos = 12;
+    while(pos + 8 <= fileSize){
+        unsigned char ck[8];
+        if(readAt(pos, ck, 8) != 8) return false;
+        uint64_t len = wavLE32(ck+4);
+        if(memcmp(ck, "fmt ", 4) == 0){
+            unsigned char f[16];
+            if(len < 16 || readAt(pos+8, f, 16) != 16) return false;
+            out.format = wavLE16(f);
+            out.channels = wavLE16(f+2);
+            out.sampleRate = wavLE32(f+4);
+            out.blockAlign = wavLE16(f+12);
+            out.bitsPerSample = wavLE16(f+14);
+            if(out.format == 0xFFFE && len >= 40){
+                unsigned char sub[2];   // first two bytes of the sub-format GUID
+                if(readAt(pos+8+24, sub, 2) != 2) return false;
+                out.format = wavLE16(sub);
+            }
+            haveFmt = true;
+        } else if(memcmp(ck, "data", 4) == 0){
+            if(!haveFmt || !out.channels || !out.blockAlign) return false;
+            out.dataOffset = pos + 8;
+            // streamed writers leave 0 or 0xFFFFFFFF here; trust the file size instead
+            if(len == 0 || len == 0xFFFFFFFFu || out.dataOffset + len > fileSize) len = fileSize - out.dataOffset;
+            out.dataBytes = len - len % out.blockAlign;
+            return true;
+        }
+        pos += 8 + len + (len & 1);  // chunks are word aligned
+    }
+    return false;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "wavheader.h"
+using namespace std;
+
+// Formats the readers below can turn into 16-bit samples
+inline bool wavDecodable(const WavInfo& w){
+    int bytes = w.bitsPerSample / 8;
+    return (w.format == 1 || (w.format == 3 && bytes == 4)) &&
+           bytes >= 1 && bytes <= 4 && w.blockAlign == bytes * w.channels && w.sampleRate;
+}
+
+// samples values of a decodable WAV's sample format -> 16-bit
+inline void wavToInt16(const WavInfo& w, const unsigned char* p, size_t samples, int16_t* out){
+    int bytes = w.bitsPerSample / 8;
+    for(size_t i = 0; i < samples; i++, p += bytes){
+        switch(bytes){
+            case 1: out[i] = (int16_t)((p[0] - 128) * 256); break;
+            case 2: out[i] = (int16_t)(p[0] | p[1] << 8); break;
+            case 3: out[i] = (int16_t)(p[1] | p[2] << 8); break;
+            default:
+                if(w.format == 3){
+                    float v;
+                    memcpy(&v, p, 4);
+                    v = v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v);
+                    out[i] = (int16_t)(v * 32767.0f);
+                } else {
+                    out[i] = (int16_t)(p[2] | p[3] << 8);
+                }
+        }
+    }
+}
+
+// Buffered PCM reader for uncompressed WAV. Any 8/16/24/32-bit integer or
+// 32-bit float input comes out as interleaved 16-bit samples.
+class WavReader{
+public:
+    WavInfo info;
+
+    ~WavReader(){ close(); }
+
+    bool open(const string& path){
+        close();
+        f = fopen(path.c_str(), "rb");
+        if(!f) return false;
+        fseek64(0, SEEK_END);
+        uint64_t size = tell64();
+        bool ok = parseWavHeader([this](uint64_t off, void* dst, size_t n) -> size_t{
+            if(fseek64(off, SEEK_SET) != 0) return 0;
+            return fread(dst, 1, n, f);
+        }, size, info);
+        if(!ok || !wavDecodable(info)){ close(); return false; }
+        return seekFrame(0);
+    }
+
+    void close(){
+        if(f) fclose(f);
+        f = nullptr;
+        pos = 0;
+    }
+
+    uint64_t frames() const{ return info.frames(); }
+    uint64_t tell() const{ return pos; }
+
+    bool seekFrame(uint64_t frame){
+        if(!f) return false;
+        if(frame > frames()) frame = frames();
+        pos = frame;
+        return fseek64(info.dataOffset + frame * info.blockAlign, SEEK_SET) == 0;
+    }
+
+    // Reads up to count frames into out (count * channels samples)
+    size_t readFrames(int16_t* out, size_t count){
+        if(!f) return 0;
+        count = (size_t)min<uint64_t>(count, frames() - pos);
+        raw.resize(count * info.blockAlign);
+        size_t got = fread(raw.data(), info.blockAlign, count, f);
+        wavToInt16(info, raw.data(), got * info.channels, out);
+        pos += got;
+        return got;
+    }
+
+private:
+    FILE* f = nullptr;
+    uint64_t pos = 0;
+    vector<unsigned char> raw;
+
+    int fseek64(uint64_t off, int whence){
+#ifdef _WIN32
+        return _fseeki64(f, (long long)off, whence);
+#else
+        return fseeko(f, (off_t)off, whence);
+#endif
+    }
+
+    uint64_t tell64(){
+#ifdef _WIN32
+        return (uint64_t)_ftelli64(f);
+#else
+        return (uint64_t)ftello(f);
+#endif
+    }
+};